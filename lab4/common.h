@@ -7,49 +7,103 @@
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
-#include <sys/sem.h>
 #include <sys/shm.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <limits.h>
 #include <signal.h>
 #include <errno.h> // For errno checking
 #include <time.h>  // For nanosleep (if needed later)
 
 // --- Configuration ---
-#define QUEUE_SIZE 10             // Number of slots in the queue
-#define MAX_MESSAGE_DATA_SIZE 255 // Maximum size for the *data* part (0-255 for unsigned char size)
-// Calculate total size needed per slot in shared memory
+#define QUEUE_BYTES (256 * 1024)            // Size of the shared byte ring
+#define QUEUE_CELL 32                       // Allocation unit: records take whole cells
+#define QUEUE_CELLS (QUEUE_BYTES / QUEUE_CELL)
+#define MAX_MESSAGE_DATA_SIZE (16 * 1024)   // Maximum size for the *data* part
+#define DEFAULT_MESSAGE_DATA_SIZE 255       // Producer's default upper bound for random sizes
+// Largest message (header + data) a single record can carry
 #define MAX_MESSAGE_SIZE (sizeof(MessageHeader) + MAX_MESSAGE_DATA_SIZE)
 #define IPC_KEY_PATH "/tmp/ipc_key_file" // Ensure this file exists! (touch /tmp/ipc_key_file)
 #define IPC_KEY_ID 'Q'
 
-// Semaphore indices (Must be consistent across all files)
-#define SEM_EMPTY_SLOTS 0  // Counts empty slots (producer waits/decrements, consumer signals/increments)
-#define SEM_FILLED_SLOTS 1 // Counts filled slots (consumer waits/decrements, producer signals/increments)
-#define SEM_MUTEX 2        // Binary semaphore for mutual exclusion accessing the queue structure
+#define QUEUE_WAIT_MS 100 // Blocked processes recheck 'running' this often
+#define CACHE_LINE 64
+
+// The queue lives in SysV shared memory used by unrelated processes, so every
+// atomic in it must be lock-free (no process-local locks hidden behind it).
+_Static_assert(ATOMIC_LONG_LOCK_FREE == 2, "queue positions must be lock-free");
+_Static_assert(ATOMIC_INT_LOCK_FREE == 2, "futex words must be lock-free");
 
 // --- Message Structure ---
-// Header placed at the beginning of each slot in the shared buffer.
+// Header placed at the beginning of each message payload in the shared ring.
 typedef struct
 {
     char type;           // Message type (optional, example usage)
     unsigned short hash; // Hash computed by the producer over type, size, and data
-    unsigned char size;  // Size of the *data* field ONLY (0 to 255)
+    uint32_t size;       // Size of the *data* field ONLY (0 to MAX_MESSAGE_DATA_SIZE)
 } MessageHeader;
 
 // --- Shared Memory Queue Structure ---
+// Lock-free MPMC ring of variable-length records. Positions count cells and
+// only grow; a record occupies whole consecutive cells and never wraps: if it
+// doesn't fit before the end of the buffer, the producer also claims the
+// cells up to the end as padding, which consumers skip.
+//
+// Each record's first cell has a state word, kept outside 'buffer' so that
+// payload bytes can never be mistaken for it. As with Vyukov's per-slot
+// sequence numbers the word includes the position, so marks left from an
+// earlier lap never match:
+//   CELL_MARK(pos, CELL_COMMITTED) - producer finished writing the record
+//   CELL_MARK(pos, CELL_RELEASED)  - consumer is done with it
+//   CELL_MARK(pos, CELL_PAD)       - padding up to the end of the buffer
+// Producers claim cells with a CAS on 'tail', consumers with a CAS on 'head',
+// and both then work on the record in place. Cells are reused only once every
+// record before them is released ('reclaimed'), so a slow consumer holding a
+// record in place holds back reuse of the space after it.
+enum
+{
+    CELL_COMMITTED = 1,
+    CELL_RELEASED = 2,
+    CELL_PAD = 3
+};
+#define CELL_MARK(pos, state) ((pos) * 4 + (state))
+
+// Placed at the start of each record, followed by the payload
 typedef struct
 {
-    // Control variables for the ring buffer
-    int head; // Index to read from next (consumed by consumer)
-    int tail; // Index to write to next (filled by producer)
+    uint32_t cells; // Record length in cells, this header included
+    uint32_t len;   // Payload bytes
+} RecordHeader;
 
-    // Message storage area within shared memory
-    // Each slot holds a complete message (header + data up to MAX_MESSAGE_DATA_SIZE)
-    char buffer[QUEUE_SIZE][MAX_MESSAGE_SIZE];
+// Any record must fit even after the worst padding
+#define QUEUE_MAX_PAYLOAD (QUEUE_BYTES / 2 - sizeof(RecordHeader))
+_Static_assert(MAX_MESSAGE_SIZE <= QUEUE_MAX_PAYLOAD, "messages must fit in the ring");
 
-    // Note: Removed producer/consumer counts from shared memory
-    // as managing them atomically and reliably is complex and better
-    // handled by the main process locally if needed for spawning/killing.
+typedef struct
+{
+    // Kept on separate cache lines so producers and consumers don't contend
+    _Alignas(CACHE_LINE) atomic_size_t head;      // Next cell to read (consumers)
+    _Alignas(CACHE_LINE) atomic_size_t tail;      // Next cell to reserve (producers)
+    _Alignas(CACHE_LINE) atomic_size_t reclaimed; // Cells before this one are free to reuse
 
+    // Futex words: bumped when a record is committed/space is reclaimed while
+    // someone sleeps. The flags say someone may sleep; the first waker clears
+    // the flag, so the fast path makes no syscalls even while the woken side
+    // is waiting for a CPU.
+    _Alignas(CACHE_LINE) atomic_uint items_event;
+    atomic_uint items_waiting; // Consumers may sleep on an empty queue
+    atomic_uint space_event;
+    atomic_uint space_waiting; // Producers may sleep on a full queue
+
+    _Alignas(CACHE_LINE) atomic_size_t cell_state[QUEUE_CELLS];
+    _Alignas(CACHE_LINE) char buffer[QUEUE_BYTES];
+
+    // Note: a process killed with SIGKILL between reserve and commit (or peek
+    // and release) stalls the queue at that record, like a lock held by a
+    // killed process. SIGTERM/SIGINT only set 'running', so records are always
+    // committed and released.
 } Queue;
 
 // --- Global variable for signal handling (used by producer/consumer) ---
@@ -66,11 +120,11 @@ static inline unsigned short compute_hash(const MessageHeader *header, const cha
 
     // Simple XOR hash combining type, size, and data bytes
     hash ^= (unsigned short)(unsigned char)header->type; // Include type
-    hash ^= (unsigned short)header->size;                // Include size
+    hash ^= (unsigned short)(header->size ^ (header->size >> 16)); // Include size
 
     // Include data bytes (up to header->size)
     // Boundary check just in case, though producer should ensure size <= MAX_MESSAGE_DATA_SIZE
-    unsigned char data_len = header->size;
+    uint32_t data_len = header->size;
     if (data_len > MAX_MESSAGE_DATA_SIZE)
     {
         data_len = MAX_MESSAGE_DATA_SIZE; // Avoid reading out of bounds
@@ -84,30 +138,224 @@ static inline unsigned short compute_hash(const MessageHeader *header, const cha
     return hash;
 }
 
-// --- Semaphore Operations ---
-// Wrapper for semop with error checking and EINTR handling
-static inline int sem_op(int semid, int sem_num, int op)
+// --- Futex Helpers ---
+// Shared (not FUTEX_PRIVATE) operations: the word is in memory mapped by
+// several processes.
+static inline void futex_wait(atomic_uint *word, unsigned int expected)
+{
+    struct timespec timeout = {0, QUEUE_WAIT_MS * 1000000L};
+    // EAGAIN (word already changed), EINTR (signal) and ETIMEDOUT all just
+    // make the caller recheck the queue and the 'running' flag
+    syscall(SYS_futex, (unsigned int *)word, FUTEX_WAIT, expected, &timeout, NULL, 0);
+}
+
+static inline void futex_wake(atomic_uint *word, int count)
+{
+    syscall(SYS_futex, (unsigned int *)word, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+// --- Queue Operations ---
+// Must be called once (by main) before any producer or consumer attaches.
+static inline void queue_init(Queue *q)
+{
+    atomic_init(&q->head, 0);
+    atomic_init(&q->tail, 0);
+    atomic_init(&q->reclaimed, 0);
+    atomic_init(&q->items_event, 0);
+    atomic_init(&q->items_waiting, 0);
+    atomic_init(&q->space_event, 0);
+    atomic_init(&q->space_waiting, 0);
+    for (size_t i = 0; i < QUEUE_CELLS; ++i)
+    {
+        atomic_init(&q->cell_state[i], 0); // Matches no CELL_MARK
+    }
+}
+
+static inline RecordHeader *queue_record(Queue *q, size_t pos)
+{
+    return (RecordHeader *)(q->buffer + (pos % QUEUE_CELLS) * QUEUE_CELL);
+}
+
+// Wake the sleepers after publishing a change. The seq_cst fence pairs with
+// the one in queue_raise_flag: either we see the flag, or the waiter's retry
+// sees our change before it goes to sleep.
+static inline void queue_notify(atomic_uint *event, atomic_uint *waiting)
+{
+    atomic_thread_fence(memory_order_seq_cst);
+    if (atomic_load_explicit(waiting, memory_order_relaxed) && atomic_exchange(waiting, 0))
+    {
+        atomic_fetch_add(event, 1);
+        futex_wake(event, INT_MAX);
+    }
+}
+
+// Returns the current 'event' to wait on. It is read before the flag is
+// raised: if a waker clears the flag after that, it also bumps 'event' and
+// the futex wait returns at once. The caller must retry once more before
+// sleeping.
+static inline unsigned int queue_raise_flag(atomic_uint *event, atomic_uint *waiting)
+{
+    unsigned int ev = atomic_load(event);
+    atomic_store(waiting, 1);
+    atomic_thread_fence(memory_order_seq_cst);
+    return ev;
+}
+
+// Moves 'reclaimed' over released records and padding, never past 'head'.
+// Returns 1 if it freed any space. Stale reads of a reused cell are harmless:
+// the CAS from a stale position fails. State loads are seq_cst so that of two
+// consumers releasing neighbouring records at once, at least one sees both.
+static inline int queue_reclaim(Queue *q)
+{
+    int advanced = 0;
+    size_t r = atomic_load(&q->reclaimed);
+    while (r < atomic_load(&q->head))
+    {
+        size_t state = atomic_load(&q->cell_state[r % QUEUE_CELLS]);
+        size_t cells;
+        if (state == CELL_MARK(r, CELL_RELEASED))
+            cells = queue_record(q, r)->cells;
+        else if (state == CELL_MARK(r, CELL_PAD))
+            cells = QUEUE_CELLS - r % QUEUE_CELLS;
+        else
+            break; // Still in use
+        // On failure the CAS reloads 'r' with the current value
+        if (atomic_compare_exchange_weak(&q->reclaimed, &r, r + cells))
+        {
+            r += cells;
+            advanced = 1;
+        }
+    }
+    return advanced;
+}
+
+// Non-blocking reserve of 'len' payload bytes. Returns a pointer to write the
+// payload in place and the record's position in *ref for queue_commit, or NULL
+// if the ring is full or len exceeds QUEUE_MAX_PAYLOAD.
+static inline void *queue_try_reserve(Queue *q, size_t len, size_t *ref)
 {
-    struct sembuf sb = {(unsigned short)sem_num, (short)op, 0};
-    if (semop(semid, &sb, 1) == -1)
+    if (len > QUEUE_MAX_PAYLOAD)
+        return NULL;
+    size_t cells = (sizeof(RecordHeader) + len + QUEUE_CELL - 1) / QUEUE_CELL;
+    size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+    size_t pad;
+    for (;;)
     {
-        if (errno == EINTR)
+        pad = QUEUE_CELLS - pos % QUEUE_CELLS;
+        if (pad >= cells)
+            pad = 0; // Fits before the end of the buffer
+        if (pos + pad + cells - atomic_load(&q->reclaimed) > QUEUE_CELLS)
         {
-            // Interrupted by signal. Return -1 to signal interruption.
-            // The caller should check the 'running' flag and decide whether to retry.
-            return -1;
+            // A stale 'pos' may even lag behind 'reclaimed'; recheck with
+            // the current tail before giving up
+            size_t current = atomic_load_explicit(&q->tail, memory_order_relaxed);
+            if (current == pos && !queue_reclaim(q))
+                return NULL;
+            pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+            continue;
+        }
+        // On failure the CAS reloads 'pos' with the current value
+        if (atomic_compare_exchange_weak(&q->tail, &pos, pos + pad + cells))
+            break;
+    }
+    if (pad)
+    {
+        atomic_store(&q->cell_state[pos % QUEUE_CELLS], CELL_MARK(pos, CELL_PAD));
+        pos += pad;
+    }
+    RecordHeader *record = queue_record(q, pos);
+    record->cells = cells;
+    record->len = len;
+    *ref = pos;
+    return record + 1;
+}
+
+// Publishes a reserved record to consumers.
+static inline void queue_commit(Queue *q, size_t ref)
+{
+    atomic_store_explicit(&q->cell_state[ref % QUEUE_CELLS], CELL_MARK(ref, CELL_COMMITTED), memory_order_release);
+    queue_notify(&q->items_event, &q->items_waiting);
+}
+
+// Non-blocking peek: claims the oldest committed record for this consumer.
+// Returns a pointer to its payload (valid until queue_release) with the size
+// in *len and the position in *ref, or NULL if the queue is empty or the
+// oldest record isn't committed yet.
+static inline void *queue_try_peek(Queue *q, size_t *len, size_t *ref)
+{
+    size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+    for (;;)
+    {
+        size_t state = atomic_load_explicit(&q->cell_state[pos % QUEUE_CELLS], memory_order_acquire);
+        size_t cells;
+        if (state == CELL_MARK(pos, CELL_COMMITTED))
+        {
+            cells = queue_record(q, pos)->cells;
+        }
+        else if (state == CELL_MARK(pos, CELL_PAD))
+        {
+            cells = QUEUE_CELLS - pos % QUEUE_CELLS;
         }
         else
         {
-            // Other critical semaphore error
-            perror("semop failed");
-            // Exit here might be too abrupt in some scenarios, but consistent
-            // with previous non-EINTR error handling.
-            exit(EXIT_FAILURE);
+            size_t current = atomic_load_explicit(&q->head, memory_order_relaxed);
+            if (current == pos)
+                return NULL;
+            pos = current; // Someone else took it
+            continue;
+        }
+        // On failure the CAS reloads 'pos' with the current value
+        if (!atomic_compare_exchange_weak(&q->head, &pos, pos + cells))
+            continue;
+        if (state == CELL_MARK(pos, CELL_PAD))
+        {
+            pos += cells; // Skip padding, reclaimed with the record after it
+            continue;
         }
+        RecordHeader *record = queue_record(q, pos);
+        *len = record->len;
+        *ref = pos;
+        return record + 1;
+    }
+}
+
+// Returns a peeked record's space to producers.
+static inline void queue_release(Queue *q, size_t ref)
+{
+    atomic_store(&q->cell_state[ref % QUEUE_CELLS], CELL_MARK(ref, CELL_RELEASED));
+    if (queue_reclaim(q))
+        queue_notify(&q->space_event, &q->space_waiting);
+}
+
+// Blocking reserve/peek. Sleep on the futex while the queue is full/empty and
+// return NULL once *keep_going is cleared (producers and consumers pass
+// &running). A blocked process rechecks the flag every QUEUE_WAIT_MS.
+static inline void *queue_reserve(Queue *q, size_t len, size_t *ref, volatile sig_atomic_t *keep_going)
+{
+    void *payload;
+    if (len > QUEUE_MAX_PAYLOAD)
+        return NULL; // Would never fit
+    while ((payload = queue_try_reserve(q, len, ref)) == NULL && *keep_going)
+    {
+        unsigned int ev = queue_raise_flag(&q->space_event, &q->space_waiting);
+        if ((payload = queue_try_reserve(q, len, ref)) != NULL)
+            break;
+        futex_wait(&q->space_event, ev);
+    }
+    return payload;
+}
+
+static inline void *queue_peek(Queue *q, size_t *len, size_t *ref, volatile sig_atomic_t *keep_going)
+{
+    void *payload;
+    while ((payload = queue_try_peek(q, len, ref)) == NULL && *keep_going)
+    {
+        unsigned int ev = queue_raise_flag(&q->items_event, &q->items_waiting);
+        if ((payload = queue_try_peek(q, len, ref)) != NULL)
+            break;
+        futex_wait(&q->items_event, ev);
     }
-    // Success
-    return 0;
+    return payload;
 }
 
 #endif // COMMON_H
\ No newline at end of file
@@ -1,4 +1,5 @@
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // For syscall() used by the futex helpers
 #include "common.h" // Include the common header
 
 // Define the global running flag (declared extern in common.h)
@@ -10,9 +11,38 @@ void signal_handler(int sig)
     running = 0;
 }
 
+static double elapsed_since(const struct timespec *start)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
 // --- Main Function ---
-int main()
+int main(int argc, char *argv[])
 {
+    // --- Options ---
+    // -q: no per-message log (throughput mode)
+    // -n count: stop after 'count' messages (0 = until signalled)
+    int quiet = 0;
+    unsigned long limit = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "qn:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'q':
+            quiet = 1;
+            break;
+        case 'n':
+            limit = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-q] [-n count]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // --- Setup Signal Handling ---
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
@@ -23,7 +53,6 @@ int main()
     // --- IPC Initialization ---
     key_t key;
     int shmid = -1;
-    int semid = -1;
     Queue *queue = (Queue *)-1;
 
     // Generate IPC Key (using path from common.h)
@@ -50,125 +79,71 @@ int main()
         exit(EXIT_FAILURE);
     }
 
-    // Get Semaphore Set ID (don't create)
-    semid = semget(key, 3, 0666);
-    if (semid == -1)
-    {
-        perror("semget (consumer) - Did main/producer start and create the semaphores?");
-        shmdt(queue);
-        exit(EXIT_FAILURE);
-    }
-
-    printf("[Consumer %d] Started. Attached to SHM id %d, SEM id %d.\n", getpid(), shmid, semid);
-    printf("[Consumer %d] Initial Semaphores: EMPTY_SLOTS=%d, FILLED_SLOTS=%d, MUTEX=%d\n",
-           getpid(), semctl(semid, SEM_EMPTY_SLOTS, GETVAL),
-           semctl(semid, SEM_FILLED_SLOTS, GETVAL), semctl(semid, SEM_MUTEX, GETVAL));
+    printf("[Consumer %d] Started. Attached to SHM id %d.\n", getpid(), shmid);
     fflush(stdout);
 
+    unsigned long consumed = 0, invalid = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
     // --- Main Consumption Loop ---
-    while (running)
+    while (running && (limit == 0 || consumed < limit))
     {
-        printf("[Consumer %d] Waiting for a message (FILLED_SLOTS = %d)...\n",
-               getpid(), semctl(semid, SEM_FILLED_SLOTS, GETVAL));
-        fflush(stdout);
-
-        // 1. Wait for a filled slot (P operation on FILLED_SLOTS)
-        sem_op(semid, SEM_FILLED_SLOTS, -1);
-
-        // Check if we should terminate after waking up
-        if (!running)
-            break;
-
-        printf("[Consumer %d] Message available. Waiting for mutex (MUTEX = %d)...\n",
-               getpid(), semctl(semid, SEM_MUTEX, GETVAL));
-        fflush(stdout);
-
-        // 2. Acquire Mutex (P operation on SEM_MUTEX)
-        sem_op(semid, SEM_MUTEX, -1);
-        printf("[Consumer %d] Mutex acquired.\n", getpid());
-        fflush(stdout);
-
-        // --- Critical Section ---
-        // Now we have exclusive access to the queue's head pointer
-
-        // Check if running flag changed while waiting for mutex
-        if (!running)
+        // 1. Claim the oldest message and work on it in place: lock-free
+        // unless the queue is empty, in which case we sleep on the futex
+        // until a producer commits one
+        size_t len, ref;
+        char *message = queue_peek(queue, &len, &ref, &running);
+        if (message == NULL)
+            break; // Terminated while waiting for a message
+        consumed++;
+
+        MessageHeader *header = (MessageHeader *)message;
+        char *data = message + sizeof(MessageHeader);
+
+        // Validate size against the record before using it further (important!)
+        if (len < sizeof(MessageHeader) || header->size != len - sizeof(MessageHeader))
         {
-            printf("[Consumer %d] Terminating inside critical section.\n", getpid());
-            fflush(stdout);
-            sem_op(semid, SEM_MUTEX, 1); // Release mutex
-            // Must put FILLED_SLOTS back since we didn't consume
-            sem_op(semid, SEM_FILLED_SLOTS, 1);
-            break;
+            fprintf(stderr, "[Consumer %d] CORRUPTED MESSAGE: Invalid size in record of %zu bytes at cell %zu. Skipping.\n",
+                    getpid(), len, ref);
+            invalid++;
+            queue_release(queue, ref);
+            continue; // Skip processing this corrupted message
         }
 
-        // 3. Read message from shared memory buffer into local memory
-        // Copy the entire potential message slot first.
-        char local_message_buffer[MAX_MESSAGE_SIZE];
-        memcpy(local_message_buffer, queue->buffer[queue->head], MAX_MESSAGE_SIZE);
-
-        // Get pointers to header and data within the local buffer
-        MessageHeader *local_header = (MessageHeader *)local_message_buffer;
-        char *local_data = local_message_buffer + sizeof(MessageHeader);
-
-        // Validate size before using it further (important!)
-        if (local_header->size > MAX_MESSAGE_DATA_SIZE)
+        // 2. Compute and verify hash (in place)
+        unsigned short computed_hash = compute_hash(header, data);
+        int valid = (computed_hash == header->hash);
+        if (!valid)
         {
-            fprintf(stderr, "[Consumer %d] CORRUPTED MESSAGE: Invalid size %d in slot %d. Skipping.\n",
-                    getpid(), local_header->size, queue->head);
-            // Update head even for corrupted message to advance past it
-            queue->head = (queue->head + 1) % QUEUE_SIZE;
-            sem_op(semid, SEM_MUTEX, 1);       // Release mutex
-            sem_op(semid, SEM_EMPTY_SLOTS, 1); // Signal slot is now 'empty' (even though corrupted)
-            continue;                          // Skip processing this corrupted message
+            fprintf(stderr, "[Consumer %d] WARNING: Hash mismatch at cell %zu (Computed=0x%X, Received=0x%X)!\n",
+                    getpid(), ref, computed_hash, header->hash);
+            fflush(stderr);
+            invalid++;
         }
 
-        // 4. Update head pointer *after* successfully reading/copying
-        int current_head = queue->head; // For logging
-        queue->head = (queue->head + 1) % QUEUE_SIZE;
-
-        printf("[Consumer %d] Consumed message from slot %d. New head: %d.\n",
-               getpid(), current_head, queue->head);
-        fflush(stdout);
-
-        // --- End of Critical Section ---
-
-        // 5. Release Mutex (V operation on SEM_MUTEX)
-        sem_op(semid, SEM_MUTEX, 1);
-        printf("[Consumer %d] Mutex released.\n", getpid());
-        fflush(stdout);
-
-        // 6. Signal an empty slot (V operation on SEM_EMPTY_SLOTS)
-        sem_op(semid, SEM_EMPTY_SLOTS, 1);
-        printf("[Consumer %d] Signaled empty slot (EMPTY_SLOTS = %d).\n",
-               getpid(), semctl(semid, SEM_EMPTY_SLOTS, GETVAL));
-        fflush(stdout);
-
-        // 7. Process the message (using the local copy)
-        printf("[Consumer %d] Processing message: Type=%c Size=%d\n",
-               getpid(), local_header->type, local_header->size);
-        fflush(stdout);
-
-        // 8. Compute and verify hash (using local copy)
-        unsigned short computed_hash = compute_hash(local_header, local_data);
-        int valid = (computed_hash == local_header->hash);
-        printf("[Consumer %d] Hash verification: Computed=0x%X, Received=0x%X, Valid: %s\n",
-               getpid(), computed_hash, local_header->hash, valid ? "yes" : "no");
-        fflush(stdout);
-
-        if (!valid)
+        if (!quiet)
         {
-            // Optional: Handle invalid hash cases specifically
-            fprintf(stderr, "[Consumer %d] WARNING: Hash mismatch for message from slot %d!\n", getpid(), current_head);
-            fflush(stderr);
+            size_t head = atomic_load(&queue->head);
+            size_t tail = atomic_load(&queue->tail);
+            printf("[Consumer %d] Processing message at cell %zu: Type=%c Size=%u Hash=0x%X Valid: %s. Queue: head %zu, tail %zu.\n",
+                   getpid(), ref, header->type, header->size, header->hash, valid ? "yes" : "no", head, tail);
+            fflush(stdout);
         }
 
+        // 3. Done with the message: return its space to producers
+        queue_release(queue, ref);
+
         // Optional: Add delay if needed
         // struct timespec ts = {0, 50 * 1000000}; // 50 ms
         // nanosleep(&ts, NULL);
 
     } // End while(running)
 
+    double seconds = elapsed_since(&start);
+    printf("[Consumer %d] Consumed %lu messages (%lu invalid) in %.3f s (%.0f msg/s).\n",
+           getpid(), consumed, invalid, seconds, seconds > 0 ? consumed / seconds : 0.0);
+
     // --- Cleanup ---
     printf("[Consumer %d] Termination signal received or loop ended. Detaching shared memory.\n", getpid());
     fflush(stdout);
@@ -1,4 +1,5 @@
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // For syscall() used by the futex helpers
 #include "common.h"   // Include the common header
 #include <sys/wait.h> // For waitpid
 
@@ -6,7 +7,6 @@
 
 // Global variables for cleanup handler
 int shmid = -1;
-int semid = -1;
 Queue *queue_ptr = (Queue *)-1; // Use a different name to avoid conflict with type 'Queue'
 pid_t producer_pids[MAX_PROCESSES];
 pid_t consumer_pids[MAX_PROCESSES];
@@ -80,17 +80,6 @@ void cleanup()
         shmid = -1; // Mark as removed
     }
 
-    // Remove semaphore set
-    if (semid != -1)
-    {
-        printf("[Main] Removing semaphore set (ID: %d)...\n", semid);
-        if (semctl(semid, 0, IPC_RMID) == -1)
-        { // sem_num is ignored for IPC_RMID
-            perror("semctl IPC_RMID (main)");
-        }
-        semid = -1; // Mark as removed
-    }
-
     printf("[Main] Cleanup complete.\n");
 }
 
@@ -151,73 +140,12 @@ int main(int argc, char *argv[])
     }
     printf("[Main] Shared Memory attached at address: %p\n", (void *)queue_ptr);
 
-    // Create or get Semaphore Set (3 semaphores)
-    semid = semget(key, 3, IPC_CREAT | 0666);
-    if (semid == -1)
-    {
-        perror("semget (main creation)");
-        shmdt(queue_ptr);
-        queue_ptr = (Queue *)-1;
-        shmctl(shmid, IPC_RMID, NULL);
-        shmid = -1;
-        exit(EXIT_FAILURE);
-    }
-    printf("[Main] Semaphore Set created/obtained with ID: %d\n", semid);
-
-    // --- Initialize Queue and Semaphores ---
-    // Check if semaphores were just created (are 0) or already initialized
-    struct semid_ds sem_info;
-    union semun
-    {
-        int val;
-        struct semid_ds *buf;
-        unsigned short *array;
-    } arg;
-    arg.buf = &sem_info;
-
-    if (semctl(semid, 0, IPC_STAT, arg) == -1)
-    {
-        perror("semctl IPC_STAT");
-        // Cleanup before exit
-        cleanup(); // cleanup will handle detach/remove
-        exit(EXIT_FAILURE);
-    }
-
-    // Initialize only if it seems uninitialized (e.g., check sem_otime or a specific flag)
-    // Simple approach: initialize always if main starts first.
-    // Robust: Use sem_otime or a dedicated init flag semaphore.
-    // Let's assume main starts first and initializes.
-    printf("[Main] Initializing Semaphores...\n");
-    arg.val = QUEUE_SIZE; // Empty slots
-    if (semctl(semid, SEM_EMPTY_SLOTS, SETVAL, arg) == -1)
-    {
-        perror("semctl SETVAL SEM_EMPTY_SLOTS");
-        cleanup();
-        exit(EXIT_FAILURE);
-    }
-
-    arg.val = 0; // Filled slots
-    if (semctl(semid, SEM_FILLED_SLOTS, SETVAL, arg) == -1)
-    {
-        perror("semctl SETVAL SEM_FILLED_SLOTS");
-        cleanup();
-        exit(EXIT_FAILURE);
-    }
-
-    arg.val = 1; // Mutex (initially unlocked)
-    if (semctl(semid, SEM_MUTEX, SETVAL, arg) == -1)
-    {
-        perror("semctl SETVAL SEM_MUTEX");
-        cleanup();
-        exit(EXIT_FAILURE);
-    }
-
-    // Initialize queue control variables
-    // Check if SHM was newly created? Requires more complex logic.
-    // Assume main initializes it if it creates it.
-    printf("[Main] Initializing Queue head/tail...\n");
-    queue_ptr->head = 0;
-    queue_ptr->tail = 0;
+    // --- Initialize Queue ---
+    // Positions and cell states; producers and consumers
+    // synchronize through them, no semaphores are needed.
+    // Assume main starts first and initializes.
+    printf("[Main] Initializing Queue (%d bytes in %d cells)...\n", QUEUE_BYTES, QUEUE_CELLS);
+    queue_init(queue_ptr);
 
     // --- Get Paths for Children ---
     char *child_path_env = getenv("CHILD_PATH");
@@ -393,22 +321,20 @@ int main(int argc, char *argv[])
             break;
 
         case 's':
-            // Calculate occupied slots safely using modulo arithmetic
-            // Ensure head/tail are read consistently if needed (mutex? maybe not necessary for rough status)
-            int current_head = queue_ptr->head;
-            int current_tail = queue_ptr->tail;
-            int occupied = (current_tail - current_head + QUEUE_SIZE) % QUEUE_SIZE;
-            int free_slots = QUEUE_SIZE - occupied;
-
-            // Get semaphore values
-            int empty_val = semctl(semid, SEM_EMPTY_SLOTS, GETVAL);
-            int filled_val = semctl(semid, SEM_FILLED_SLOTS, GETVAL);
-            int mutex_val = semctl(semid, SEM_MUTEX, GETVAL);
+            // Lock-free snapshot in cells; read in this order no value can
+            // pass the next one
+            size_t current_reclaimed = atomic_load(&queue_ptr->reclaimed);
+            size_t current_head = atomic_load(&queue_ptr->head);
+            size_t current_tail = atomic_load(&queue_ptr->tail);
+            size_t used = current_tail - current_reclaimed;
 
             printf("[Main] --- Status ---\n");
-            printf("  Queue:      Size=%d, Head=%d, Tail=%d\n", QUEUE_SIZE, current_head, current_tail);
-            printf("  Calculated: Occupied=%d, Free=%d\n", occupied, free_slots);
-            printf("  Semaphores: EMPTY_SLOTS=%d, FILLED_SLOTS=%d, MUTEX=%d\n", empty_val, filled_val, mutex_val);
+            printf("  Queue:      Cells=%d x %d bytes, Reclaimed=%zu, Head=%zu, Tail=%zu\n", QUEUE_CELLS, QUEUE_CELL,
+                   current_reclaimed, current_head, current_tail);
+            printf("  Calculated: Unread=%zu, In use=%zu, Free=%zu cells\n", current_tail - current_head, used,
+                   QUEUE_CELLS - used);
+            printf("  Waiting:    Producers=%s, Consumers=%s\n", atomic_load(&queue_ptr->space_waiting) ? "yes" : "no",
+                   atomic_load(&queue_ptr->items_waiting) ? "yes" : "no");
             printf("  Tracked PIDs: Producers=%d, Consumers=%d\n", producer_count, consumer_count);
             printf("  -----------------\n");
             break;
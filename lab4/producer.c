@@ -1,4 +1,5 @@
 #define _POSIX_C_SOURCE 200809L
+#define _DEFAULT_SOURCE // For syscall() used by the futex helpers
 #include "common.h" // Include the common header
 #include <time.h>   // For seeding rand_r
 
@@ -11,8 +12,47 @@ void signal_handler(int sig)
     running = 0;
 }
 
-int main()
+static double elapsed_since(const struct timespec *start)
 {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    // --- Options ---
+    // -q: no per-message log and no delay (throughput mode)
+    // -n count: stop after 'count' messages (0 = until signalled)
+    // -s max_size: random data sizes are 1..max_size bytes
+    int quiet = 0;
+    unsigned long limit = 0;
+    unsigned long max_size = DEFAULT_MESSAGE_DATA_SIZE;
+    int opt;
+    while ((opt = getopt(argc, argv, "qn:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'q':
+            quiet = 1;
+            break;
+        case 'n':
+            limit = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            max_size = strtoul(optarg, NULL, 10);
+            if (max_size < 1 || max_size > MAX_MESSAGE_DATA_SIZE)
+            {
+                fprintf(stderr, "Size must be 1..%d\n", MAX_MESSAGE_DATA_SIZE);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-q] [-n count] [-s max_size]\n", argv[0]);
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // --- Setup Signal Handling ---
     struct sigaction sa;
     memset(&sa, 0, sizeof(sa));
@@ -23,7 +63,6 @@ int main()
     // --- IPC Initialization ---
     key_t key;
     int shmid = -1;
-    int semid = -1;
     Queue *queue = (Queue *)-1;
 
     // Generate IPC Key (using path from common.h)
@@ -50,109 +89,63 @@ int main()
         exit(EXIT_FAILURE);
     }
 
-    // Get Semaphore Set ID (don't create)
-    semid = semget(key, 3, 0666);
-    if (semid == -1)
-    {
-        perror("semget (producer) - Did main start and create the semaphores?");
-        shmdt(queue); // Detach memory before exiting
-        exit(EXIT_FAILURE);
-    }
-
-    printf("[Producer %d] Started. Attached to SHM id %d, SEM id %d.\n", getpid(), shmid, semid);
+    printf("[Producer %d] Started. Attached to SHM id %d.\n", getpid(), shmid);
     fflush(stdout);
 
     // Seed for random data generation
     unsigned int seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+    unsigned long produced = 0;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
 
     // --- Main Production Loop ---
-    while (running)
+    while (running && (limit == 0 || produced < limit))
     {
-        printf("[Producer %d] Waiting for empty slot (EMPTY_SLOTS = %d)...\n",
-               getpid(), semctl(semid, SEM_EMPTY_SLOTS, GETVAL));
-        fflush(stdout);
-
-        // 1. Wait for an empty slot (P operation on SEM_EMPTY_SLOTS)
-        sem_op(semid, SEM_EMPTY_SLOTS, -1);
-
-        // Check if we should terminate after waking up
-        if (!running)
-            break;
-
-        printf("[Producer %d] Slot available. Waiting for mutex (MUTEX = %d)...\n",
-               getpid(), semctl(semid, SEM_MUTEX, GETVAL));
-        fflush(stdout);
-
-        // 2. Acquire Mutex (P operation on SEM_MUTEX)
-        sem_op(semid, SEM_MUTEX, -1);
-        printf("[Producer %d] Mutex acquired.\n", getpid());
-        fflush(stdout);
-
-        // --- Critical Section ---
-        // Now we have exclusive access to the queue's tail pointer
-
-        // Check if running flag changed while waiting for mutex
-        if (!running)
+        // 1. Reserve space for the whole message in the queue: lock-free
+        // unless the queue is full, in which case we sleep on the futex
+        // until consumers release enough space
+        uint32_t size = (rand_r(&seed) % max_size) + 1;
+        size_t ref;
+        char *message = queue_reserve(queue, sizeof(MessageHeader) + size, &ref, &running);
+        if (message == NULL)
+            break; // Terminated while waiting for space
+
+        // 2. Build the message in place (no local copy)
+        MessageHeader *header = (MessageHeader *)message;
+        char *data = message + sizeof(MessageHeader);
+        header->type = 'D'; // Example type
+        header->size = size;
+        for (uint32_t i = 0; i < size; ++i)
         {
-            printf("[Producer %d] Terminating inside critical section.\n", getpid());
-            fflush(stdout);
-            sem_op(semid, SEM_MUTEX, 1); // Release mutex
-            // Must put EMPTY_SLOTS back since we didn't produce
-            sem_op(semid, SEM_EMPTY_SLOTS, 1);
-            break;
+            data[i] = rand_r(&seed) % 256;
         }
+        header->hash = compute_hash(header, data);
+        unsigned short hash = header->hash; // For logging after commit
 
-        // 3. Prepare message in local variables first
-        MessageHeader header;
-        char data_buffer[MAX_MESSAGE_DATA_SIZE];
-
-        header.type = 'D'; // Example type
-        // Generate random data size (1 to MAX_MESSAGE_DATA_SIZE bytes)
-        // rand_r is thread-safe but maybe overkill here, rand() is simpler if single-threaded producer
-        header.size = (rand_r(&seed) % MAX_MESSAGE_DATA_SIZE) + 1;
+        // 3. Publish it to consumers
+        queue_commit(queue, ref);
+        produced++;
 
-        // Generate random data
-        for (int i = 0; i < header.size; ++i)
+        if (!quiet)
         {
-            data_buffer[i] = rand_r(&seed) % 256;
-        }
-
-        // 4. Compute hash based on local header and data
-        header.hash = compute_hash(&header, data_buffer);
-
-        // 5. Copy header and data into the shared memory buffer slot
-        char *target_slot = queue->buffer[queue->tail];
-        memcpy(target_slot, &header, sizeof(MessageHeader));                   // Copy header
-        memcpy(target_slot + sizeof(MessageHeader), data_buffer, header.size); // Copy data right after header
-
-        // 6. Update tail pointer
-        int current_tail = queue->tail; // For logging
-        queue->tail = (queue->tail + 1) % QUEUE_SIZE;
-
-        printf("[Producer %d] Produced message (Size: %d, Hash: 0x%X) in slot %d. New tail: %d.\n",
-               getpid(), header.size, header.hash, current_tail, queue->tail);
-        fflush(stdout);
-
-        // --- End of Critical Section ---
-
-        // 7. Release Mutex (V operation on SEM_MUTEX)
-        sem_op(semid, SEM_MUTEX, 1);
-        printf("[Producer %d] Mutex released.\n", getpid());
-        fflush(stdout);
-
-        // 8. Signal a filled slot (V operation on SEM_FILLED_SLOTS)
-        sem_op(semid, SEM_FILLED_SLOTS, 1);
-        printf("[Producer %d] Signaled filled slot (FILLED_SLOTS = %d).\n",
-               getpid(), semctl(semid, SEM_FILLED_SLOTS, GETVAL));
-        fflush(stdout);
+            size_t head = atomic_load(&queue->head);
+            size_t tail = atomic_load(&queue->tail);
+            printf("[Producer %d] Produced message (Size: %u, Hash: 0x%X) at cell %zu. Queue: head %zu, tail %zu.\n",
+                   getpid(), size, hash, ref, head, tail);
+            fflush(stdout);
 
-        // Optional delay
-        // struct timespec ts = {0, 100 * 1000000}; // 100 ms
-        // nanosleep(&ts, NULL);
-        sleep(1); // Simpler 1 second delay
+            // Optional delay
+            // struct timespec ts = {0, 100 * 1000000}; // 100 ms
+            // nanosleep(&ts, NULL);
+            sleep(1); // Simpler 1 second delay
+        }
 
     } // End while(running)
 
+    double seconds = elapsed_since(&start);
+    printf("[Producer %d] Produced %lu messages in %.3f s (%.0f msg/s).\n",
+           getpid(), produced, seconds, seconds > 0 ? produced / seconds : 0.0);
+
     // --- Cleanup ---
     printf("[Producer %d] Termination signal received or loop ended. Detaching shared memory.\n", getpid());
     fflush(stdout);
@@ -0,0 +1,305 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "append.h"
+#include "runio.h"
+
+#define APPEND_DEFAULT_BUF (1024 * 1024)
+
+// Запись b повторяет предыдущую записанную a
+static int duplicate(int policy, const struct index_s *a, const struct index_s *b)
+{
+    switch (policy)
+    {
+    case DEDUP_EXACT:
+        return index_key(a->time_mark) == index_key(b->time_mark) && a->recno == b->recno;
+    case DEDUP_TIME:
+        return index_key(a->time_mark) == index_key(b->time_mark);
+    default:
+        return 0;
+    }
+}
+
+// Первая запись партии first идет строго после последней записи файла
+// last, и повторов между ними быть не может
+static int strictly_after(int policy, const struct index_s *last, const struct index_s *first)
+{
+    if (policy == DEDUP_TIME)
+        return index_key(last->time_mark) < index_key(first->time_mark);
+    return compare_index(last, first) < 0;
+}
+
+// Источник слияния с проверкой порядка
+struct source
+{
+    struct run_reader r;
+    struct index_s head;
+    int active;
+    const char *name;
+};
+
+static int source_next(struct source *s)
+{
+    struct index_s prev = s->head;
+    int was_active = s->active;
+    int got = rr_next(&s->r, &s->head, RECORD_SIZE);
+    if (got < 0)
+    {
+        perror("[Append] read");
+        return -1;
+    }
+    if (got && was_active && compare_index(&prev, &s->head) > 0)
+    {
+        fprintf(stderr, "[Append] %s is not sorted\n", s->name);
+        return -1;
+    }
+    s->active = got;
+    return 0;
+}
+
+static int source_open(struct source *s, int fd, uint64_t records, size_t read_buf, const char *name)
+{
+    s->active = 0;
+    s->name = name;
+    if (rr_open(&s->r, fd, sizeof(uint64_t), sizeof(uint64_t) + records * RECORD_SIZE, read_buf, RECORD_SIZE, NULL, 0) != 0)
+    {
+        perror("[Append] malloc reader buffer");
+        return -1;
+    }
+    return source_next(s);
+}
+
+// Запись результата с отбрасыванием повторов
+struct dedup_writer
+{
+    struct run_writer w;
+    struct index_s last;
+    int has_last;
+    int policy;
+    uint64_t written;
+    uint64_t dropped;
+};
+
+static int dedup_put(struct dedup_writer *d, const struct index_s *rec)
+{
+    d->last = *rec;
+    d->has_last = 1;
+    d->written++;
+    return rw_put(&d->w, rec, RECORD_SIZE);
+}
+
+// Запись партии пропускается, если повторяет последнюю записанную или
+// (по time_mark) еще не записанную запись файла next, которая идет за ней
+static int dedup_batch(struct dedup_writer *d, const struct index_s *rec, const struct index_s *next)
+{
+    if ((d->has_last && duplicate(d->policy, &d->last, rec)) ||
+        (next && d->policy == DEDUP_TIME && duplicate(d->policy, next, rec)))
+    {
+        d->dropped++;
+        return 0;
+    }
+    return dedup_put(d, rec);
+}
+
+// Число записей из заголовка; файл должен их вмещать
+static int read_count(int fd, const char *name, uint64_t *records)
+{
+    struct stat st;
+    if (pread(fd, records, sizeof(uint64_t), 0) != sizeof(uint64_t) || fstat(fd, &st) == -1)
+    {
+        fprintf(stderr, "[Append] cannot read header of %s\n", name);
+        return 1;
+    }
+    if ((uint64_t)st.st_size < sizeof(uint64_t) + *records * RECORD_SIZE)
+    {
+        fprintf(stderr, "[Append] %s is shorter than %lu records from its header\n", name, *records);
+        return 1;
+    }
+    return 0;
+}
+
+// Партия дописывается за последней записью файла. Сначала на диск
+// уходят записи, потом заголовок: после сбоя файл остается прежним,
+// а хвост за записями из заголовка не читается.
+static int append_tail(int tfd, int bfd, const char *batch, struct append_stats *st, int policy, size_t read_buf,
+                       size_t write_buf)
+{
+    struct source src = {0};
+    struct dedup_writer d = {.policy = policy};
+    int ret = 1;
+    if (source_open(&src, bfd, st->batch, read_buf, batch) != 0)
+        goto out_reader;
+    if (rw_open(&d.w, tfd, sizeof(uint64_t) + st->existing * RECORD_SIZE, write_buf, NULL, -1) != 0)
+    {
+        perror("[Append] malloc writer buffer");
+        goto out_reader;
+    }
+    while (src.active)
+    {
+        if (dedup_batch(&d, &src.head, NULL) != 0)
+        {
+            perror("[Append] write");
+            goto out;
+        }
+        if (source_next(&src) != 0)
+            goto out;
+    }
+    uint64_t total = st->existing + d.written;
+    if (rw_flush(&d.w) != 0 || fdatasync(tfd) != 0 ||
+        pwrite(tfd, &total, sizeof(total), 0) != sizeof(total) || fsync(tfd) != 0)
+    {
+        perror("[Append] write");
+        goto out;
+    }
+    if (ftruncate(tfd, sizeof(uint64_t) + total * RECORD_SIZE) != 0)
+        perror("[Append] ftruncate");
+    st->written = total;
+    st->dropped = d.dropped;
+    st->in_place = 1;
+    ret = 0;
+
+out:
+    rw_close(&d.w);
+out_reader:
+    rr_close(&src.r);
+    return ret;
+}
+
+// Слияние файла и партии в out_path. При равенстве первой идет запись
+// файла, а записи файла пишутся всегда.
+static int merge_into(int tfd, int bfd, const char *target, const char *batch, const char *out_path,
+                      struct append_stats *st, int policy, size_t read_buf, size_t write_buf)
+{
+    struct source src[2]; // Файл (если есть) и партия последней
+    struct dedup_writer d = {.policy = policy};
+    int nsrc = 0, ret = 1;
+    memset(src, 0, sizeof(src));
+    int out_fd = open(out_path, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    if (out_fd == -1)
+    {
+        perror("[Append] open output");
+        return 1;
+    }
+    if (tfd != -1)
+    {
+        if (source_open(&src[nsrc++], tfd, st->existing, read_buf, target) != 0)
+            goto out;
+    }
+    if (source_open(&src[nsrc++], bfd, st->batch, read_buf, batch) != 0)
+        goto out;
+    if (rw_open(&d.w, out_fd, sizeof(uint64_t), write_buf, NULL, -1) != 0)
+    {
+        perror("[Append] malloc writer buffer");
+        goto out;
+    }
+
+    for (;;)
+    {
+        struct source *s = NULL;
+        for (int i = 0; i < nsrc; i++)
+        {
+            if (src[i].active && (!s || compare_index(&src[i].head, &s->head) < 0))
+                s = &src[i];
+        }
+        if (!s)
+            break;
+        int from_batch = s == &src[nsrc - 1];
+        const struct index_s *next = nsrc == 2 && src[0].active ? &src[0].head : NULL;
+        if ((from_batch ? dedup_batch(&d, &s->head, next) : dedup_put(&d, &s->head)) != 0)
+        {
+            perror("[Append] write");
+            goto out_writer;
+        }
+        if (source_next(s) != 0)
+            goto out_writer;
+    }
+    if (rw_flush(&d.w) != 0 || pwrite(out_fd, &d.written, sizeof(d.written), 0) != sizeof(d.written) ||
+        fsync(out_fd) != 0)
+    {
+        perror("[Append] write");
+        goto out_writer;
+    }
+    st->written = d.written;
+    st->dropped = d.dropped;
+    ret = 0;
+
+out_writer:
+    rw_close(&d.w);
+out:
+    for (int i = 0; i < nsrc; i++)
+        rr_close(&src[i].r);
+    close(out_fd);
+    if (ret != 0)
+        unlink(out_path);
+    return ret;
+}
+
+int append_index(const char *batch, const char *target, const char *out_path, int policy, size_t read_buf,
+                 size_t write_buf, struct append_stats *st)
+{
+    memset(st, 0, sizeof(*st));
+    if (read_buf == 0)
+        read_buf = APPEND_DEFAULT_BUF;
+    if (write_buf == 0)
+        write_buf = APPEND_DEFAULT_BUF;
+
+    int bfd = open(batch, O_RDONLY);
+    if (bfd == -1)
+    {
+        perror("[Append] open batch");
+        return 1;
+    }
+    int tfd = open(target, O_RDWR);
+    if (tfd == -1 && errno != ENOENT)
+    {
+        perror("[Append] open target");
+        close(bfd);
+        return 1;
+    }
+
+    int ret = 1;
+    struct stat bst, tst;
+    if (read_count(bfd, batch, &st->batch) != 0 || (tfd != -1 && read_count(tfd, target, &st->existing) != 0))
+        goto out;
+    if (tfd != -1 && fstat(bfd, &bst) == 0 && fstat(tfd, &tst) == 0 && bst.st_dev == tst.st_dev &&
+        bst.st_ino == tst.st_ino)
+    {
+        fprintf(stderr, "[Append] batch and target are the same file\n");
+        goto out;
+    }
+
+    if (tfd != -1 && st->batch == 0)
+    {
+        st->written = st->existing;
+        st->in_place = 1;
+        ret = 0;
+        goto out;
+    }
+    if (tfd != -1 && st->existing > 0)
+    {
+        struct index_s last, first;
+        if (pread(tfd, &last, RECORD_SIZE, sizeof(uint64_t) + (st->existing - 1) * RECORD_SIZE) != RECORD_SIZE ||
+            pread(bfd, &first, RECORD_SIZE, sizeof(uint64_t)) != RECORD_SIZE)
+        {
+            perror("[Append] read boundary records");
+            goto out;
+        }
+        if (strictly_after(policy, &last, &first))
+        {
+            ret = append_tail(tfd, bfd, batch, st, policy, read_buf, write_buf);
+            goto out;
+        }
+    }
+    ret = merge_into(tfd, bfd, target, batch, out_path, st, policy, read_buf, write_buf);
+
+out:
+    if (tfd != -1)
+        close(tfd);
+    close(bfd);
+    return ret;
+}
@@ -0,0 +1,38 @@
+#ifndef APPEND_H
+#define APPEND_H
+
+#include <stdint.h>
+#include "index.h"
+
+// Вливание отсортированной партии в отсортированный индексный файл.
+// Если вся партия идет после последней записи файла, она дописывается
+// в конец на месте и стоимость зависит только от размера партии. Иначе
+// партия и файл сливаются за один проход во временный файл.
+
+// Что делать с записями партии, повторяющими записи файла или более
+// ранние записи партии. Записи, уже бывшие в файле, не отбрасываются
+// никогда, даже если повторяют друг друга.
+enum dedup_policy
+{
+    DEDUP_KEEP,  // Оставлять все записи
+    DEDUP_EXACT, // Убирать записи с теми же time_mark и recno
+    DEDUP_TIME   // Одна запись на каждый time_mark (по index_key)
+};
+
+struct append_stats
+{
+    uint64_t batch;    // Записей в партии
+    uint64_t existing; // Записей в файле до вливания
+    uint64_t written;  // Записей в файле после
+    uint64_t dropped;  // Отброшено повторов
+    int in_place;      // Партия дописана в конец без слияния
+};
+
+// Вливает отсортированную партию batch в target. Слияние пишется в
+// out_path, который вызывающий затем переименовывает в target; при
+// дописывании на месте out_path не создается. Отсутствующий target
+// считается пустым. Нарушение порядка, замеченное при слиянии, - ошибка.
+int append_index(const char *batch, const char *target, const char *out_path, int policy, size_t read_buf,
+                 size_t write_buf, struct append_stats *st);
+
+#endif // APPEND_H
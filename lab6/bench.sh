@@ -0,0 +1,185 @@
+#!/bin/sh
+# Прогоны sort_index по сетке memsize x blocks x threads на входах,
+# сгенерированных gen, с итогом в CSV или JSON Lines, и сравнение двух
+# CSV-итогов для поиска регрессий.
+#
+#   ./bench.sh [-n records] [-d "dist ..."] [-m "memsize ..."] [-b "blocks ..."]
+#              [-t "threads ..."] [-r repeats] [-s seed] [-f csv|json] [-o file]
+#              [-w workdir] [-x "sort_index options"] [-S sorter] [-G gen]
+#              [-L label] [-C]
+#   ./bench.sh -c baseline.csv current.csv [-p percent]
+#
+# Распределения - как у gen -d (uniform, zipf:1.2, ...). Каждый прогон
+# сортирует свежую копию входа; сочетания с blocks < 4*threads
+# пропускаются. -C сбрасывает страничный кэш перед прогоном (нужен root).
+# В сравнении для каждого сценария берется лучший из повторов, и код
+# выхода 1, если он медленнее базового больше чем на percent (10) процентов.
+
+set -eu
+
+records=4194304
+dists=uniform
+memsizes="16777216 67108864"
+blocks_list="16 64"
+threads_list="1 $(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)"
+repeats=3
+seed=1
+format=csv
+output=-
+workdir=
+extra=
+sorter=./sort_index
+gen=./gen
+label=
+drop_cache=0
+compare=0
+percent=10
+
+usage()
+{
+    sed -n '6,10p' "$0" | sed 's/^# *//' >&2
+    exit 1
+}
+
+while getopts "n:d:m:b:t:r:s:f:o:w:x:S:G:L:Ccp:" opt; do
+    case $opt in
+    n) records=$OPTARG ;;
+    d) dists=$OPTARG ;;
+    m) memsizes=$OPTARG ;;
+    b) blocks_list=$OPTARG ;;
+    t) threads_list=$OPTARG ;;
+    r) repeats=$OPTARG ;;
+    s) seed=$OPTARG ;;
+    f) format=$OPTARG ;;
+    o) output=$OPTARG ;;
+    w) workdir=$OPTARG ;;
+    x) extra=$OPTARG ;;
+    S) sorter=$OPTARG ;;
+    G) gen=$OPTARG ;;
+    L) label=$OPTARG ;;
+    C) drop_cache=1 ;;
+    c) compare=1 ;;
+    p) percent=$OPTARG ;;
+    *) usage ;;
+    esac
+done
+shift $((OPTIND - 1))
+
+# Сравнение: лучшее elapsed_s каждого сценария в базовом и текущем итогах
+if [ "$compare" -eq 1 ]; then
+    [ $# -eq 2 ] || usage
+    awk -F, -v percent="$percent" '
+        FNR == 1 {
+            for (i = 1; i <= NF; i++)
+                col[$i] = i
+            file++
+            next
+        }
+        {
+            key = $col["dist"] " memsize=" $col["memsize"] " blocks=" $col["blocks_per_part"] " threads=" $col["threads"]
+            t = $col["elapsed_s"] + 0
+            if (file == 1 && (!(key in base) || t < base[key]))
+                base[key] = t
+            if (file == 2) {
+                if (!(key in cur)) order[n++] = key
+                if (!(key in cur) || t < cur[key])
+                    cur[key] = t
+            }
+        }
+        END {
+            bad = 0
+            for (i = 0; i < n; i++) {
+                key = order[i]
+                if (!(key in base)) {
+                    printf "[Bench] %-60s %9s %9.3f  new\n", key, "-", cur[key]
+                    continue
+                }
+                ratio = base[key] > 0 ? cur[key] / base[key] : 1
+                slow = ratio > 1 + percent / 100
+                bad += slow
+                printf "[Bench] %-60s %9.3f %9.3f %7.2fx%s\n", key, base[key], cur[key], ratio, slow ? "  REGRESSION" : ""
+            }
+            exit bad > 0
+        }' "$1" "$2"
+    exit $?
+fi
+
+[ $# -eq 0 ] || usage
+case $format in
+csv | json) ;;
+*) usage ;;
+esac
+for tool in "$sorter" "$gen"; do
+    if [ ! -x "$tool" ]; then
+        echo "[Bench] $tool not found, run make first" >&2
+        exit 1
+    fi
+done
+if [ -z "$label" ]; then
+    label=$(git describe --always --dirty 2>/dev/null || echo unknown)
+fi
+
+own_workdir=0
+if [ -z "$workdir" ]; then
+    workdir=$(mktemp -d "${TMPDIR:-/tmp}/bench_sort.XXXXXX")
+    own_workdir=1
+fi
+cleanup()
+{
+    rm -f "$workdir/input.idx" "$workdir/run.idx" "$workdir/run.out"
+    if [ "$own_workdir" -eq 1 ]; then
+        rmdir "$workdir" 2>/dev/null || true
+    fi
+}
+trap cleanup EXIT INT TERM
+
+if [ "$output" != - ]; then
+    exec >"$output"
+fi
+
+header_done=0
+for dist in $dists; do
+    echo "[Bench] Generating $records records, distribution $dist" >&2
+    "$gen" -s "$seed" -d "$dist" "$records" "$workdir/input.idx" >/dev/null
+    for memsize in $memsizes; do
+        for blocks in $blocks_list; do
+            for threads in $threads_list; do
+                if [ "$blocks" -lt $((4 * threads)) ]; then
+                    echo "[Bench] Skipping blocks=$blocks threads=$threads: blocks < 4*threads" >&2
+                    continue
+                fi
+                run=1
+                while [ "$run" -le "$repeats" ]; do
+                    cp "$workdir/input.idx" "$workdir/run.idx"
+                    if [ "$drop_cache" -eq 1 ]; then
+                        sync
+                        echo 3 >/proc/sys/vm/drop_caches
+                    fi
+                    summary=csv
+                    [ "$format" = json ] && summary=json
+                    # shellcheck disable=SC2086
+                    if ! "$sorter" $extra -S "$summary" "$memsize" "$blocks" "$threads" "$workdir/run.idx" \
+                        >"$workdir/run.out"; then
+                        echo "[Bench] $sorter failed: dist=$dist memsize=$memsize blocks=$blocks threads=$threads" >&2
+                        exit 1
+                    fi
+                    echo "[Bench] $dist memsize=$memsize blocks=$blocks threads=$threads run $run done" >&2
+                    # Строки итога - все, что не начинается с [
+                    if [ "$format" = csv ]; then
+                        if [ "$header_done" -eq 0 ]; then
+                            printf 'version,dist,memsize,blocks_per_part,run,'
+                            grep -v '^\[' "$workdir/run.out" | sed -n 1p
+                            header_done=1
+                        fi
+                        printf '%s,%s,%s,%s,%s,' "$label" "$dist" "$memsize" "$blocks" "$run"
+                        grep -v '^\[' "$workdir/run.out" | sed -n 2p
+                    else
+                        printf '{"version": "%s", "dist": "%s", "memsize": %s, "blocks": %s, "run": %s, "metrics": %s}\n' \
+                            "$label" "$dist" "$memsize" "$blocks" "$run" "$(grep '^{' "$workdir/run.out")"
+                    fi
+                    run=$((run + 1))
+                done
+            done
+        done
+    done
+done
@@ -0,0 +1,436 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include "index.h"
+#include "loser_tree.h"
+#include "mem.h"
+#include "radix.h"
+#include "simd.h"
+
+#define DEFAULT_RECORDS (1u << 22)
+#define MAX_WAYS 1024
+#define BENCH_RUN 4096 // Длина исходных серий в pingpong, записей
+
+static double now_sec(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// k отсортированных прогонов подряд в runs[], прогон i - [i*len, (i+1)*len)
+static struct index_s *make_runs(size_t records, int k, unsigned int seed)
+{
+    struct index_s *runs = malloc(sizeof(struct index_s) * records);
+    if (!runs)
+        return NULL;
+    for (size_t i = 0; i < records; i++)
+    {
+        runs[i].time_mark = rand_r(&seed) / (double)RAND_MAX;
+        runs[i].recno = i + 1;
+    }
+    size_t len = records / k;
+    for (int i = 0; i < k; i++)
+        qsort(&runs[i * len], len, sizeof(struct index_s), compare_index);
+    return runs;
+}
+
+// Прежний движок merge_parts: линейный поиск минимума среди k прогонов
+static uint64_t merge_scan(const struct index_s *runs, size_t len, int k, struct index_s *out)
+{
+    size_t *pos = calloc(k, sizeof(size_t));
+    if (!pos)
+    {
+        perror("[Bench] calloc");
+        return 0;
+    }
+    uint64_t n = 0;
+    while (1)
+    {
+        int min_idx = -1;
+        for (int i = 0; i < k; i++)
+        {
+            if (pos[i] < len)
+            {
+                if (min_idx == -1 || compare_index(&runs[i * len + pos[i]], &runs[min_idx * len + pos[min_idx]]) < 0)
+                    min_idx = i;
+            }
+        }
+        if (min_idx == -1)
+            break;
+        out[n++] = runs[min_idx * len + pos[min_idx]++];
+    }
+    free(pos);
+    return n;
+}
+
+static uint64_t merge_tree(const struct index_s *runs, size_t len, int k, struct index_s *out)
+{
+    struct loser_tree lt;
+    size_t *pos = calloc(k, sizeof(size_t));
+    if (!pos || lt_init(&lt, k, &rs_index_format) != 0)
+    {
+        perror("[Bench] init loser tree");
+        free(pos);
+        return 0;
+    }
+    for (int i = 0; i < k; i++)
+    {
+        memcpy(lt_head(&lt, i), &runs[i * len], sizeof(struct index_s));
+        lt_set(&lt, i, len > 0);
+        pos[i] = 1;
+    }
+    lt_build(&lt);
+
+    uint64_t n = 0;
+    int w;
+    while ((w = lt_winner(&lt)) != -1)
+    {
+        memcpy(&out[n++], lt_head(&lt, w), sizeof(struct index_s));
+        int more = pos[w] < len;
+        if (more)
+            memcpy(lt_head(&lt, w), &runs[w * len + pos[w]++], sizeof(struct index_s));
+        lt_set(&lt, w, more);
+        lt_replay(&lt);
+    }
+    lt_free(&lt);
+    free(pos);
+    return n;
+}
+
+static int bench_kway(size_t records)
+{
+    struct index_s *out = malloc(sizeof(struct index_s) * records);
+    if (!out)
+    {
+        perror("[Bench] malloc");
+        return 1;
+    }
+
+    printf("%6s %12s %12s %12s %8s\n", "k", "records", "scan_ns/rec", "tree_ns/rec", "speedup");
+    for (int k = 2; k <= MAX_WAYS; k *= 2)
+    {
+        size_t n = records / k * k;
+        struct index_s *runs = make_runs(n, k, k);
+        if (!runs)
+        {
+            perror("[Bench] malloc runs");
+            free(out);
+            return 1;
+        }
+
+        double t0 = now_sec();
+        uint64_t n_scan = merge_scan(runs, n / k, k, out);
+        double t_scan = now_sec() - t0;
+        t0 = now_sec();
+        uint64_t n_tree = merge_tree(runs, n / k, k, out);
+        double t_tree = now_sec() - t0;
+
+        for (size_t i = 1; i < n; i++)
+        {
+            if (compare_index(&out[i - 1], &out[i]) > 0)
+            {
+                fprintf(stderr, "[Bench] tree merge output is not sorted at %zu\n", i);
+                free(runs);
+                free(out);
+                return 1;
+            }
+        }
+        if (n_scan != n || n_tree != n)
+        {
+            fprintf(stderr, "[Bench] merged %lu/%lu records, expected %zu\n", n_scan, n_tree, n);
+            free(runs);
+            free(out);
+            return 1;
+        }
+
+        printf("%6d %12zu %12.2f %12.2f %8.2f\n", k, n, t_scan * 1e9 / n, t_tree * 1e9 / n, t_scan / t_tree);
+        fflush(stdout);
+        free(runs);
+    }
+
+    free(out);
+    return 0;
+}
+
+static void merge_runs(struct index_s *dest, const struct index_s *a, size_t a_len, const struct index_s *b, size_t b_len)
+{
+    size_t i = 0, j = 0, k = 0;
+    while (i < a_len && j < b_len)
+    {
+        if (compare_index(&a[i], &b[j]) <= 0)
+            dest[k++] = a[i++];
+        else
+            dest[k++] = b[j++];
+    }
+    while (i < a_len)
+        dest[k++] = a[i++];
+    while (j < b_len)
+        dest[k++] = b[j++];
+}
+
+// Раунды попарного слияния серий длины run. copy_back = 1 - прежняя схема
+// (слияние в tmp и memcpy обратно), 0 - попеременные буферы с одной
+// итоговой копией при нечетном числе раундов. Возвращает число раундов.
+static int merge_rounds(struct index_s *buf, struct index_s *tmp, size_t n, size_t run, int copy_back)
+{
+    struct index_s *src = buf, *dst = tmp;
+    int rounds = 0;
+    for (size_t width = run; width < n; width *= 2, rounds++)
+    {
+        for (size_t start = 0; start < n; start += 2 * width)
+        {
+            size_t mid = (start + width < n) ? start + width : n;
+            size_t end = (mid + width < n) ? mid + width : n;
+            merge_runs(&dst[start], &src[start], mid - start, &src[mid], end - mid);
+            if (copy_back)
+                memcpy(&src[start], &dst[start], (end - start) * sizeof(struct index_s));
+        }
+        if (!copy_back)
+        {
+            struct index_s *t = src;
+            src = dst;
+            dst = t;
+        }
+    }
+    if (src != buf)
+        memcpy(buf, src, n * sizeof(struct index_s));
+    return rounds;
+}
+
+static int bench_pingpong(size_t records)
+{
+    size_t run = BENCH_RUN;
+    if (records < run)
+    {
+        fprintf(stderr, "[Main] pingpong needs at least %d records\n", BENCH_RUN);
+        return 1;
+    }
+    struct index_s *orig = make_runs(records / run * run, records / run, 1);
+    struct index_s *buf = malloc(sizeof(struct index_s) * records);
+    struct index_s *tmp = malloc(sizeof(struct index_s) * records);
+    if (!orig || !buf || !tmp)
+    {
+        perror("[Bench] malloc");
+        free(orig);
+        free(buf);
+        free(tmp);
+        return 1;
+    }
+    records = records / run * run;
+
+    printf("%10s %12s %7s %10s %12s %10s\n", "mode", "records", "rounds", "seconds", "moved_GiB", "GiB/s");
+    for (int copy_back = 1; copy_back >= 0; copy_back--)
+    {
+        memcpy(buf, orig, records * sizeof(struct index_s));
+        double t0 = now_sec();
+        int rounds = merge_rounds(buf, tmp, records, run, copy_back);
+        double t = now_sec() - t0;
+
+        for (size_t i = 1; i < records; i++)
+        {
+            if (compare_index(&buf[i - 1], &buf[i]) > 0)
+            {
+                fprintf(stderr, "[Bench] merge output is not sorted at %zu\n", i);
+                free(orig);
+                free(buf);
+                free(tmp);
+                return 1;
+            }
+        }
+
+        // Слияние читает и пишет каждую запись раунда, memcpy - еще раз
+        double bytes = 2.0 * records * sizeof(struct index_s) * rounds;
+        if (copy_back)
+            bytes *= 2;
+        else if (rounds & 1)
+            bytes += 2.0 * records * sizeof(struct index_s);
+        double gib = bytes / (1024.0 * 1024 * 1024);
+        printf("%10s %12zu %7d %10.3f %12.2f %10.2f\n", copy_back ? "copy-back" : "ping-pong", records, rounds, t,
+               gib, gib / t);
+        fflush(stdout);
+    }
+
+    free(orig);
+    free(buf);
+    free(tmp);
+    return 0;
+}
+
+// Ядра сортировки блока и слияния двух серий на случайных ключах
+static int bench_kernels(size_t records)
+{
+    struct index_s *orig = make_runs(records, 1, 7);
+    struct index_s *buf = malloc(sizeof(struct index_s) * records);
+    struct index_s *tmp = malloc(sizeof(struct index_s) * records);
+    if (!orig || !buf || !tmp)
+    {
+        perror("[Bench] malloc");
+        free(orig);
+        free(buf);
+        free(tmp);
+        return 1;
+    }
+    unsigned int seed = 11;
+    for (size_t i = 0; i < records; i++)
+        orig[i].time_mark = rand_r(&seed) / (double)RAND_MAX;
+
+    printf("[Bench] AVX2: %s\n", simd_enabled() ? "yes" : "no");
+    printf("%10s %12s %10s %12s\n", "kernel", "records", "seconds", "ns/rec");
+    const char *names[] = {"qsort", "radix", "simd"};
+    for (int mode = 0; mode < 3; mode++)
+    {
+        memcpy(buf, orig, records * sizeof(struct index_s));
+        double t0 = now_sec();
+        struct index_s *out = buf;
+        if (mode == 0)
+            qsort(buf, records, sizeof(struct index_s), compare_index);
+        else if (mode == 1)
+            out = radix_sort(&rs_index_format, buf, tmp, records);
+        else
+            out = simd_sort_index(buf, tmp, records);
+        double t = now_sec() - t0;
+        for (size_t i = 1; i < records; i++)
+        {
+            if (compare_index(&out[i - 1], &out[i]) > 0)
+            {
+                fprintf(stderr, "[Bench] %s output is not sorted at %zu\n", names[mode], i);
+                free(orig);
+                free(buf);
+                free(tmp);
+                return 1;
+            }
+        }
+        printf("%10s %12zu %10.3f %12.2f\n", names[mode], records, t, t * 1e9 / records);
+    }
+
+    // Две отсортированные половины: ветвящееся слияние против merge_index
+    memcpy(buf, orig, records * sizeof(struct index_s));
+    size_t half = records / 2;
+    qsort(buf, half, sizeof(struct index_s), compare_index);
+    qsort(buf + half, records - half, sizeof(struct index_s), compare_index);
+    double t0 = now_sec();
+    merge_runs(tmp, buf, half, buf + half, records - half);
+    double t_branch = now_sec() - t0;
+    t0 = now_sec();
+    merge_index(tmp, buf, half, buf + half, records - half);
+    double t_kernel = now_sec() - t0;
+    printf("%10s %12zu %10.3f %12.2f\n", "merge", records, t_branch, t_branch * 1e9 / records);
+    printf("%10s %12zu %10.3f %12.2f\n", simd_enabled() ? "merge-avx2" : "merge-cmov", records, t_kernel,
+           t_kernel * 1e9 / records);
+    fflush(stdout);
+
+    free(orig);
+    free(buf);
+    free(tmp);
+    return 0;
+}
+
+// Сортировка блока radix в буферах на обычных и огромных страницах:
+// first_touch - заполнение свежих буферов (страничные отказы), sort -
+// лучшее из нескольких прогонов по уже размещенной памяти (промахи TLB)
+static int bench_memory(size_t records)
+{
+    struct index_s *orig = make_runs(records, 1, 13);
+    if (!orig)
+    {
+        perror("[Bench] malloc");
+        return 1;
+    }
+    unsigned int seed = 17;
+    for (size_t i = 0; i < records; i++)
+        orig[i].time_mark = rand_r(&seed) / (double)RAND_MAX;
+
+    printf("%10s %12s %12s %10s %12s %8s %12s\n", "pages", "records", "first_touch", "sort_s", "ns/rec", "speedup",
+           "huge_KiB");
+    const char *names[] = {"4K", "thp", "hugetlb"};
+    size_t bytes = records * sizeof(struct index_s);
+    double t_base = 0;
+    for (int mode = HUGE_OFF; mode <= HUGE_EXPLICIT; mode++)
+    {
+        struct mem_buf data, tmp;
+        if (mem_alloc(&data, bytes, mode) != 0)
+        {
+            perror("[Bench] mem_alloc");
+            free(orig);
+            return 1;
+        }
+        if (mem_alloc(&tmp, bytes, mode) != 0)
+        {
+            perror("[Bench] mem_alloc");
+            mem_free(&data);
+            free(orig);
+            return 1;
+        }
+        struct index_s *buf = data.base;
+        double t0 = now_sec();
+        memcpy(buf, orig, bytes);
+        memset(tmp.base, 0, bytes);
+        double t_touch = now_sec() - t0;
+        long huge_kb = mem_anon_huge_kb();
+
+        double t_sort = 0;
+        for (int round = 0; round < 3; round++)
+        {
+            memcpy(buf, orig, bytes);
+            t0 = now_sec();
+            struct index_s *out = radix_sort(&rs_index_format, buf, tmp.base, records);
+            double t = now_sec() - t0;
+            if (round == 0 || t < t_sort)
+                t_sort = t;
+            for (size_t i = 1; i < records; i++)
+            {
+                if (compare_index(&out[i - 1], &out[i]) > 0)
+                {
+                    fprintf(stderr, "[Bench] %s output is not sorted at %zu\n", names[mode], i);
+                    mem_free(&data);
+                    mem_free(&tmp);
+                    free(orig);
+                    return 1;
+                }
+            }
+        }
+        if (mode == HUGE_OFF)
+            t_base = t_sort;
+        // hugetlb без пула страниц откатывается на THP - печатается полученный режим
+        printf("%10s %12zu %12.3f %10.3f %12.2f %8.2f %12ld\n", names[data.huge], records, t_touch, t_sort,
+               t_sort * 1e9 / records, t_base / t_sort, huge_kb);
+        fflush(stdout);
+        mem_free(&data);
+        mem_free(&tmp);
+    }
+    free(orig);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "[Main] Usage: %s kway|pingpong|kernels|memory [records]\n", argv[0]);
+        return 1;
+    }
+
+    simd_init();
+    size_t records = (argc == 3) ? (size_t)atoll(argv[2]) : DEFAULT_RECORDS;
+    if (records < MAX_WAYS)
+    {
+        fprintf(stderr, "[Main] records must be at least %d\n", MAX_WAYS);
+        return 1;
+    }
+
+    if (strcmp(argv[1], "kway") == 0)
+        return bench_kway(records);
+    if (strcmp(argv[1], "pingpong") == 0)
+        return bench_pingpong(records);
+    if (strcmp(argv[1], "kernels") == 0)
+        return bench_kernels(records);
+    if (strcmp(argv[1], "memory") == 0)
+        return bench_memory(records);
+
+    fprintf(stderr, "[Main] Unknown benchmark: %s\n", argv[1]);
+    return 1;
+}
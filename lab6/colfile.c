@@ -0,0 +1,295 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "colfile.h"
+
+int col_detect(int fd)
+{
+    char magic[COL_MAGIC_SIZE];
+    return pread(fd, magic, sizeof(magic), 0) == sizeof(magic) && memcmp(magic, COL_MAGIC, COL_MAGIC_SIZE) == 0;
+}
+
+int col_open(struct col_file *f, const char *filename)
+{
+    f->map = NULL;
+    f->dir = NULL;
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        perror("[Col] open");
+        return 1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        perror("[Col] fstat");
+        close(fd);
+        return 1;
+    }
+    f->size = st.st_size;
+    if (f->size < sizeof(struct col_header) + sizeof(struct col_trailer))
+    {
+        fprintf(stderr, "[Col] %s is too short for a columnar index\n", filename);
+        close(fd);
+        return 1;
+    }
+    f->map = mmap(NULL, f->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (f->map == MAP_FAILED)
+    {
+        perror("[Col] mmap");
+        f->map = NULL;
+        return 1;
+    }
+
+    struct col_trailer tr;
+    memcpy(&f->hdr, f->map, sizeof(f->hdr));
+    memcpy(&tr, (const char *)f->map + f->size - sizeof(tr), sizeof(tr));
+    uint64_t dir_bytes = (uint64_t)f->hdr.blocks * sizeof(struct col_block);
+    if (memcmp(f->hdr.magic, COL_MAGIC, COL_MAGIC_SIZE) != 0 ||
+        memcmp(tr.magic, COL_TRAILER_MAGIC, COL_MAGIC_SIZE) != 0 || f->hdr.block_records == 0 ||
+        tr.dir_offset + dir_bytes + sizeof(tr) != f->size)
+    {
+        fprintf(stderr, "[Col] %s: bad columnar header or footer\n", filename);
+        col_close(f);
+        return 1;
+    }
+    // Каталог лежит сразу за varint-потоком с произвольного смещения,
+    // поэтому читается копией, а не через указатель в отображение
+    f->dir = malloc(dir_bytes ? dir_bytes : 1);
+    if (!f->dir)
+    {
+        perror("[Col] malloc directory");
+        col_close(f);
+        return 1;
+    }
+    memcpy(f->dir, (const char *)f->map + tr.dir_offset, dir_bytes);
+    // Поиск вычисляет номер записи по номеру блока, поэтому полными
+    // должны быть все блоки, кроме последнего
+    uint64_t records = 0;
+    uint32_t i = 0;
+    for (; i < f->hdr.blocks; i++)
+    {
+        uint32_t count = f->dir[i].count;
+        if (count == 0 || count > f->hdr.block_records || (i + 1 < f->hdr.blocks && count != f->hdr.block_records))
+            break;
+        records += count;
+    }
+    if (i != f->hdr.blocks || records != f->hdr.records)
+    {
+        fprintf(stderr, "[Col] %s: block counts do not match %lu records\n", filename, f->hdr.records);
+        col_close(f);
+        return 1;
+    }
+    return 0;
+}
+
+void col_close(struct col_file *f)
+{
+    if (f->map)
+        munmap(f->map, f->size);
+    free(f->dir);
+    f->map = NULL;
+    f->dir = NULL;
+}
+
+// Блок целиком лежит в области данных файла
+static int block_valid(const struct col_file *f, const struct col_block *b)
+{
+    return b->count <= f->hdr.block_records &&
+           b->offset + b->time_bytes + b->recno_bytes <= f->size - sizeof(struct col_trailer);
+}
+
+void col_time_cursor(const struct col_file *f, uint32_t block, struct col_cursor *c)
+{
+    const struct col_block *b = &f->dir[block];
+    c->p = (const uint8_t *)f->map + b->offset;
+    c->end = c->p + b->time_bytes;
+    c->prev = 0;
+    c->left = block_valid(f, b) ? b->count : 0;
+}
+
+int col_decode_block(const struct col_file *f, uint32_t block, struct index_s *out)
+{
+    const struct col_block *b = &f->dir[block];
+    if (!block_valid(f, b))
+        return -1;
+
+    const uint8_t *p = (const uint8_t *)f->map + b->offset;
+    const uint8_t *recnos = p + b->time_bytes;
+    const uint8_t *end = recnos;
+    uint64_t prev = 0, z;
+    for (uint32_t i = 0; i < b->count; i++)
+    {
+        if (!(p = get_varint(p, end, &z)))
+            return -1;
+        prev = unzigzag(z, prev);
+        uint64_t bits = key_to_bits(prev);
+        memcpy(&out[i].time_mark, &bits, sizeof(bits));
+    }
+    // Столбец recno начинается ровно за time_bytes байт столбца времени
+    if (p != recnos)
+        return -1;
+    end = recnos + b->recno_bytes;
+    prev = 0;
+    for (uint32_t i = 0; i < b->count; i++)
+    {
+        if (!(p = get_varint(p, end, &z)))
+            return -1;
+        prev = unzigzag(z, prev);
+        out[i].recno = prev;
+    }
+    if (p != end)
+        return -1;
+    return b->count;
+}
+
+static int write_all(int fd, const void *buf, size_t len, off_t pos)
+{
+    const char *p = (const char *)buf;
+    while (len > 0)
+    {
+        ssize_t n = pwrite(fd, p, len, pos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        p += n;
+        len -= n;
+        pos += n;
+    }
+    return 0;
+}
+
+int colw_open(struct col_writer *w, const char *filename, uint32_t block_records)
+{
+    w->block_records = block_records ? block_records : COL_BLOCK_RECORDS;
+    w->records = 0;
+    w->pos = sizeof(struct col_header);
+    w->pending_count = 0;
+    w->blocks = 0;
+    w->dir_cap = 64;
+    w->pending = malloc(sizeof(struct index_s) * w->block_records);
+    w->buf = malloc(COL_MAX_BLOCK_BYTES(w->block_records));
+    w->dir = malloc(sizeof(struct col_block) * w->dir_cap);
+    w->fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+    if (!w->pending || !w->buf || !w->dir || w->fd == -1)
+    {
+        perror("[Col] open writer");
+        if (w->fd != -1)
+            close(w->fd);
+        free(w->pending);
+        free(w->buf);
+        free(w->dir);
+        return 1;
+    }
+    return 0;
+}
+
+static int flush_block(struct col_writer *w)
+{
+    if (w->pending_count == 0)
+        return 0;
+    if (w->blocks == w->dir_cap)
+    {
+        struct col_block *grown = realloc(w->dir, sizeof(struct col_block) * w->dir_cap * 2);
+        if (!grown)
+            return -1;
+        w->dir = grown;
+        w->dir_cap *= 2;
+    }
+
+    const struct index_s *recs = w->pending;
+    struct col_block *b = &w->dir[w->blocks];
+    const struct index_s *min = &recs[0], *max = &recs[0];
+    uint8_t *p = w->buf;
+    uint64_t prev = 0;
+    for (uint32_t i = 0; i < w->pending_count; i++)
+    {
+        uint64_t bits;
+        memcpy(&bits, &recs[i].time_mark, sizeof(bits));
+        uint64_t key = bits_to_key(bits);
+        p = put_varint(p, zigzag(key, prev));
+        prev = key;
+        if (compare_index(&recs[i], min) < 0)
+            min = &recs[i];
+        if (compare_index(&recs[i], max) > 0)
+            max = &recs[i];
+    }
+    b->time_bytes = p - w->buf;
+    prev = 0;
+    for (uint32_t i = 0; i < w->pending_count; i++)
+    {
+        p = put_varint(p, zigzag(recs[i].recno, prev));
+        prev = recs[i].recno;
+    }
+    b->recno_bytes = (p - w->buf) - b->time_bytes;
+    b->offset = w->pos;
+    b->count = w->pending_count;
+    b->reserved = 0;
+    b->min_time = min->time_mark;
+    b->max_time = max->time_mark;
+
+    if (write_all(w->fd, w->buf, p - w->buf, w->pos) != 0)
+        return -1;
+    w->pos += p - w->buf;
+    w->blocks++;
+    w->pending_count = 0;
+    return 0;
+}
+
+int colw_put(struct col_writer *w, const struct index_s *recs, size_t n)
+{
+    while (n > 0)
+    {
+        size_t take = w->block_records - w->pending_count;
+        if (take > n)
+            take = n;
+        memcpy(&w->pending[w->pending_count], recs, take * sizeof(struct index_s));
+        w->pending_count += take;
+        w->records += take;
+        recs += take;
+        n -= take;
+        if (w->pending_count == w->block_records && flush_block(w) != 0)
+        {
+            perror("[Col] write block");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int colw_close(struct col_writer *w)
+{
+    int ret = 0;
+    if (flush_block(w) != 0)
+        ret = -1;
+
+    struct col_header hdr;
+    memcpy(hdr.magic, COL_MAGIC, COL_MAGIC_SIZE);
+    hdr.records = w->records;
+    hdr.block_records = w->block_records;
+    hdr.blocks = w->blocks;
+    struct col_trailer tr;
+    tr.dir_offset = w->pos;
+    memcpy(tr.magic, COL_TRAILER_MAGIC, COL_MAGIC_SIZE);
+    size_t dir_bytes = sizeof(struct col_block) * w->blocks;
+    if (ret == 0 && (write_all(w->fd, w->dir, dir_bytes, w->pos) != 0 ||
+                     write_all(w->fd, &tr, sizeof(tr), w->pos + dir_bytes) != 0 ||
+                     write_all(w->fd, &hdr, sizeof(hdr), 0) != 0))
+        ret = -1;
+    if (ret != 0)
+        perror("[Col] write directory");
+
+    close(w->fd);
+    free(w->pending);
+    free(w->buf);
+    free(w->dir);
+    return ret;
+}
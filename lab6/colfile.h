@@ -0,0 +1,169 @@
+#ifndef COLFILE_H
+#define COLFILE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "index.h"
+
+// Колоночный сжатый формат индексного файла:
+//   struct col_header
+//   блоки: столбец time_mark, затем столбец recno
+//   каталог блоков: struct col_block[blocks]
+//   struct col_trailer
+// Оба столбца кодируются разностью с предыдущим значением блока,
+// zigzag и varint (7 бит на байт). time_mark кодируется через биективный
+// порядковый ключ биты -> uint64, так что у отсортированного файла
+// разности малы и положительны, а исходные биты восстанавливаются точно.
+// Первое слово обычного формата - число записей; магическая строка
+// как число записей была бы больше 3*10^18, поэтому форматы не путаются.
+
+#define COL_MAGIC "IDXCOL01"
+#define COL_TRAILER_MAGIC "IDXCEND1"
+#define COL_MAGIC_SIZE 8
+#define COL_BLOCK_RECORDS 1024 // По умолчанию; блок - единица чтения при поиске
+#define COL_MAX_BLOCK_BYTES(n) ((size_t)(n) * 20) // Худший случай: два varint по 10 байт
+
+struct col_header
+{
+    char magic[COL_MAGIC_SIZE];
+    uint64_t records;
+    uint32_t block_records; // Записей в каждом блоке, кроме последнего
+    uint32_t blocks;
+};
+
+struct col_block
+{
+    uint64_t offset; // Начало блока от начала файла
+    uint32_t time_bytes;
+    uint32_t recno_bytes;
+    uint32_t count;
+    uint32_t reserved;
+    double min_time; // Наименьшая и наибольшая запись блока по compare_index
+    double max_time;
+};
+
+struct col_trailer
+{
+    uint64_t dir_offset;
+    char magic[COL_MAGIC_SIZE];
+};
+
+// Биективный порядковый ключ битов double: в отличие от index_key
+// различает -0.0 и +0.0 и сохраняет содержимое NaN
+static inline uint64_t bits_to_key(uint64_t bits)
+{
+    return (bits >> 63) ? ~bits : bits | (1ULL << 63);
+}
+
+static inline uint64_t key_to_bits(uint64_t key)
+{
+    return (key >> 63) ? key & ~(1ULL << 63) : ~key;
+}
+
+static inline uint8_t *put_varint(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80)
+    {
+        *p++ = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+    uint64_t x = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7)
+    {
+        uint8_t b = *p++;
+        x |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+        {
+            *v = x;
+            return p;
+        }
+    }
+    return NULL;
+}
+
+// Разность с переносом как знаковое число, zigzag: малые по модулю
+// разности любого знака дают короткий varint
+static inline uint64_t zigzag(uint64_t cur, uint64_t prev)
+{
+    int64_t d = (int64_t)(cur - prev);
+    return ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+}
+
+static inline uint64_t unzigzag(uint64_t z, uint64_t prev)
+{
+    return prev + ((z >> 1) ^ (0 - (z & 1)));
+}
+
+// Чтение: файл отображается в память, блоки декодируются по одному
+struct col_file
+{
+    void *map;
+    size_t size;
+    struct col_header hdr;
+    struct col_block *dir; // Копия каталога: в файле он не выровнен
+};
+
+// Проверка первых байт файла: 1 - колоночный формат
+int col_detect(int fd);
+int col_open(struct col_file *f, const char *filename);
+void col_close(struct col_file *f);
+
+// Последовательное чтение столбца time_mark блока без декодирования
+// всего блока - поиску границы обычно хватает части столбца
+struct col_cursor
+{
+    const uint8_t *p;
+    const uint8_t *end;
+    uint64_t prev;
+    uint32_t left;
+};
+
+void col_time_cursor(const struct col_file *f, uint32_t block, struct col_cursor *c);
+
+// 1 - следующее значение в *time_mark, 0 - столбец кончился, -1 - поврежден
+static inline int col_next_time(struct col_cursor *c, double *time_mark)
+{
+    uint64_t z;
+    if (c->left == 0)
+        return 0;
+    if (!(c->p = get_varint(c->p, c->end, &z)))
+        return -1;
+    c->prev = unzigzag(z, c->prev);
+    c->left--;
+    uint64_t bits = key_to_bits(c->prev);
+    memcpy(time_mark, &bits, sizeof(bits));
+    return 1;
+}
+
+// Декодирование блока в out (не меньше hdr.block_records записей).
+// Возвращает число записей или -1, если блок поврежден.
+int col_decode_block(const struct col_file *f, uint32_t block, struct index_s *out);
+
+// Запись: блоки кодируются по мере поступления записей
+struct col_writer
+{
+    int fd;
+    uint32_t block_records;
+    uint64_t records;
+    uint64_t pos; // Конец записанных данных
+    struct index_s *pending;
+    uint32_t pending_count;
+    uint8_t *buf;
+    struct col_block *dir;
+    uint32_t blocks;
+    uint32_t dir_cap;
+};
+
+int colw_open(struct col_writer *w, const char *filename, uint32_t block_records);
+int colw_put(struct col_writer *w, const struct index_s *recs, size_t n);
+// Дописывает последний блок, каталог и заголовок. Закрывает файл.
+int colw_close(struct col_writer *w);
+
+#endif // COLFILE_H
@@ -2,43 +2,265 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <math.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <time.h>
+#include <pthread.h>
+#include "index.h"
 
-#define MIN_MJD 15020.0
-#define MAX_MJD 2460299.0
-#define RECORDS_MULTIPLE 256
+#define MAX_THREADS 1024
+#define CHUNK_RECORDS 65536 // Записей в буфере потока между pwrite
+#define ZIPF_KEYS 1000000   // Различных ключей в распределении Zipf
+#define CLUSTER_WIDTH 1.0   // Полуширина кластера в сутках
 
-struct index_s
+// Распределения ключей. У каждого свой параметр после двоеточия:
+// nearly:k - доля перемешанных записей в процентах, zipf:s - показатель
+// степени, clustered:c - число кластеров
+enum distribution
 {
-    double time_mark;
-    uint64_t recno;
+    DIST_UNIFORM,
+    DIST_SORTED,
+    DIST_REVERSE,
+    DIST_NEARLY,
+    DIST_ZIPF,
+    DIST_CLUSTERED,
+    DIST_EQUAL
 };
 
-struct index_hdr_s
+struct dist_spec
 {
+    const char *name;
+    int kind;
+    double param; // Значение параметра по умолчанию
+};
+
+static const struct dist_spec dists[] = {
+    {"uniform", DIST_UNIFORM, 0},
+    {"sorted", DIST_SORTED, 0},
+    {"reverse", DIST_REVERSE, 0},
+    {"nearly", DIST_NEARLY, 1.0},
+    {"zipf", DIST_ZIPF, 1.1},
+    {"clustered", DIST_CLUSTERED, 16},
+    {"equal", DIST_EQUAL, 0}};
+
+struct gen_params
+{
+    uint64_t seed;
     uint64_t records;
-    struct index_s idx[];
+    int kind;
+    double param;
 };
 
-int main(int argc, char *argv[])
+// splitmix64: значение с номером n считается напрямую, без прохода по
+// предыдущим, поэтому запись i зависит только от seed и i, а не от того,
+// какой поток ее сгенерировал
+#define SPLITMIX_GAMMA 0x9e3779b97f4a7c15ULL
+
+static inline uint64_t splitmix64(uint64_t seed, uint64_t n)
+{
+    uint64_t z = seed + (n + 1) * SPLITMIX_GAMMA;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Равномерное число в [0, 1) из старших 53 бит
+static inline double unit_double(uint64_t x)
+{
+    return (x >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double uniform_mark(uint64_t seed, uint64_t i)
+{
+    double integer_part = MIN_MJD + unit_double(splitmix64(seed, 2 * i)) * (MAX_MJD - MIN_MJD);
+    double fractional_part = unit_double(splitmix64(seed, 2 * i + 1));
+    return integer_part + fractional_part;
+}
+
+// Возрастающая метка позиции pos: шаг на запись плюс смещение внутри шага
+static double sorted_mark(const struct gen_params *p, uint64_t pos)
+{
+    double step = (MAX_MJD - MIN_MJD) / p->records;
+    return MIN_MJD + (pos + unit_double(splitmix64(p->seed, 2 * pos))) * step;
+}
+
+// Ранг из [1, ZIPF_KEYS] с вероятностью ~ 1/rank^s обращением
+// непрерывной функции распределения
+static uint64_t zipf_rank(double u, double s)
 {
-    if (argc != 3)
+    double r;
+    if (fabs(s - 1.0) < 1e-9)
+        r = exp(u * log((double)ZIPF_KEYS));
+    else
+        r = pow(u * (pow((double)ZIPF_KEYS, 1.0 - s) - 1.0) + 1.0, 1.0 / (1.0 - s));
+    uint64_t rank = (uint64_t)r;
+    return rank < 1 ? 1 : (rank > ZIPF_KEYS ? ZIPF_KEYS : rank);
+}
+
+static void make_record(const struct gen_params *p, uint64_t i, struct index_s *rec)
+{
+    switch (p->kind)
     {
-        fprintf(stderr, "[Main] Usage: %s records filename\n", argv[0]);
-        return 1;
+    case DIST_SORTED:
+        rec->time_mark = sorted_mark(p, i);
+        break;
+    case DIST_REVERSE:
+        rec->time_mark = sorted_mark(p, p->records - 1 - i);
+        break;
+    case DIST_NEARLY:
+        // param% записей получают случайную метку, остальные на своих местах
+        if (unit_double(splitmix64(p->seed, 2 * i + 1)) * 100.0 < p->param)
+            rec->time_mark = uniform_mark(p->seed ^ SPLITMIX_GAMMA, i);
+        else
+            rec->time_mark = sorted_mark(p, i);
+        break;
+    case DIST_ZIPF:
+    {
+        // Ранги перемешаны по диапазону дат, чтобы частые ключи не шли подряд
+        uint64_t rank = zipf_rank(unit_double(splitmix64(p->seed, 2 * i)), p->param);
+        double day = unit_double(splitmix64(p->seed ^ SPLITMIX_GAMMA, rank));
+        rec->time_mark = floor(MIN_MJD + day * (MAX_MJD - MIN_MJD));
+        break;
     }
+    case DIST_CLUSTERED:
+    {
+        // Центр кластера равномерный, отклонение - сумма двух равномерных
+        // величин, метка округлена до секунды, поэтому много повторов
+        uint64_t clusters = p->param >= 1 ? (uint64_t)p->param : 1;
+        uint64_t cluster = splitmix64(p->seed, 2 * i) % clusters;
+        double center = MIN_MJD + unit_double(splitmix64(p->seed ^ SPLITMIX_GAMMA, cluster)) * (MAX_MJD - MIN_MJD);
+        uint64_t x = splitmix64(p->seed, 2 * i + 1);
+        double offset = (unit_double(x) + unit_double(x << 32) - 1.0) * CLUSTER_WIDTH;
+        rec->time_mark = round((center + offset) * 86400.0) / 86400.0;
+        break;
+    }
+    case DIST_EQUAL:
+        rec->time_mark = MIN_MJD;
+        break;
+    default:
+        rec->time_mark = uniform_mark(p->seed, i);
+        break;
+    }
+    rec->recno = i + 1;
+}
+
+static int parse_distribution(const char *arg, struct gen_params *p)
+{
+    const char *colon = strchr(arg, ':');
+    size_t len = colon ? (size_t)(colon - arg) : strlen(arg);
+    for (size_t d = 0; d < sizeof(dists) / sizeof(dists[0]); d++)
+    {
+        if (strlen(dists[d].name) != len || strncmp(arg, dists[d].name, len) != 0)
+            continue;
+        p->kind = dists[d].kind;
+        p->param = colon ? atof(colon + 1) : dists[d].param;
+        return 0;
+    }
+    return 1;
+}
+
+struct gen_task
+{
+    int fd;
+    const struct gen_params *params;
+    uint64_t first; // Диапазон записей потока [first, last)
+    uint64_t last;
+    int status;
+};
 
-    uint64_t records = atoll(argv[1]);
-    const char *filename = argv[2];
+void *gen_thread(void *arg)
+{
+    struct gen_task *task = (struct gen_task *)arg;
+    struct index_s *buf = malloc(sizeof(struct index_s) * CHUNK_RECORDS);
+    if (!buf)
+    {
+        perror("[Thread] malloc");
+        task->status = 1;
+        return NULL;
+    }
 
-    if (records % RECORDS_MULTIPLE != 0)
+    for (uint64_t i = task->first; i < task->last; i += CHUNK_RECORDS)
     {
-        fprintf(stderr, "[Main] Records must be multiple of %d\n", RECORDS_MULTIPLE);
+        size_t count = (task->last - i < CHUNK_RECORDS) ? task->last - i : CHUNK_RECORDS;
+        for (size_t j = 0; j < count; j++)
+            make_record(task->params, i + j, &buf[j]);
+
+        const char *p = (const char *)buf;
+        size_t left = count * sizeof(struct index_s);
+        off_t pos = sizeof(uint64_t) + i * sizeof(struct index_s);
+        while (left > 0)
+        {
+            ssize_t n = pwrite(task->fd, p, left, pos);
+            if (n <= 0)
+            {
+                perror("[Thread] pwrite");
+                free(buf);
+                task->status = 1;
+                return NULL;
+            }
+            p += n;
+            left -= n;
+            pos += n;
+        }
+    }
+
+    free(buf);
+    task->status = 0;
+    return NULL;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "[Main] Usage: %s [-t threads] [-s seed] "
+                    "[-d uniform|sorted|reverse|nearly[:pct]|zipf[:s]|clustered[:n]|equal] records filename\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    struct gen_params params = {.seed = time(NULL), .kind = DIST_UNIFORM};
+    int c;
+    while ((c = getopt(argc, argv, "t:s:d:")) != -1)
+    {
+        switch (c)
+        {
+        case 't':
+            threads = atol(optarg);
+            break;
+        case 's':
+            params.seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'd':
+            if (parse_distribution(optarg, &params) != 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 2)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (threads < 1 || threads > MAX_THREADS)
+    {
+        fprintf(stderr, "[Main] threads must be between 1 and %d\n", MAX_THREADS);
         return 1;
     }
 
+    uint64_t records = atoll(argv[optind]);
+    params.records = records;
+    const char *filename = argv[optind + 1];
+    if ((uint64_t)threads > records)
+        threads = records ? records : 1;
+
     int fd = open(filename, O_CREAT | O_WRONLY | O_TRUNC, 0666);
     if (fd == -1)
     {
@@ -46,33 +268,72 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    if (write(fd, &records, sizeof(uint64_t)) != sizeof(uint64_t))
+    // Место под файл выделяется сразу, чтобы потоки писали в свои
+    // области без роста файла и фрагментации
+    off_t file_size = sizeof(uint64_t) + records * sizeof(struct index_s);
+    int err = posix_fallocate(fd, 0, file_size);
+    if (err != 0 && ftruncate(fd, file_size) == -1)
+    {
+        perror("[Main] ftruncate");
+        close(fd);
+        return 1;
+    }
+
+    if (pwrite(fd, &records, sizeof(uint64_t), 0) != sizeof(uint64_t))
     {
         perror("[Main] write header");
         close(fd);
         return 1;
     }
 
-    unsigned int seed = time(NULL);
-    for (uint64_t i = 0; i < records; i++)
+    struct gen_task *tasks = calloc(threads, sizeof(struct gen_task));
+    pthread_t *thread_ids = malloc(sizeof(pthread_t) * threads);
+    if (!tasks || !thread_ids)
     {
-        struct index_s rec;
-        double integer_part = MIN_MJD + (rand_r(&seed) / (double)RAND_MAX) * (MAX_MJD - MIN_MJD);
-        double fractional_part = rand_r(&seed) / (double)RAND_MAX;
-        rec.time_mark = integer_part + fractional_part;
-        rec.recno = i + 1;
+        perror("[Main] malloc");
+        free(tasks);
+        free(thread_ids);
+        close(fd);
+        return 1;
+    }
 
-        if (write(fd, &rec, sizeof(struct index_s)) != sizeof(struct index_s))
+    for (long t = 0; t < threads; t++)
+    {
+        tasks[t].fd = fd;
+        tasks[t].params = &params;
+        tasks[t].first = records * t / threads;
+        tasks[t].last = records * (t + 1) / threads;
+    }
+
+    long started = 1;
+    for (; started < threads; started++)
+    {
+        if (pthread_create(&thread_ids[started], NULL, gen_thread, &tasks[started]) != 0)
         {
-            perror("[Main] write record");
-            close(fd);
-            return 1;
+            perror("[Main] pthread_create");
+            break;
         }
     }
+    gen_thread(&tasks[0]);
+    // Диапазоны потоков, которые не удалось запустить, генерируем сами
+    for (long t = started; t < threads; t++)
+        gen_thread(&tasks[t]);
+    for (long t = 1; t < started; t++)
+        pthread_join(thread_ids[t], NULL);
 
-    printf("[Main] Generated %lu records in %s\n", records, filename);
-    fflush(stdout);
-
+    int status = 0;
+    for (long t = 0; t < threads; t++)
+    {
+        if (tasks[t].status != 0)
+            status = 1;
+    }
+    free(tasks);
+    free(thread_ids);
     close(fd);
+    if (status != 0)
+        return 1;
+
+    printf("[Main] Generated %lu records in %s (seed %lu)\n", records, filename, params.seed);
+    fflush(stdout);
     return 0;
-}
\ No newline at end of file
+}
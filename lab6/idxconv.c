@@ -0,0 +1,161 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "index.h"
+#include "colfile.h"
+
+// Обычный формат -> колоночный
+static int to_columnar(const char *in, const char *out, uint32_t block_records)
+{
+    int fd = open(in, O_RDONLY);
+    if (fd == -1)
+    {
+        perror("[Main] open");
+        return 1;
+    }
+    uint64_t records;
+    struct stat st;
+    if (pread(fd, &records, sizeof(uint64_t), 0) != sizeof(uint64_t) || fstat(fd, &st) == -1)
+    {
+        perror("[Main] read header");
+        close(fd);
+        return 1;
+    }
+    size_t file_size = sizeof(uint64_t) + records * RECORD_SIZE;
+    if ((uint64_t)st.st_size < file_size)
+    {
+        fprintf(stderr, "[Main] file is shorter than %lu records from its header\n", records);
+        close(fd);
+        return 1;
+    }
+    void *map = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("[Main] mmap");
+        return 1;
+    }
+    posix_madvise(map, file_size, POSIX_MADV_SEQUENTIAL);
+
+    struct col_writer w;
+    if (colw_open(&w, out, block_records) != 0)
+    {
+        munmap(map, file_size);
+        return 1;
+    }
+    const struct index_s *data = (const struct index_s *)((const char *)map + sizeof(uint64_t));
+    int ret = colw_put(&w, data, records) != 0;
+    uint64_t bytes = w.pos;
+    if (colw_close(&w) != 0)
+        ret = 1;
+    munmap(map, file_size);
+    if (ret == 0)
+    {
+        printf("[Main] Wrote %lu records to %s: %lu data bytes, %.2f bytes per record\n", records, out, bytes,
+               records ? (double)bytes / records : 0.0);
+        fflush(stdout);
+    }
+    return ret;
+}
+
+// Колоночный формат -> обычный
+static int to_raw(const char *in, const char *out)
+{
+    struct col_file f;
+    if (col_open(&f, in) != 0)
+        return 1;
+    struct index_s *buf = malloc(sizeof(struct index_s) * f.hdr.block_records);
+    int fd = open(out, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+    if (!buf || fd == -1)
+    {
+        perror("[Main] open output");
+        free(buf);
+        if (fd != -1)
+            close(fd);
+        col_close(&f);
+        return 1;
+    }
+
+    int ret = 0;
+    if (write(fd, &f.hdr.records, sizeof(uint64_t)) != sizeof(uint64_t))
+    {
+        perror("[Main] write header");
+        ret = 1;
+    }
+    for (uint32_t b = 0; b < f.hdr.blocks && ret == 0; b++)
+    {
+        int n = col_decode_block(&f, b, buf);
+        if (n < 0)
+        {
+            fprintf(stderr, "[Main] block %u of %s is corrupted\n", b, in);
+            ret = 1;
+            break;
+        }
+        const char *p = (const char *)buf;
+        size_t left = n * RECORD_SIZE;
+        while (left > 0)
+        {
+            ssize_t w = write(fd, p, left);
+            if (w <= 0)
+            {
+                perror("[Main] write records");
+                ret = 1;
+                break;
+            }
+            p += w;
+            left -= w;
+        }
+    }
+    close(fd);
+    free(buf);
+    if (ret == 0)
+    {
+        printf("[Main] Wrote %lu records to %s\n", f.hdr.records, out);
+        fflush(stdout);
+    }
+    col_close(&f);
+    return ret;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "[Main] Usage: %s [-b block_records] to-col input output\n"
+                    "       %s to-raw input output\n",
+            prog, prog);
+}
+
+int main(int argc, char *argv[])
+{
+    uint32_t block_records = COL_BLOCK_RECORDS;
+    int c;
+    while ((c = getopt(argc, argv, "b:")) != -1)
+    {
+        switch (c)
+        {
+        case 'b':
+            block_records = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 3 || block_records == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    if (strcmp(argv[optind], "to-col") == 0)
+        return to_columnar(argv[optind + 1], argv[optind + 2], block_records);
+    if (strcmp(argv[optind], "to-raw") == 0)
+        return to_raw(argv[optind + 1], argv[optind + 2]);
+    usage(argv[0]);
+    return 1;
+}
@@ -0,0 +1,53 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define RECORD_SIZE sizeof(struct index_s)
+
+// Диапазон меток времени, которые порождает gen (MJD)
+#define MIN_MJD 15020.0
+#define MAX_MJD 2460299.0
+
+struct index_s
+{
+    double time_mark;
+    uint64_t recno;
+};
+
+struct index_hdr_s
+{
+    uint64_t records;
+    struct index_s idx[];
+};
+
+// Ключ сортировки: беззнаковое число с тем же порядком, что у time_mark.
+// Отрицательные числа инвертируются целиком, у положительных выставляется
+// старший бит. -0.0 равен +0.0, все NaN считаются равными и идут после +inf.
+static inline uint64_t index_key(double time_mark)
+{
+    uint64_t bits;
+    if (time_mark != time_mark)
+        return UINT64_MAX;
+    if (time_mark == 0.0)
+        time_mark = 0.0;
+    memcpy(&bits, &time_mark, sizeof(bits));
+    return (bits >> 63) ? ~bits : bits | (1ULL << 63);
+}
+
+// Порядок записей: по index_key(time_mark), при равенстве - по recno
+static inline int compare_index(const void *a, const void *b)
+{
+    const struct index_s *ia = (const struct index_s *)a;
+    const struct index_s *ib = (const struct index_s *)b;
+    uint64_t ka = index_key(ia->time_mark);
+    uint64_t kb = index_key(ib->time_mark);
+    if (ka != kb)
+        return ka < kb ? -1 : 1;
+    if (ia->recno != ib->recno)
+        return ia->recno < ib->recno ? -1 : 1;
+    return 0;
+}
+
+#endif // INDEX_H
@@ -0,0 +1,127 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "journal.h"
+
+static int append(int fd, const char *line)
+{
+    size_t len = strlen(line);
+    if (write(fd, line, len) != (ssize_t)len)
+        return -1;
+    return fdatasync(fd);
+}
+
+// Разбор прочитанного журнала: учитываются только целые строки
+static void parse(struct journal *j, char *text, size_t len)
+{
+    char *line = text;
+    char *end = text + len;
+    while (line < end)
+    {
+        char *nl = memchr(line, '\n', end - line);
+        if (!nl)
+            break;
+        *nl = '\0';
+        unsigned long long index;
+        if (sscanf(line, "part %llu", &index) == 1 && index < (unsigned long long)j->parts)
+            j->part_done[index] = 1;
+        else if (sscanf(line, "chunk %llu", &index) == 1 && index < j->chunks)
+            j->chunk_done[index] = 1;
+        else if (strcmp(line, "complete") == 0)
+            j->complete = 1;
+        line = nl + 1;
+    }
+}
+
+int journal_open(struct journal *j, const char *path, const char *header, int parts, uint64_t chunks)
+{
+    j->parts = parts;
+    j->chunks = chunks;
+    j->complete = 0;
+    j->resumed = 0;
+    j->part_done = calloc(parts, 1);
+    j->chunk_done = calloc(chunks, 1);
+    j->fd = open(path, O_CREAT | O_RDWR, 0666);
+    if (!j->part_done || !j->chunk_done || j->fd == -1)
+    {
+        perror("[Journal] open");
+        if (j->fd != -1)
+            close(j->fd);
+        free(j->part_done);
+        free(j->chunk_done);
+        return 1;
+    }
+    pthread_mutex_init(&j->mutex, NULL);
+
+    struct stat st;
+    char *text = NULL;
+    size_t header_len = strlen(header);
+    if (fstat(j->fd, &st) == 0 && st.st_size > 0 && (text = malloc(st.st_size + 1)) != NULL &&
+        pread(j->fd, text, st.st_size, 0) == st.st_size)
+    {
+        text[st.st_size] = '\0';
+        // Журнал другого входа не учитывается целиком, даже если он
+        // отмечен complete: его результат к этому входу не относится
+        j->resumed = (size_t)st.st_size >= header_len && memcmp(text, header, header_len) == 0;
+        if (j->resumed)
+            parse(j, text + header_len, st.st_size - header_len);
+    }
+    free(text);
+    if (!j->resumed)
+        return journal_reset(j, header);
+    if (lseek(j->fd, 0, SEEK_END) == -1)
+    {
+        perror("[Journal] seek");
+        return 1;
+    }
+    return 0;
+}
+
+int journal_reset(struct journal *j, const char *header)
+{
+    memset(j->part_done, 0, j->parts);
+    memset(j->chunk_done, 0, j->chunks);
+    j->complete = 0;
+    j->resumed = 0;
+    if (ftruncate(j->fd, 0) == -1 || lseek(j->fd, 0, SEEK_SET) == -1 || append(j->fd, header) != 0)
+    {
+        perror("[Journal] reset");
+        return 1;
+    }
+    return 0;
+}
+
+int journal_mark(struct journal *j, const char *kind, uint64_t index)
+{
+    char line[64];
+    snprintf(line, sizeof(line), "%s %lu\n", kind, index);
+    pthread_mutex_lock(&j->mutex);
+    int ret = append(j->fd, line);
+    pthread_mutex_unlock(&j->mutex);
+    if (ret != 0)
+        perror("[Journal] write");
+    return ret;
+}
+
+int journal_complete(struct journal *j)
+{
+    pthread_mutex_lock(&j->mutex);
+    int ret = append(j->fd, "complete\n");
+    pthread_mutex_unlock(&j->mutex);
+    if (ret != 0)
+        perror("[Journal] write");
+    j->complete = ret == 0;
+    return ret;
+}
+
+void journal_close(struct journal *j)
+{
+    close(j->fd);
+    pthread_mutex_destroy(&j->mutex);
+    free(j->part_done);
+    free(j->chunk_done);
+}
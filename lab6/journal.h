@@ -0,0 +1,38 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+#include <pthread.h>
+
+// Журнал возобновляемой сортировки: текстовый файл, первая строка -
+// заголовок с параметрами входа, дальше по строке на каждый готовый
+// шаг ("part N", "chunk N", "complete"). Строка дописывается и
+// сбрасывается на диск только после того, как на диске данные шага,
+// поэтому после сбоя журнал никогда не опережает данные. Оборванная
+// последняя строка игнорируется.
+struct journal
+{
+    int fd;
+    pthread_mutex_t mutex;
+    int parts;
+    uint64_t chunks;
+    unsigned char *part_done;
+    unsigned char *chunk_done;
+    int complete; // Результат записан целиком, остался только rename
+    int resumed;  // Журнал с тем же заголовком найден на диске
+};
+
+// Открывает журнал path. Если заголовок совпадает с header, прочитанные
+// шаги сохраняются, иначе журнал начинается заново.
+int journal_open(struct journal *j, const char *path, const char *header, int parts, uint64_t chunks);
+
+// Начать журнал заново с заголовком header
+int journal_reset(struct journal *j, const char *header);
+
+// Дописать шаг: kind - "part" или "chunk". Потокобезопасно.
+int journal_mark(struct journal *j, const char *kind, uint64_t index);
+int journal_complete(struct journal *j);
+
+void journal_close(struct journal *j);
+
+#endif // JOURNAL_H
@@ -0,0 +1,449 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include "kmerge.h"
+#include "loser_tree.h"
+#include "runio.h"
+
+#define KMERGE_MAX_ENTRIES 4096 // Больше источников - запросы ждут места в очереди
+
+size_t kmerge_co_rank(const void *a, size_t a_len, const void *b, size_t b_len, size_t size, size_t rank,
+                      rs_less less, const void *ctx)
+{
+    const char *ca = (const char *)a, *cb = (const char *)b;
+    size_t lo = rank > b_len ? rank - b_len : 0;
+    size_t hi = rank < a_len ? rank : a_len;
+    while (lo < hi)
+    {
+        size_t i = lo + (hi - lo) / 2;
+        if (!less(ctx, cb + (rank - i - 1) * size, ca + i * size))
+            lo = i + 1;
+        else
+            hi = i;
+    }
+    return lo;
+}
+
+// Части для разбиения по рангу
+struct split_parts
+{
+    const struct rs_format *f;
+    const char *const *parts;
+    const size_t *lens;
+    int k;
+};
+
+static inline const char *part_rec(const struct split_parts *sp, int part, size_t j)
+{
+    return sp->parts[part] + j * sp->f->record_size;
+}
+
+// Записей части, префикс ключа которых меньше (strict = 1) или не больше key
+static size_t count_prefix(const struct split_parts *sp, int part, uint64_t key, int strict)
+{
+    size_t lo = 0, hi = sp->lens[part];
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        uint64_t k = rs_prefix(&sp->f->key, part_rec(sp, part, mid));
+        if (k < key || (!strict && k == key))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+static uint64_t count_all(const struct split_parts *sp, uint64_t key)
+{
+    uint64_t sum = 0;
+    for (int i = 0; i < sp->k; i++)
+        sum += count_prefix(sp, i, key, 0);
+    return sum;
+}
+
+// Запись j части t идет в результате раньше записи pj части p: при
+// равных ключах раньше та, что в части с меньшим номером или раньше в ней
+static int merged_before(const struct split_parts *sp, int t, size_t j, int p, size_t pj)
+{
+    int c = rs_compare(sp->f, part_rec(sp, t, j), part_rec(sp, p, pj));
+    if (c != 0)
+        return c < 0;
+    return t < p || (t == p && j < pj);
+}
+
+// Записей окна [lo, hi) части t, идущих раньше записи pj части p
+static size_t count_before(const struct split_parts *sp, int t, size_t lo, size_t hi, int p, size_t pj)
+{
+    while (lo < hi)
+    {
+        size_t mid = lo + (hi - lo) / 2;
+        if (merged_before(sp, t, mid, p, pj))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Сначала двоичным поиском по значениям находится префикс ключа P записи
+// ранга rank: все записи с меньшим префиксом левее разреза, с большим -
+// правее. Если префикса мало для порядка, разрез среди записей с
+// префиксом P ищется сужением окон [lo, hi): середина самого широкого
+// окна сравнивается со всеми частями, и по ее рангу сужаются все окна.
+int kmerge_split(const struct rs_format *f, const char *const *parts, const size_t *lens, int k, uint64_t rank,
+                 size_t *pos)
+{
+    struct split_parts sp = {.f = f, .parts = parts, .lens = lens, .k = k};
+    uint64_t total = 0;
+    for (int i = 0; i < k; i++)
+        total += lens[i];
+    if (rank == 0 || rank >= total)
+    {
+        for (int i = 0; i < k; i++)
+            pos[i] = rank == 0 ? 0 : lens[i];
+        return 0;
+    }
+
+    uint64_t lo_key = 0, hi_key = UINT64_MAX;
+    while (lo_key < hi_key)
+    {
+        uint64_t mid = lo_key + (hi_key - lo_key) / 2;
+        if (count_all(&sp, mid) >= rank)
+            hi_key = mid;
+        else
+            lo_key = mid + 1;
+    }
+
+    size_t *lo = malloc(sizeof(size_t) * 4 * k);
+    if (!lo)
+        return 1;
+    size_t *hi = lo + k, *base_lo = lo + 2 * k, *base_hi = lo + 3 * k;
+    uint64_t left = rank;
+    for (int i = 0; i < k; i++)
+    {
+        lo[i] = base_lo[i] = count_prefix(&sp, i, lo_key, 1);
+        hi[i] = base_hi[i] = count_prefix(&sp, i, lo_key, 0);
+        left -= lo[i];
+    }
+
+    if (!rs_has_tail(f))
+    {
+        // Записи с равным префиксом равны: берутся по порядку частей
+        for (int i = 0; i < k; i++)
+        {
+            size_t equal = hi[i] - lo[i];
+            if (equal > left)
+                equal = left;
+            pos[i] = lo[i] + equal;
+            left -= equal;
+        }
+        free(lo);
+        return 0;
+    }
+
+    for (;;)
+    {
+        int w = 0;
+        for (int i = 1; i < k; i++)
+        {
+            if (hi[i] - lo[i] > hi[w] - lo[w])
+                w = i;
+        }
+        if (hi[w] == lo[w])
+            break;
+        size_t m = lo[w] + (hi[w] - lo[w]) / 2;
+        uint64_t below = 0;
+        for (int i = 0; i < k; i++)
+        {
+            pos[i] = i == w ? m : count_before(&sp, i, base_lo[i], base_hi[i], w, m);
+            below += pos[i];
+        }
+        // Запись m части w и все, что раньше нее, - в первых rank или нет
+        int before = below < rank;
+        for (int i = 0; i < k; i++)
+        {
+            size_t cut = pos[i] + (before && i == w);
+            if (before && cut > lo[i])
+                lo[i] = cut;
+            if (!before && cut < hi[i])
+                hi[i] = cut;
+        }
+    }
+    for (int i = 0; i < k; i++)
+        pos[i] = lo[i];
+    free(lo);
+    return 0;
+}
+
+// Буферы всех источников и записи регистрируются в кольце одним
+// вызовом; если ядро отказало (лимит памяти, больше UIO_MAXIOV буферов),
+// запросы идут без зарегистрированных буферов. Затем в полет уходят
+// первые окна всех источников.
+static int register_buffers(struct uring *ring, struct run_reader *readers, int k, struct run_writer *writer)
+{
+    struct iovec *iov = malloc(sizeof(struct iovec) * (k + 1));
+    if (iov)
+    {
+        for (int i = 0; i < k; i++)
+            rr_iovec(&readers[i], &iov[i]);
+        rw_iovec(writer, &iov[k]);
+        if (uring_register(ring, iov, k + 1) == 0)
+        {
+            for (int i = 0; i < k; i++)
+                readers[i].buf_index = i;
+            writer->buf_index = k;
+        }
+        free(iov);
+    }
+    for (int i = 0; i < k; i++)
+    {
+        if (rr_prefetch(&readers[i]) != 0)
+            return -1;
+    }
+    return uring_submit(ring);
+}
+
+int kmerge_range(const struct rs_format *f, int in_fd, const off_t *starts, const off_t *ends, int k, int out_fd,
+                 off_t out_pos, size_t read_buf, size_t write_buf, const struct kmerge_io *io, struct metrics *m,
+                 int thread)
+{
+    size_t size = f->record_size;
+    uint64_t t0 = metrics_now();
+    uint64_t merged = 0;
+    struct run_reader *readers = calloc(k, sizeof(struct run_reader));
+    struct run_writer writer = {0};
+    struct loser_tree lt = {0};
+    int ret = 1;
+    if (!readers || lt_init(&lt, k, f) != 0)
+    {
+        perror("[Merge] malloc readers");
+        free(readers);
+        return 1;
+    }
+
+    // По запросу в полете на каждый источник и на запись. Без кольца
+    // (нет памяти, запрет) слияние идет синхронно.
+    struct uring ring;
+    struct uring *rp = NULL;
+    unsigned entries = k + 1 < KMERGE_MAX_ENTRIES ? k + 1 : KMERGE_MAX_ENTRIES;
+    if (io && io->uring && uring_init(&ring, entries) == 0)
+        rp = &ring;
+    int direct_in = rp && io->in_direct_fd >= 0;
+
+    if (rw_open(&writer, out_fd, out_pos, write_buf, rp, rp ? io->out_direct_fd : -1) != 0)
+    {
+        perror("[Merge] malloc writer buffer");
+        goto out;
+    }
+
+    for (int i = 0; i < k; i++)
+    {
+        if (rr_open(&readers[i], direct_in ? io->in_direct_fd : in_fd, starts[i], ends[i], read_buf, size, rp,
+                    direct_in) != 0)
+        {
+            perror("[Merge] malloc reader buffer");
+            goto out;
+        }
+    }
+    if (rp && register_buffers(rp, readers, k, &writer) != 0)
+    {
+        perror("[Merge] queue initial reads");
+        goto out;
+    }
+    for (int i = 0; i < k; i++)
+    {
+        int got = rr_next(&readers[i], lt_head(&lt, i), size);
+        if (got < 0)
+        {
+            perror("[Merge] read initial record");
+            goto out;
+        }
+        lt_set(&lt, i, got);
+    }
+    lt_build(&lt);
+
+    int min_idx;
+    while ((min_idx = lt_winner(&lt)) != -1)
+    {
+        if (rw_put(&writer, lt_head(&lt, min_idx), size) != 0)
+        {
+            perror("[Merge] write merged record");
+            goto out;
+        }
+        merged++;
+        int got = rr_next(&readers[min_idx], lt_head(&lt, min_idx), size);
+        if (got < 0)
+        {
+            perror("[Merge] read next record");
+            goto out;
+        }
+        lt_set(&lt, min_idx, got);
+        lt_replay(&lt);
+    }
+
+    if (rw_flush(&writer) != 0)
+    {
+        perror("[Merge] write merged record");
+        goto out;
+    }
+    ret = 0;
+
+out:
+    {
+        uint64_t io_ns = writer.io_ns;
+        uint64_t bytes_read = 0;
+        for (int i = 0; i < k; i++)
+        {
+            io_ns += readers[i].io_ns;
+            bytes_read += readers[i].bytes;
+        }
+        metrics_time(m, thread, PHASE_IO, io_ns);
+        metrics_time(m, thread, PHASE_MERGE, metrics_now() - t0 - io_ns);
+        metrics_count(m, thread, CNT_FINAL, merged);
+        metrics_count(m, thread, CNT_BYTES_READ, bytes_read);
+        metrics_count(m, thread, CNT_BYTES_WRITTEN, writer.bytes);
+    }
+    for (int i = 0; i < k; i++)
+        rr_close(&readers[i]);
+    free(readers);
+    rw_close(&writer);
+    if (rp)
+        uring_exit(rp);
+    lt_free(&lt);
+    return ret;
+}
+
+// Общее состояние финального слияния
+struct parts_shared
+{
+    const struct kmerge_job *job;
+    int k;
+    const off_t *offsets; // offsets[c][i] - начало куска c в части i
+    atomic_uint_fast64_t next;
+    atomic_int failed;
+};
+
+struct parts_worker
+{
+    struct parts_shared *sh;
+    int thread;
+};
+
+static void *parts_thread(void *arg)
+{
+    struct parts_worker *w = (struct parts_worker *)arg;
+    struct parts_shared *sh = w->sh;
+    const struct kmerge_job *job = sh->job;
+    int k = sh->k;
+    for (;;)
+    {
+        uint64_t c = atomic_fetch_add(&sh->next, 1);
+        if (c >= job->chunks || atomic_load(&sh->failed))
+            break;
+        if (job->done && job->done[c])
+            continue;
+        if (job->verbose)
+        {
+            printf("[Thread %d] Merging ranks %lu-%lu\n", w->thread, job->ranks[c], job->ranks[c + 1]);
+            fflush(stdout);
+        }
+        off_t out_pos = job->f->header_size + job->ranks[c] * job->f->record_size;
+        int status = kmerge_range(job->f, job->fd, &sh->offsets[c * k], &sh->offsets[(c + 1) * k], k, job->out_fd,
+                                  out_pos, job->read_buf, job->write_buf, &job->io, job->m, w->thread);
+        if (status == 0 && job->chunk_done)
+            status = job->chunk_done(job->arg, c);
+        if (status != 0)
+        {
+            atomic_store(&sh->failed, 1);
+            break;
+        }
+    }
+    return NULL;
+}
+
+int kmerge_parts(const struct kmerge_job *job)
+{
+    const struct rs_format *f = job->f;
+    int k = (job->records + job->records_per_part - 1) / job->records_per_part;
+    size_t file_size = f->header_size + job->records * f->record_size;
+    void *map = mmap(NULL, file_size, PROT_READ, MAP_SHARED, job->fd, 0);
+    if (map == MAP_FAILED)
+    {
+        perror("[Merge] mmap parts");
+        return 1;
+    }
+
+    const char **parts = malloc(sizeof(char *) * k);
+    size_t *lens = malloc(sizeof(size_t) * k);
+    size_t *cuts = malloc(sizeof(size_t) * k);
+    off_t *offsets = malloc(sizeof(off_t) * k * (job->chunks + 1));
+    struct parts_worker *workers = calloc(job->threads, sizeof(struct parts_worker));
+    pthread_t *thread_ids = malloc(sizeof(pthread_t) * job->threads);
+    int ret = 1;
+    if (!parts || !lens || !cuts || !offsets || !workers || !thread_ids)
+    {
+        perror("[Merge] malloc merge tasks");
+        goto out;
+    }
+
+    const char *records = (const char *)map + f->header_size;
+    for (int i = 0; i < k; i++)
+    {
+        uint64_t first = (uint64_t)i * job->records_per_part;
+        parts[i] = records + first * f->record_size;
+        lens[i] = job->records - first < job->records_per_part ? job->records - first : job->records_per_part;
+    }
+
+    // Разделители на границах кусков
+    for (uint64_t c = 0; c <= job->chunks; c++)
+    {
+        if (kmerge_split(f, parts, lens, k, job->ranks[c], cuts) != 0)
+        {
+            perror("[Merge] split parts");
+            goto out;
+        }
+        for (int i = 0; i < k; i++)
+            offsets[c * k + i] = parts[i] - (const char *)map + cuts[i] * f->record_size;
+    }
+
+    struct parts_shared shared = {.job = job, .k = k, .offsets = offsets};
+    atomic_init(&shared.next, 0);
+    atomic_init(&shared.failed, 0);
+    for (int t = 0; t < job->threads; t++)
+    {
+        workers[t].sh = &shared;
+        workers[t].thread = t;
+    }
+
+    int started = 1;
+    for (; started < job->threads; started++)
+    {
+        if (pthread_create(&thread_ids[started], NULL, parts_thread, &workers[started]) != 0)
+        {
+            perror("[Merge] pthread_create");
+            break;
+        }
+    }
+    // Куски, которые не разобрали незапущенные потоки, сливает вызывающий
+    parts_thread(&workers[0]);
+    for (int t = 1; t < started; t++)
+    {
+        if (pthread_join(thread_ids[t], NULL) != 0)
+            perror("[Merge] pthread_join");
+    }
+    ret = atomic_load(&shared.failed);
+
+out:
+    free(parts);
+    free(lens);
+    free(cuts);
+    free(offsets);
+    free(workers);
+    free(thread_ids);
+    munmap(map, file_size);
+    return ret;
+}
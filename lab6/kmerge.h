@@ -0,0 +1,71 @@
+#ifndef KMERGE_H
+#define KMERGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "metrics.h"
+#include "recfmt.h"
+
+// Сколько элементов a входит в первые rank элементов слияния
+// отсортированных по less a и b, где при равенстве раньше идут элементы
+// a. Элементы - по size байт.
+size_t kmerge_co_rank(const void *a, size_t a_len, const void *b, size_t b_len, size_t size, size_t rank,
+                      rs_less less, const void *ctx);
+
+// Разбиение k отсортированных частей с записями формата f по рангу:
+// pos[i] - сколько записей части i попадает в первые rank записей
+// результата слияния. Все записи левее разреза не больше любой записи
+// правее, равные записи распределяются по частям в порядке номеров, как
+// при устойчивом слиянии. 0 - успех, 1 - нет памяти.
+int kmerge_split(const struct rs_format *f, const char *const *parts, const size_t *lens, int k, uint64_t rank,
+                 size_t *pos);
+
+// Ввод-вывод слияния: uring = 1 - через собственное кольцо io_uring с
+// зарегистрированными буферами (без кольца - pread/pwrite). *_direct_fd -
+// те же файлы, открытые с O_DIRECT, или -1.
+struct kmerge_io
+{
+    int uring;
+    int in_direct_fd;
+    int out_direct_fd;
+};
+
+// Слияние диапазонов [starts[i], ends[i]) файла in_fd (смещения в байтах)
+// из записей формата f с записью результата в out_fd начиная со смещения
+// out_pos. Время и объем ввода-вывода учитываются в слоте thread метрик m
+// (может быть NULL). io == NULL - синхронный ввод-вывод.
+int kmerge_range(const struct rs_format *f, int in_fd, const off_t *starts, const off_t *ends, int k, int out_fd,
+                 off_t out_pos, size_t read_buf, size_t write_buf, const struct kmerge_io *io, struct metrics *m,
+                 int thread);
+
+// Финальное слияние частей файла fd: записи после заголовка идут частями
+// по records_per_part, каждая отсортирована. Результат делится по рангам
+// ranks на chunks кусков, каждый кусок сливается kmerge_range независимо
+// и пишется в out_fd по своему смещению (заголовок out_fd не трогается).
+// Куски раздаются threads потокам атомарным счетчиком, вызывающий поток
+// работает как поток 0.
+struct kmerge_job
+{
+    const struct rs_format *f;
+    int fd;
+    int out_fd;
+    uint64_t records;
+    size_t records_per_part;
+    uint64_t chunks;
+    const uint64_t *ranks;     // chunks + 1 границ кусков
+    const unsigned char *done; // Уже слитые куски или NULL
+    // После слияния куска, может быть NULL; ненулевой результат - ошибка
+    int (*chunk_done)(void *arg, uint64_t chunk);
+    void *arg;
+    int threads;
+    size_t read_buf;
+    size_t write_buf;
+    struct kmerge_io io;
+    int verbose;
+    struct metrics *m; // На threads потоков, может быть NULL
+};
+
+int kmerge_parts(const struct kmerge_job *job);
+
+#endif // KMERGE_H
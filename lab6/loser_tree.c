@@ -0,0 +1,96 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include "loser_tree.h"
+
+// Источник a побеждает b. При равных ключах побеждает меньший номер,
+// поэтому слияние устойчиво, как и линейный поиск минимума.
+static inline int lt_beats(const struct loser_tree *lt, int a, int b)
+{
+    if (!lt->active[b])
+        return lt->active[a] || a < b;
+    if (!lt->active[a])
+        return 0;
+    if (lt->key[a] != lt->key[b])
+        return lt->key[a] < lt->key[b];
+    if (lt->tail)
+    {
+        int c = rs_tail_compare(lt->f, lt_head(lt, a), lt_head(lt, b));
+        if (c != 0)
+            return c < 0;
+    }
+    return a < b;
+}
+
+int lt_init(struct loser_tree *lt, int k, const struct rs_format *f)
+{
+    lt->k = k;
+    lt->f = f;
+    lt->tail = rs_has_tail(f);
+    lt->node = malloc(sizeof(int) * 2 * k); // Вторая половина - рабочая для lt_build
+    lt->head = malloc(f->record_size * k);
+    lt->key = malloc(sizeof(uint64_t) * k);
+    lt->active = calloc(k, 1);
+    if (!lt->node || !lt->head || !lt->key || !lt->active)
+    {
+        lt_free(lt);
+        return 1;
+    }
+    return 0;
+}
+
+void lt_free(struct loser_tree *lt)
+{
+    free(lt->node);
+    free(lt->head);
+    free(lt->key);
+    free(lt->active);
+    lt->node = NULL;
+    lt->head = NULL;
+    lt->key = NULL;
+    lt->active = NULL;
+}
+
+void lt_build(struct loser_tree *lt)
+{
+    int k = lt->k;
+    if (k == 1)
+    {
+        lt->node[0] = 0;
+        return;
+    }
+
+    // winner[j] - победитель поддерева узла j, пока строим снизу вверх
+    int *winner = lt->node + k;
+    for (int j = k - 1; j >= 1; j--)
+    {
+        int l = 2 * j, r = 2 * j + 1;
+        int a = (l >= k) ? l - k : winner[l];
+        int b = (r >= k) ? r - k : winner[r];
+        if (lt_beats(lt, a, b))
+        {
+            winner[j] = a;
+            lt->node[j] = b;
+        }
+        else
+        {
+            winner[j] = b;
+            lt->node[j] = a;
+        }
+    }
+    lt->node[0] = winner[1];
+}
+
+void lt_replay(struct loser_tree *lt)
+{
+    int w = lt->node[0];
+    for (int j = (w + lt->k) >> 1; j >= 1; j >>= 1)
+    {
+        if (lt_beats(lt, lt->node[j], w))
+        {
+            int t = lt->node[j];
+            lt->node[j] = w;
+            w = t;
+        }
+    }
+    lt->node[0] = w;
+}
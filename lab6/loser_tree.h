@@ -0,0 +1,52 @@
+#ifndef LOSER_TREE_H
+#define LOSER_TREE_H
+
+#include "recfmt.h"
+
+// Дерево проигравших для k-путевого слияния записей формата f: выбор
+// минимума за O(log k). node[0] хранит номер источника-победителя,
+// node[1..k-1] - проигравших во внутренних узлах. Лист источника i
+// находится в позиции k + i. Узлы сравнивают префиксы ключей, записи -
+// только при равных префиксах, если префикса мало для порядка.
+struct loser_tree
+{
+    int k;
+    const struct rs_format *f;
+    int tail;               // rs_has_tail(f)
+    int *node;
+    char *head;             // Текущая запись каждого источника, k * record_size
+    uint64_t *key;          // Префиксы ключей текущих записей
+    unsigned char *active;  // 0 - источник исчерпан (считается +бесконечностью)
+};
+
+int lt_init(struct loser_tree *lt, int k, const struct rs_format *f);
+void lt_free(struct loser_tree *lt);
+
+// Текущая запись источника i
+static inline void *lt_head(const struct loser_tree *lt, int i)
+{
+    return lt->head + (size_t)i * lt->f->record_size;
+}
+
+// Отметка, что в lt_head(i) новая запись (active = 1) или источник исчерпан
+static inline void lt_set(struct loser_tree *lt, int i, int active)
+{
+    lt->active[i] = active;
+    if (active)
+        lt->key[i] = rs_prefix(&lt->f->key, lt_head(lt, i));
+}
+
+// Построение дерева после lt_set всех источников.
+void lt_build(struct loser_tree *lt);
+
+// Повторный турнир после lt_set у текущего победителя.
+void lt_replay(struct loser_tree *lt);
+
+// Номер источника с минимальной записью или -1, если все исчерпаны.
+static inline int lt_winner(const struct loser_tree *lt)
+{
+    int w = lt->node[0];
+    return lt->active[w] ? w : -1;
+}
+
+#endif // LOSER_TREE_H
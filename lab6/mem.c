@@ -0,0 +1,190 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "mem.h"
+
+#define DEFAULT_HUGE_PAGE (2 * 1024 * 1024)
+#define MAX_NODES 64
+
+// Число из строки вида "Hugepagesize:    2048 kB" в /proc/meminfo или smaps_rollup
+static long read_kb(const char *path, const char *key)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return -1;
+    char line[256];
+    long kb = -1;
+    size_t key_len = strlen(key);
+    while (fgets(line, sizeof(line), f))
+    {
+        if (strncmp(line, key, key_len) == 0 && line[key_len] == ':')
+        {
+            kb = atol(line + key_len + 1);
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+static size_t huge_page_size(void)
+{
+    long kb = read_kb("/proc/meminfo", "Hugepagesize");
+    return kb > 0 ? (size_t)kb * 1024 : DEFAULT_HUGE_PAGE;
+}
+
+// Отображение, выровненное по огромной странице: берется с запасом,
+// лишнее с краев возвращается
+static void *map_aligned(size_t size, size_t align)
+{
+    char *raw = mmap(NULL, size + align, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED)
+        return NULL;
+    char *base = (char *)(((uintptr_t)raw + align - 1) & ~(uintptr_t)(align - 1));
+    if (base > raw)
+        munmap(raw, base - raw);
+    size_t tail = (raw + size + align) - (base + size);
+    if (tail > 0)
+        munmap(base + size, tail);
+    return base;
+}
+
+int mem_alloc(struct mem_buf *b, size_t size, int huge)
+{
+    b->size = 0;
+    b->huge = HUGE_OFF;
+    if (huge == HUGE_OFF)
+    {
+        if (posix_memalign(&b->base, sysconf(_SC_PAGESIZE), size) != 0)
+            b->base = NULL;
+        return b->base ? 0 : 1;
+    }
+
+    size_t page = huge_page_size();
+    size_t rounded = (size + page - 1) / page * page;
+    if (huge == HUGE_EXPLICIT)
+    {
+        b->base = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (b->base != MAP_FAILED)
+        {
+            b->size = rounded;
+            b->huge = HUGE_EXPLICIT;
+            return 0;
+        }
+        perror("[Mem] MAP_HUGETLB, falling back to transparent huge pages");
+    }
+
+    b->base = map_aligned(rounded, page);
+    if (!b->base)
+        return 1;
+    b->size = rounded;
+    b->huge = HUGE_THP;
+    mem_advise_huge(b->base, rounded);
+    return 0;
+}
+
+void mem_free(struct mem_buf *b)
+{
+    if (b->size)
+        munmap(b->base, b->size);
+    else
+        free(b->base);
+    b->base = NULL;
+}
+
+void mem_advise_huge(void *addr, size_t len)
+{
+#ifdef MADV_HUGEPAGE
+    madvise(addr, len, MADV_HUGEPAGE);
+#else
+    (void)addr;
+    (void)len;
+#endif
+}
+
+long mem_anon_huge_kb(void)
+{
+    return read_kb("/proc/self/smaps_rollup", "AnonHugePages");
+}
+
+// Разбор списка процессоров вида "0-3,8-11"
+static int parse_cpulist(const char *path, cpu_set_t *set)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return 1;
+    char list[4096];
+    int ok = fgets(list, sizeof(list), f) != NULL;
+    fclose(f);
+    if (!ok)
+        return 1;
+
+    CPU_ZERO(set);
+    char *p = list;
+    while (*p && *p != '\n')
+    {
+        char *end;
+        long lo = strtol(p, &end, 10), hi = lo;
+        if (end == p)
+            return 1;
+        if (*end == '-')
+        {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+        }
+        for (long cpu = lo; cpu <= hi && cpu < CPU_SETSIZE; cpu++)
+            CPU_SET(cpu, set);
+        p = (*end == ',') ? end + 1 : end;
+    }
+    return CPU_COUNT(set) == 0;
+}
+
+int numa_detect(struct numa_topology *t)
+{
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) != 0)
+        return 1;
+    cpu_set_t *cpus = malloc(sizeof(cpu_set_t) * MAX_NODES);
+    if (!cpus)
+        return 1;
+    // Учитываются только процессоры, доступные процессу (taskset, cgroup);
+    // узел без них не получает потоков
+    int nodes = 0;
+    for (int node = 0; node < MAX_NODES; node++)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        if (parse_cpulist(path, &cpus[nodes]) != 0)
+            continue;
+        CPU_AND(&cpus[nodes], &cpus[nodes], &allowed);
+        if (CPU_COUNT(&cpus[nodes]) > 0)
+            nodes++;
+    }
+    // Узлов нет: один узел со всеми процессорами, доступными процессу
+    if (nodes == 0)
+    {
+        cpus[0] = allowed;
+        nodes = 1;
+    }
+    t->nodes = nodes;
+    t->cpus = cpus;
+    return 0;
+}
+
+void numa_free(struct numa_topology *t)
+{
+    free(t->cpus);
+    t->cpus = NULL;
+}
+
+int numa_pin(const struct numa_topology *t, int worker)
+{
+    const cpu_set_t *cpus = (const cpu_set_t *)t->cpus;
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus[worker % t->nodes]);
+}
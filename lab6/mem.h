@@ -0,0 +1,51 @@
+#ifndef MEM_H
+#define MEM_H
+
+#include <stddef.h>
+
+// Размещение больших буферов: огромные страницы и привязка к узлам NUMA.
+// Без огромных страниц буфер выравнивается по странице (posix_memalign),
+// чтобы годиться для O_DIRECT.
+
+enum huge_mode
+{
+    HUGE_OFF,     // posix_memalign, страницы по 4K
+    HUGE_THP,     // Анонимное отображение с madvise(MADV_HUGEPAGE)
+    HUGE_EXPLICIT // MAP_HUGETLB из заранее выделенного пула, иначе THP
+};
+
+struct mem_buf
+{
+    void *base;
+    size_t size; // Размер отображения; 0 - буфер из posix_memalign
+    int huge;    // Режим, который удалось получить
+};
+
+int mem_alloc(struct mem_buf *b, size_t size, int huge);
+void mem_free(struct mem_buf *b);
+
+// Просьба к ядру собирать отображение из огромных страниц. Для
+// отображений файлов действует только там, где ядро это поддерживает
+// (например, tmpfs с huge=), иначе безвредна.
+void mem_advise_huge(void *addr, size_t len);
+
+// Анонимной памяти процесса в огромных страницах, КиБ; -1 - неизвестно
+long mem_anon_huge_kb(void);
+
+// Узлы NUMA из /sys/devices/system/node, суженные до процессоров из
+// sched_getaffinity. Потоки раскладываются по узлам по кругу: поток w
+// работает на процессорах узла w % nodes. Без сведений об узлах
+// считается, что узел один и в нем все доступные процессоры.
+struct numa_topology
+{
+    int nodes;
+    void *cpus; // cpu_set_t[nodes]
+};
+
+int numa_detect(struct numa_topology *t);
+void numa_free(struct numa_topology *t);
+
+// Привязать вызывающий поток к процессорам узла потока worker
+int numa_pin(const struct numa_topology *t, int worker);
+
+#endif // MEM_H
@@ -0,0 +1,273 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/resource.h>
+#include "metrics.h"
+
+static const char *phase_names[PHASE_COUNT] = {"sort", "merge", "wait", "io"};
+static const char *counter_names[CNT_COUNT] = {"blocks",        "sorted_records", "merges",        "merged_records",
+                                               "final_records", "bytes_read",     "bytes_written", "presorted_records"};
+static const char *wall_names[WALL_COUNT] = {"parts", "final_merge"};
+
+uint64_t metrics_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+int metrics_init(struct metrics *m, int threads, uint64_t records, int parts)
+{
+    m->threads = threads;
+    m->records = records;
+    m->parts = parts;
+    atomic_init(&m->parts_done, 0);
+    m->start_ns = metrics_now();
+    for (int w = 0; w < WALL_COUNT; w++)
+        m->wall_ns[w] = 0;
+    m->verbose = 0;
+    m->interval = 0;
+    m->stop = 0;
+    m->progress_started = 0;
+    // aligned_alloc требует размер, кратный выравниванию, - слот занимает целые кэш-линии
+    m->per_thread = aligned_alloc(_Alignof(struct thread_metrics), sizeof(struct thread_metrics) * threads);
+    if (!m->per_thread)
+        return 1;
+    for (int t = 0; t < threads; t++)
+    {
+        for (int p = 0; p < PHASE_COUNT; p++)
+            atomic_init(&m->per_thread[t].ns[p], 0);
+        for (int c = 0; c < CNT_COUNT; c++)
+            atomic_init(&m->per_thread[t].count[c], 0);
+    }
+    pthread_mutex_init(&m->mutex, NULL);
+    pthread_cond_init(&m->cond, NULL);
+    return 0;
+}
+
+void metrics_destroy(struct metrics *m)
+{
+    metrics_stop_progress(m);
+    free(m->per_thread);
+    m->per_thread = NULL;
+    pthread_mutex_destroy(&m->mutex);
+    pthread_cond_destroy(&m->cond);
+}
+
+static uint64_t sum_counter(const struct metrics *m, enum metric_counter c)
+{
+    uint64_t sum = 0;
+    for (int t = 0; t < m->threads; t++)
+        sum += atomic_load_explicit(&m->per_thread[t].count[c], memory_order_relaxed);
+    return sum;
+}
+
+static uint64_t sum_phase(const struct metrics *m, enum metric_phase p)
+{
+    uint64_t sum = 0;
+    for (int t = 0; t < m->threads; t++)
+        sum += atomic_load_explicit(&m->per_thread[t].ns[p], memory_order_relaxed);
+    return sum;
+}
+
+// Пиковый RSS процесса и байты, действительно прочитанные с накопителя
+// и отправленные на него (/proc/self/io; без него -1). Страничный кэш и
+// tmpfs в них не попадают, в отличие от bytes_read/bytes_written.
+struct proc_usage
+{
+    long max_rss_kib;
+    long long storage_read;
+    long long storage_written;
+};
+
+static void read_usage(struct proc_usage *u)
+{
+    struct rusage ru;
+    u->max_rss_kib = getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : -1;
+    u->storage_read = -1;
+    u->storage_written = -1;
+    FILE *f = fopen("/proc/self/io", "r");
+    if (!f)
+        return;
+    char line[128];
+    while (fgets(line, sizeof(line), f))
+    {
+        if (strncmp(line, "read_bytes:", 11) == 0)
+            u->storage_read = atoll(line + 11);
+        else if (strncmp(line, "write_bytes:", 12) == 0)
+            u->storage_written = atoll(line + 12);
+    }
+    fclose(f);
+}
+
+// Объем в MiB или n/a, если счетчик недоступен (нет /proc/self/io)
+static const char *format_mib(char *buf, size_t len, long long bytes)
+{
+    if (bytes < 0)
+        snprintf(buf, len, "n/a");
+    else
+        snprintf(buf, len, "%.1f MiB", bytes / 1048576.0);
+    return buf;
+}
+
+static double throughput(const struct metrics *m, double elapsed)
+{
+    return elapsed > 0 ? m->records / elapsed : 0.0;
+}
+
+static void *progress_func(void *arg)
+{
+    struct metrics *m = (struct metrics *)arg;
+    pthread_mutex_lock(&m->mutex);
+    while (!m->stop)
+    {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += m->interval;
+        while (!m->stop && pthread_cond_timedwait(&m->cond, &m->mutex, &deadline) != ETIMEDOUT)
+            ;
+        if (m->stop)
+            break;
+
+        double elapsed = (metrics_now() - m->start_ns) / 1e9;
+        uint64_t sorted = sum_counter(m, CNT_SORTED);
+        uint64_t final = sum_counter(m, CNT_FINAL);
+        double total = m->records ? (double)m->records : 1.0;
+        fprintf(stderr, "[Progress] %.1f s: parts %d/%d, sorted %.1f%%, final merge %.1f%%\n", elapsed,
+                atomic_load(&m->parts_done), m->parts, 100.0 * sorted / total, 100.0 * final / total);
+        fflush(stderr);
+    }
+    pthread_mutex_unlock(&m->mutex);
+    return NULL;
+}
+
+int metrics_start_progress(struct metrics *m, int interval)
+{
+    if (interval <= 0)
+        return 0;
+    m->interval = interval;
+    if (pthread_create(&m->progress, NULL, progress_func, m) != 0)
+        return 1;
+    m->progress_started = 1;
+    return 0;
+}
+
+void metrics_stop_progress(struct metrics *m)
+{
+    if (!m->progress_started)
+        return;
+    pthread_mutex_lock(&m->mutex);
+    m->stop = 1;
+    pthread_cond_signal(&m->cond);
+    pthread_mutex_unlock(&m->mutex);
+    pthread_join(m->progress, NULL);
+    m->progress_started = 0;
+}
+
+void metrics_report_text(const struct metrics *m, FILE *out)
+{
+    double elapsed = (metrics_now() - m->start_ns) / 1e9;
+    fprintf(out, "[Summary] records: %lu, parts: %d, threads: %d, elapsed: %.3f s (parts %.3f s, final merge %.3f s)\n",
+            m->records, m->parts, m->threads, elapsed, m->wall_ns[WALL_PARTS] / 1e9, m->wall_ns[WALL_FINAL] / 1e9);
+    struct proc_usage u;
+    read_usage(&u);
+    char read_mib[32], written_mib[32];
+    fprintf(out, "[Summary] throughput: %.0f records/s, peak RSS: %.1f MiB, storage read: %s, written: %s\n",
+            throughput(m, elapsed), u.max_rss_kib / 1024.0, format_mib(read_mib, sizeof(read_mib), u.storage_read),
+            format_mib(written_mib, sizeof(written_mib), u.storage_written));
+    fprintf(out, "[Summary] %6s %9s %9s %9s %9s %8s %8s %12s %12s %10s %10s\n", "thread", "sort_s", "merge_s", "wait_s",
+            "io_s", "blocks", "merges", "sorted", "final", "read_MiB", "write_MiB");
+    for (int t = 0; t <= m->threads; t++)
+    {
+        double ns[PHASE_COUNT];
+        uint64_t cnt[CNT_COUNT];
+        for (int p = 0; p < PHASE_COUNT; p++)
+            ns[p] = (t < m->threads ? atomic_load(&m->per_thread[t].ns[p]) : sum_phase(m, p)) / 1e9;
+        for (int c = 0; c < CNT_COUNT; c++)
+            cnt[c] = t < m->threads ? atomic_load(&m->per_thread[t].count[c]) : sum_counter(m, c);
+        char name[16];
+        if (t < m->threads)
+            snprintf(name, sizeof(name), "%d", t);
+        else
+            snprintf(name, sizeof(name), "total");
+        fprintf(out, "[Summary] %6s %9.3f %9.3f %9.3f %9.3f %8lu %8lu %12lu %12lu %10.1f %10.1f\n", name,
+                ns[PHASE_SORT], ns[PHASE_MERGE], ns[PHASE_WAIT], ns[PHASE_IO], cnt[CNT_BLOCKS], cnt[CNT_MERGES],
+                cnt[CNT_SORTED], cnt[CNT_FINAL], cnt[CNT_BYTES_READ] / 1048576.0,
+                cnt[CNT_BYTES_WRITTEN] / 1048576.0);
+    }
+    fflush(out);
+}
+
+static void json_thread(FILE *out, const struct metrics *m, int t)
+{
+    fprintf(out, "{");
+    for (int p = 0; p < PHASE_COUNT; p++)
+    {
+        uint64_t ns = t < 0 ? sum_phase(m, p) : atomic_load(&m->per_thread[t].ns[p]);
+        fprintf(out, "\"%s_s\": %.6f, ", phase_names[p], ns / 1e9);
+    }
+    for (int c = 0; c < CNT_COUNT; c++)
+    {
+        uint64_t v = t < 0 ? sum_counter(m, c) : atomic_load(&m->per_thread[t].count[c]);
+        fprintf(out, "\"%s\": %lu%s", counter_names[c], v, c + 1 < CNT_COUNT ? ", " : "");
+    }
+    fprintf(out, "}");
+}
+
+void metrics_report_json(const struct metrics *m, FILE *out)
+{
+    double elapsed = (metrics_now() - m->start_ns) / 1e9;
+    fprintf(out, "{\"records\": %lu, \"parts\": %d, \"threads\": %d, \"elapsed_s\": %.6f, \"wall\": {", m->records,
+            m->parts, m->threads, elapsed);
+    for (int w = 0; w < WALL_COUNT; w++)
+        fprintf(out, "\"%s_s\": %.6f%s", wall_names[w], m->wall_ns[w] / 1e9, w + 1 < WALL_COUNT ? ", " : "");
+    struct proc_usage u;
+    read_usage(&u);
+    fprintf(out, "}, \"records_per_s\": %.1f, \"max_rss_kib\": %ld, ", throughput(m, elapsed), u.max_rss_kib);
+    // Без /proc/self/io поля объема не выводятся
+    if (u.storage_read >= 0)
+        fprintf(out, "\"storage_read_bytes\": %lld, \"storage_write_bytes\": %lld, ", u.storage_read, u.storage_written);
+    fprintf(out, "\"total\": ");
+    json_thread(out, m, -1);
+    fprintf(out, ", \"per_thread\": [");
+    for (int t = 0; t < m->threads; t++)
+    {
+        json_thread(out, m, t);
+        if (t + 1 < m->threads)
+            fprintf(out, ", ");
+    }
+    fprintf(out, "]}\n");
+    fflush(out);
+}
+
+void metrics_report_csv(const struct metrics *m, FILE *out)
+{
+    double elapsed = (metrics_now() - m->start_ns) / 1e9;
+    struct proc_usage u;
+    read_usage(&u);
+    fprintf(out, "records,parts,threads,elapsed_s,records_per_s");
+    for (int w = 0; w < WALL_COUNT; w++)
+        fprintf(out, ",%s_wall_s", wall_names[w]);
+    for (int p = 0; p < PHASE_COUNT; p++)
+        fprintf(out, ",%s_s", phase_names[p]);
+    for (int c = 0; c < CNT_COUNT; c++)
+        fprintf(out, ",%s", counter_names[c]);
+    fprintf(out, ",max_rss_kib,storage_read_bytes,storage_write_bytes\n");
+
+    fprintf(out, "%lu,%d,%d,%.6f,%.1f", m->records, m->parts, m->threads, elapsed, throughput(m, elapsed));
+    for (int w = 0; w < WALL_COUNT; w++)
+        fprintf(out, ",%.6f", m->wall_ns[w] / 1e9);
+    for (int p = 0; p < PHASE_COUNT; p++)
+        fprintf(out, ",%.6f", sum_phase(m, p) / 1e9);
+    for (int c = 0; c < CNT_COUNT; c++)
+        fprintf(out, ",%lu", sum_counter(m, c));
+    fprintf(out, ",%ld", u.max_rss_kib);
+    // Без /proc/self/io поля объема пустые
+    if (u.storage_read >= 0)
+        fprintf(out, ",%lld,%lld\n", u.storage_read, u.storage_written);
+    else
+        fprintf(out, ",,\n");
+    fflush(out);
+}
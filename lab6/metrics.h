@@ -0,0 +1,96 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Метрики сортировки. У каждого потока свой слот на отдельной кэш-линии,
+// пишет в него только этот поток (атомарно, без упорядочивания), читают
+// поток прогресса и итоговый отчет. Блокировок на горячем пути нет.
+
+enum metric_phase
+{
+    PHASE_SORT,  // Сортировка блоков
+    PHASE_MERGE, // Слияния внутри частей и финальное слияние
+    PHASE_WAIT,  // Простой в ожидании задач
+    PHASE_IO,    // Чтение и запись файла
+    PHASE_COUNT
+};
+
+enum metric_counter
+{
+    CNT_BLOCKS,        // Отсортировано блоков
+    CNT_SORTED,        // Записей в отсортированных блоках
+    CNT_MERGES,        // Выполнено кусков слияния
+    CNT_MERGED,        // Записей, прошедших через слияния частей
+    CNT_FINAL,         // Записей, записанных финальным слиянием
+    CNT_BYTES_READ,    // Байт прочитано read/pread
+    CNT_BYTES_WRITTEN, // Байт записано write/pwrite
+    CNT_PRESORTED,     // Записей, для которых сортировка или слияние свелись к проверке и копии
+    CNT_COUNT
+};
+
+// Интервалы всего прогона по стенным часам
+enum metric_wall
+{
+    WALL_PARTS, // Сортировка всех частей
+    WALL_FINAL, // Финальное слияние
+    WALL_COUNT
+};
+
+struct thread_metrics
+{
+    _Alignas(64) atomic_uint_fast64_t ns[PHASE_COUNT];
+    atomic_uint_fast64_t count[CNT_COUNT];
+};
+
+struct metrics
+{
+    int threads;
+    struct thread_metrics *per_thread;
+    uint64_t records;
+    int parts;
+    atomic_int parts_done;
+    uint64_t start_ns;
+    uint64_t wall_ns[WALL_COUNT];
+    int verbose; // Трассировка каждого блока и куска слияния
+
+    // Периодическая строка прогресса
+    int interval;
+    int stop;
+    pthread_t progress;
+    int progress_started;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+};
+
+uint64_t metrics_now(void);
+
+int metrics_init(struct metrics *m, int threads, uint64_t records, int parts);
+void metrics_destroy(struct metrics *m);
+
+static inline void metrics_time(struct metrics *m, int thread, enum metric_phase phase, uint64_t ns)
+{
+    if (m)
+        atomic_fetch_add_explicit(&m->per_thread[thread].ns[phase], ns, memory_order_relaxed);
+}
+
+static inline void metrics_count(struct metrics *m, int thread, enum metric_counter counter, uint64_t n)
+{
+    if (m)
+        atomic_fetch_add_explicit(&m->per_thread[thread].count[counter], n, memory_order_relaxed);
+}
+
+// Поток, раз в interval секунд печатающий строку прогресса в stderr
+int metrics_start_progress(struct metrics *m, int interval);
+void metrics_stop_progress(struct metrics *m);
+
+void metrics_report_text(const struct metrics *m, FILE *out);
+void metrics_report_json(const struct metrics *m, FILE *out);
+
+// Две строки CSV: заголовок и итог по всем потокам, для сравнения прогонов
+void metrics_report_csv(const struct metrics *m, FILE *out);
+
+#endif // METRICS_H
@@ -0,0 +1,214 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include "index.h"
+#include "metrics.h"
+#include "search.h"
+
+#define DEFAULT_FENCE_STEP 4096 // Записей между опорными ключами, 64 КиБ файла
+
+struct query_options
+{
+    uint64_t fence_step;
+    int count_only;        // Печатать только число записей, а не recno
+    const char *batch;     // Файл запросов "from to" по строке, "-" - stdin
+    uint64_t random;       // Число случайных запросов шириной width
+    double width;
+    uint64_t seed;
+};
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+// Выдача recno записей [first, last)
+static void print_recnos(struct index_file *f, uint64_t first, uint64_t last, FILE *out)
+{
+    for (uint64_t i = first; i < last;)
+    {
+        uint64_t avail;
+        const struct index_s *recs = index_records(f, i, &avail);
+        if (!recs)
+            break;
+        if (avail > last - i)
+            avail = last - i;
+        for (uint64_t j = 0; j < avail; j++)
+            fprintf(out, "%lu\n", recs[j].recno);
+        i += avail;
+    }
+}
+
+// Поиск границ и выдача recno найденных записей. Возвращает число записей.
+static uint64_t run_query(struct index_file *f, double from, double to, int count_only, FILE *out)
+{
+    uint64_t first, last;
+    index_range(f, from, to, &first, &last);
+    if (!count_only)
+        print_recnos(f, first, last, out);
+    return last - first;
+}
+
+static void report_latency(uint64_t *lat, uint64_t n, uint64_t total)
+{
+    if (n == 0)
+        return;
+    qsort(lat, n, sizeof(uint64_t), compare_u64);
+    uint64_t sum = 0;
+    for (uint64_t i = 0; i < n; i++)
+        sum += lat[i];
+    fprintf(stderr, "[Latency] queries: %lu, records: %lu, mean: %.2f us, p50: %.2f us, p90: %.2f us, "
+                    "p99: %.2f us, max: %.2f us\n",
+            n, total, sum / 1e3 / n, lat[n / 2] / 1e3, lat[n * 9 / 10] / 1e3, lat[n * 99 / 100] / 1e3,
+            lat[n - 1] / 1e3);
+}
+
+// Пакет запросов: из файла или случайные. Задержка поиска границ
+// каждого запроса меряется отдельно, без выдачи recno; перцентили
+// печатаются в stderr.
+static int run_batch(struct index_file *f, const struct query_options *opt, FILE *out)
+{
+    FILE *in = NULL;
+    if (opt->batch)
+    {
+        in = strcmp(opt->batch, "-") == 0 ? stdin : fopen(opt->batch, "r");
+        if (!in)
+        {
+            perror("[Main] open batch");
+            return 1;
+        }
+    }
+
+    uint64_t cap = opt->random ? opt->random : 1024, n = 0, total = 0;
+    uint64_t *lat = malloc(sizeof(uint64_t) * cap);
+    if (!lat)
+    {
+        perror("[Main] malloc");
+        if (in && in != stdin)
+            fclose(in);
+        return 1;
+    }
+
+    unsigned int seed = opt->seed;
+    for (;;)
+    {
+        double from, to;
+        if (in)
+        {
+            if (fscanf(in, "%lf %lf", &from, &to) != 2)
+                break;
+        }
+        else
+        {
+            if (n == opt->random)
+                break;
+            from = MIN_MJD + rand_r(&seed) / (double)RAND_MAX * (MAX_MJD - MIN_MJD);
+            to = from + opt->width;
+        }
+        if (n == cap)
+        {
+            uint64_t *grown = realloc(lat, sizeof(uint64_t) * cap * 2);
+            if (!grown)
+                break;
+            lat = grown;
+            cap *= 2;
+        }
+
+        uint64_t first, last;
+        uint64_t t0 = metrics_now();
+        index_range(f, from, to, &first, &last);
+        lat[n++] = metrics_now() - t0;
+        total += last - first;
+        if (opt->count_only)
+            fprintf(out, "%.6f %.6f %lu\n", from, to, last - first);
+        else
+            print_recnos(f, first, last, out);
+    }
+
+    if (in && in != stdin)
+        fclose(in);
+    fflush(out);
+    report_latency(lat, n, total);
+    free(lat);
+    return 0;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "[Main] Usage: %s [-c] [-f fence_step] filename from to\n"
+                    "       %s [-c] [-f fence_step] -b batch_file|- filename\n"
+                    "       %s [-c] [-f fence_step] -n queries [-W width] [-s seed] filename\n",
+            prog, prog, prog);
+}
+
+int main(int argc, char *argv[])
+{
+    struct query_options opt = {.fence_step = DEFAULT_FENCE_STEP, .width = 1.0, .seed = 1};
+    int c;
+    while ((c = getopt(argc, argv, "cf:b:n:W:s:")) != -1)
+    {
+        switch (c)
+        {
+        case 'c':
+            opt.count_only = 1;
+            break;
+        case 'f':
+            opt.fence_step = strtoull(optarg, NULL, 0);
+            break;
+        case 'b':
+            opt.batch = optarg;
+            break;
+        case 'n':
+            opt.random = strtoull(optarg, NULL, 0);
+            break;
+        case 'W':
+            opt.width = atof(optarg);
+            break;
+        case 's':
+            opt.seed = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    int batch = opt.batch || opt.random;
+    if (argc - optind != (batch ? 1 : 3))
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    struct index_file f;
+    if (index_open(&f, argv[optind]) != 0)
+        return 1;
+    if (index_build_fence(&f, opt.fence_step) != 0)
+    {
+        index_close(&f);
+        return 1;
+    }
+
+    // recno выдаются потоком, буфер stdout побольше
+    static char out_buf[1 << 20];
+    setvbuf(stdout, out_buf, _IOFBF, sizeof(out_buf));
+
+    int status = 0;
+    if (batch)
+    {
+        status = run_batch(&f, &opt, stdout);
+    }
+    else
+    {
+        uint64_t found = run_query(&f, atof(argv[optind + 1]), atof(argv[optind + 2]), opt.count_only, stdout);
+        if (opt.count_only)
+            printf("%lu\n", found);
+        fflush(stdout);
+    }
+
+    index_close(&f);
+    return status;
+}
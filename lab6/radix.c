@@ -0,0 +1,184 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include "radix.h"
+
+#define RADIX_BUCKETS (1 << RADIX_BITS)
+#define RADIX_MASK (RADIX_BUCKETS - 1)
+#define RADIX_PASSES ((64 + RADIX_BITS - 1) / RADIX_BITS)
+#define INSERTION_LIMIT 16
+
+// Сортировка сравнением: порядок less над элементами по size байт
+struct span_order
+{
+    size_t size;
+    rs_less less;
+    const void *ctx;
+};
+
+static int record_less(const void *ctx, const void *a, const void *b)
+{
+    return rs_compare((const struct rs_format *)ctx, a, b) < 0;
+}
+
+// Устойчивое слияние серий a и b в out
+static void merge_span(const struct span_order *o, const char *a, size_t na, const char *b, size_t nb, char *out)
+{
+    size_t size = o->size;
+    while (na > 0 && nb > 0)
+    {
+        int take_b = o->less(o->ctx, b, a);
+        memcpy(out, take_b ? b : a, size);
+        out += size;
+        if (take_b)
+        {
+            b += size;
+            nb--;
+        }
+        else
+        {
+            a += size;
+            na--;
+        }
+    }
+    memcpy(out, a, na * size);
+    memcpy(out + na * size, b, nb * size);
+}
+
+// Вставки в отрезке a[0..n); tmp - место под один элемент
+static void insertion_span(const struct span_order *o, char *a, char *tmp, size_t n)
+{
+    size_t size = o->size;
+    for (size_t i = 1; i < n; i++)
+    {
+        size_t j = i;
+        while (j > 0 && o->less(o->ctx, a + i * size, a + (j - 1) * size))
+            j--;
+        if (j == i)
+            continue;
+        memcpy(tmp, a + i * size, size);
+        memmove(a + (j + 1) * size, a + j * size, (i - j) * size);
+        memcpy(a + j * size, tmp, size);
+    }
+}
+
+// Устойчивая сортировка сравнением: вставками по отрезкам
+// INSERTION_LIMIT, затем восходящие слияния через tmp (не меньше n
+// элементов). Результат - в a.
+static void sort_span(const struct span_order *o, char *a, char *tmp, size_t n)
+{
+    size_t size = o->size;
+    for (size_t i = 0; i < n; i += INSERTION_LIMIT)
+        insertion_span(o, a + i * size, tmp, n - i < INSERTION_LIMIT ? n - i : INSERTION_LIMIT);
+    char *src = a, *dst = tmp;
+    for (size_t width = INSERTION_LIMIT; width < n; width *= 2)
+    {
+        for (size_t lo = 0; lo < n; lo += 2 * width)
+        {
+            size_t mid = lo + width < n ? lo + width : n;
+            size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+            merge_span(o, src + lo * size, mid - lo, src + mid * size, hi - mid, dst + lo * size);
+        }
+        char *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != a)
+        memcpy(a, src, n * size);
+}
+
+// LSD-сортировка устойчива, но префикс не различает элементы с равным
+// началом ключа
+void radix_sort_ties(const struct rs_format *f, void *data, void *tmp, size_t n, rs_less less, const void *ctx)
+{
+    struct span_order o = {.size = f->record_size, .less = less, .ctx = ctx};
+    char *a = (char *)data, *t = (char *)tmp;
+    size_t i = 0;
+    while (i < n)
+    {
+        uint64_t key = rs_prefix(&f->key, a + i * o.size);
+        size_t j = i + 1;
+        while (j < n && rs_prefix(&f->key, a + j * o.size) == key)
+            j++;
+        if (j - i > 1)
+            sort_span(&o, a + i * o.size, t + i * o.size, j - i);
+        i = j;
+    }
+}
+
+// Раскладка записей по корзинам разряда shift; h - начала корзин
+static inline void scatter(const struct rs_key *key, const char *src, char *dst, size_t n, size_t size, int shift,
+                           size_t *h)
+{
+    for (size_t i = 0; i < n; i++, src += size)
+        memcpy(dst + h[(rs_prefix(key, src) >> shift) & RADIX_MASK]++ * size, src, size);
+}
+
+void *radix_sort(const struct rs_format *f, void *data, void *scratch, size_t n)
+{
+    size_t size = f->record_size;
+    // Второй ключ, который целиком помещается в префикс, сортируется
+    // младшими разрядами, и досортировка серий не нужна
+    int key2_digits = f->key2.type != RS_KEY_NONE && rs_key_exact(&f->key) && rs_key_exact(&f->key2);
+    int passes = key2_digits ? 2 * RADIX_PASSES : RADIX_PASSES;
+    size_t (*hist)[RADIX_BUCKETS] = calloc(passes, sizeof(*hist));
+    if (!hist)
+    {
+        // Без памяти под гистограммы остается сортировка сравнением
+        struct span_order o = {.size = size, .less = record_less, .ctx = f};
+        sort_span(&o, data, scratch, n);
+        return data;
+    }
+
+    // Гистограммы всех разрядов за один проход; разряды второго ключа -
+    // первые RADIX_PASSES
+    size_t (*key_hist)[RADIX_BUCKETS] = hist + (passes - RADIX_PASSES);
+    const char *rec = (const char *)data;
+    for (size_t i = 0; i < n; i++, rec += size)
+    {
+        uint64_t key = rs_prefix(&f->key, rec);
+        for (int p = 0; p < RADIX_PASSES; p++)
+            key_hist[p][(key >> (p * RADIX_BITS)) & RADIX_MASK]++;
+        if (key2_digits)
+        {
+            uint64_t key2 = rs_prefix(&f->key2, rec);
+            for (int p = 0; p < RADIX_PASSES; p++)
+                hist[p][(key2 >> (p * RADIX_BITS)) & RADIX_MASK]++;
+        }
+    }
+
+    char *src = (char *)data, *dst = (char *)scratch;
+    for (int p = 0; p < passes; p++)
+    {
+        const struct rs_key *key = p < passes - RADIX_PASSES ? &f->key2 : &f->key;
+        int shift = (p % RADIX_PASSES) * RADIX_BITS;
+        size_t *h = hist[p];
+
+        // Разряд одинаков у всех записей - проход ничего не меняет
+        if (n == 0 || h[(rs_prefix(key, src) >> shift) & RADIX_MASK] == n)
+            continue;
+
+        size_t sum = 0;
+        for (int b = 0; b < RADIX_BUCKETS; b++)
+        {
+            size_t c = h[b];
+            h[b] = sum;
+            sum += c;
+        }
+        // Записи индекса и метки по 16 байт копируются без вызова memcpy
+        if (size == sizeof(struct index_s))
+            scatter(key, src, dst, n, sizeof(struct index_s), shift, h);
+        else
+            scatter(key, src, dst, n, size, shift, h);
+
+        char *t = src;
+        src = dst;
+        dst = t;
+    }
+
+    free(hist);
+
+    if (rs_has_tail(f) && !key2_digits)
+        radix_sort_ties(f, src, dst, n, record_less, f);
+    return src;
+}
@@ -0,0 +1,25 @@
+#ifndef RADIX_H
+#define RADIX_H
+
+#include <stddef.h>
+#include "recfmt.h"
+
+#define RADIX_BITS 11
+
+// LSD-сортировка n записей формата f по префиксу первого ключа проходами
+// по RADIX_BITS бит. Если оба ключа целиком помещаются в префиксы (как у
+// rs_index_format), второй ключ сортируется такими же проходами как
+// младшие разряды. Иначе серии с равным префиксом, если префикса мало для
+// порядка, досортировываются сравнением rs_compare. Сортировка устойчива.
+// Для rs_index_format порядок совпадает с compare_index. scratch - рабочий буфер не меньше n записей.
+// Результат не копируется обратно: возвращается data или scratch, где он
+// оказался.
+void *radix_sort(const struct rs_format *f, void *data, void *scratch, size_t n);
+
+// Досортировка серий с равным префиксом первого ключа в n элементах
+// формата f по less: устойчивые вставки и слияния через tmp (не меньше n
+// элементов). radix_sort вызывает ее с порядком rs_compare, если
+// префикса мало для порядка.
+void radix_sort_ties(const struct rs_format *f, void *data, void *tmp, size_t n, rs_less less, const void *ctx);
+
+#endif // RADIX_H
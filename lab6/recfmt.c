@@ -0,0 +1,106 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "recfmt.h"
+
+const struct rs_format rs_index_format = {
+    .record_size = sizeof(struct index_s),
+    .header_size = sizeof(uint64_t),
+    .key = {RS_KEY_F64, offsetof(struct index_s, time_mark), sizeof(double)},
+    .key2 = {RS_KEY_U64, offsetof(struct index_s, recno), sizeof(uint64_t)}};
+
+static int key_compare(const struct rs_key *k, const char *a, const char *b)
+{
+    uint64_t ka = rs_prefix(k, a), kb = rs_prefix(k, b);
+    if (ka != kb)
+        return ka < kb ? -1 : 1;
+    if (k->type == RS_KEY_BYTES && k->len > 8)
+        return memcmp(a + k->offset + 8, b + k->offset + 8, k->len - 8);
+    return 0;
+}
+
+int rs_compare(const struct rs_format *f, const void *a, const void *b)
+{
+    int c = key_compare(&f->key, a, b);
+    if (c != 0 || f->key2.type == RS_KEY_NONE)
+        return c;
+    return key_compare(&f->key2, a, b);
+}
+
+int rs_tail_compare(const struct rs_format *f, const void *a, const void *b)
+{
+    const char *ca = (const char *)a, *cb = (const char *)b;
+    if (f->key.type == RS_KEY_BYTES && f->key.len > 8)
+    {
+        int c = memcmp(ca + f->key.offset + 8, cb + f->key.offset + 8, f->key.len - 8);
+        if (c != 0)
+            return c;
+    }
+    return f->key2.type == RS_KEY_NONE ? 0 : key_compare(&f->key2, ca, cb);
+}
+
+int rs_parse_key(const char *text, struct rs_key *key)
+{
+    static const struct
+    {
+        const char *name;
+        int type;
+    } types[] = {{"f64", RS_KEY_F64}, {"u64", RS_KEY_U64}, {"i64", RS_KEY_I64}, {"bytes", RS_KEY_BYTES}};
+
+    const char *colon = strchr(text, ':');
+    if (!colon)
+        return 1;
+    key->type = RS_KEY_NONE;
+    for (size_t i = 0; i < sizeof(types) / sizeof(types[0]); i++)
+    {
+        if (strlen(types[i].name) == (size_t)(colon - text) && strncmp(text, types[i].name, colon - text) == 0)
+            key->type = types[i].type;
+    }
+    if (key->type == RS_KEY_NONE)
+        return 1;
+
+    char *end;
+    key->offset = strtoull(colon + 1, &end, 10);
+    if (end == colon + 1)
+        return 1;
+    key->len = 8;
+    if (key->type == RS_KEY_BYTES)
+    {
+        if (*end != ':')
+            return 1;
+        const char *len = end + 1;
+        key->len = strtoull(len, &end, 10);
+        if (end == len || key->len == 0)
+            return 1;
+    }
+    return *end != '\0';
+}
+
+static int check_key(const struct rs_key *k, size_t record_size, const char *name)
+{
+    if (k->offset > record_size || k->len > record_size - k->offset)
+    {
+        fprintf(stderr, "[Main] %s key (offset %zu, length %zu) does not fit in a %zu-byte record\n", name, k->offset,
+                k->len, record_size);
+        return 1;
+    }
+    return 0;
+}
+
+int rs_check_format(const struct rs_format *f)
+{
+    if (f->record_size == 0)
+    {
+        fprintf(stderr, "[Main] record size must be positive\n");
+        return 1;
+    }
+    if (f->key.type == RS_KEY_NONE)
+    {
+        fprintf(stderr, "[Main] primary key is not set\n");
+        return 1;
+    }
+    if (check_key(&f->key, f->record_size, "primary"))
+        return 1;
+    return f->key2.type != RS_KEY_NONE && check_key(&f->key2, f->record_size, "secondary");
+}
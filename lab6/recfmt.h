@@ -0,0 +1,138 @@
+#ifndef RECFMT_H
+#define RECFMT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "index.h"
+
+// Описание файла из записей фиксированного размера: заголовок из
+// header_size байт и за ним записи по record_size байт. Порядок записей -
+// по ключу, при равенстве - по второму ключу. По этому описанию работают
+// общие сортировка (radix.c), слияние (loser_tree.c, kmerge.c) и
+// разбиение по рангам; индексный файл - частный случай rs_index_format.
+//
+// Каждый ключ приводится к беззнаковому 64-битному префиксу с тем же
+// порядком, и горячие циклы сравнивают только префиксы. Полное
+// сравнение записей нужно только при равных префиксах, если ключ
+// длиннее 8 байт или задан второй ключ.
+
+enum rs_key_type
+{
+    RS_KEY_NONE,  // Второй ключ не задан
+    RS_KEY_F64,   // double, порядок как у index_key: -0.0 == +0.0, NaN после +inf
+    RS_KEY_U64,   // uint64_t
+    RS_KEY_I64,   // int64_t
+    RS_KEY_BYTES  // len байт, побайтно без знака, как memcmp
+};
+
+struct rs_key
+{
+    int type;
+    size_t offset; // Смещение поля в записи
+    size_t len;    // Длина поля; у числовых - 8
+};
+
+struct rs_format
+{
+    size_t record_size;
+    size_t header_size;
+    struct rs_key key;
+    struct rs_key key2; // RS_KEY_NONE - без второго ключа
+};
+
+// Индексный файл: число записей и struct index_s, порядок compare_index
+extern const struct rs_format rs_index_format;
+
+// Разбор ключа вида "f64:OFF", "u64:OFF", "i64:OFF" или "bytes:OFF:LEN"
+int rs_parse_key(const char *text, struct rs_key *key);
+
+// Проверка, что ключи помещаются в запись; 0 - формат годится
+int rs_check_format(const struct rs_format *f);
+
+// Порядок записей по первому и второму ключу
+int rs_compare(const struct rs_format *f, const void *a, const void *b);
+
+// Сравнение записей с равными префиксами первого ключа
+int rs_tail_compare(const struct rs_format *f, const void *a, const void *b);
+
+// Строгий порядок элементов с контекстом ctx - для сортировок и
+// разбиений, элементы которых не сравниваются одним rs_compare
+typedef int (*rs_less)(const void *ctx, const void *a, const void *b);
+
+// Префиксы ключей: беззнаковые числа с тем же порядком, что у поля
+
+static inline uint64_t rs_load_f64(const char *p, size_t len)
+{
+    (void)len;
+    double v;
+    memcpy(&v, p, sizeof(v));
+    return index_key(v);
+}
+
+static inline uint64_t rs_load_u64(const char *p, size_t len)
+{
+    (void)len;
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t rs_load_i64(const char *p, size_t len)
+{
+    (void)len;
+    int64_t v;
+    memcpy(&v, p, sizeof(v));
+    return (uint64_t)v ^ (1ULL << 63);
+}
+
+// Первые 8 байт поля старшим байтом вперед, недостающие - нули
+static inline uint64_t rs_load_bytes(const char *p, size_t len)
+{
+    const unsigned char *u = (const unsigned char *)p;
+    if (len >= 8)
+        return (uint64_t)u[0] << 56 | (uint64_t)u[1] << 48 | (uint64_t)u[2] << 40 | (uint64_t)u[3] << 32 |
+               (uint64_t)u[4] << 24 | (uint64_t)u[5] << 16 | (uint64_t)u[6] << 8 | (uint64_t)u[7];
+    uint64_t v = 0;
+    for (size_t i = 0; i < len; i++)
+        v |= (uint64_t)u[i] << (56 - 8 * i);
+    return v;
+}
+
+// Типы ключей, для которых генерируются специализированные функции
+#define RS_KINDS(X)          \
+    X(f64, rs_load_f64)      \
+    X(u64, rs_load_u64)      \
+    X(i64, rs_load_i64)      \
+    X(bytes, rs_load_bytes)
+
+// Префикс ключа k записи rec
+static inline uint64_t rs_prefix(const struct rs_key *k, const void *rec)
+{
+    const char *p = (const char *)rec + k->offset;
+    switch (k->type)
+    {
+    case RS_KEY_F64:
+        return rs_load_f64(p, k->len);
+    case RS_KEY_U64:
+        return rs_load_u64(p, k->len);
+    case RS_KEY_I64:
+        return rs_load_i64(p, k->len);
+    default:
+        return rs_load_bytes(p, k->len);
+    }
+}
+
+// Префикс содержит ключ целиком: порядок префиксов - порядок ключей
+static inline int rs_key_exact(const struct rs_key *k)
+{
+    return k->type != RS_KEY_BYTES || k->len <= 8;
+}
+
+// Равенство префиксов не означает равенства ключей
+static inline int rs_has_tail(const struct rs_format *f)
+{
+    return !rs_key_exact(&f->key) || f->key2.type != RS_KEY_NONE;
+}
+
+#endif // RECFMT_H
@@ -0,0 +1,550 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include "kmerge.h"
+#include "radix.h"
+#include "recsort.h"
+#include "runio.h"
+#include "sched.h"
+
+#define RS_MERGE_PIECE 65536 // Записей; слияния блоков меньше 2*RS_MERGE_PIECE не делятся
+#define RS_GATHER_TASKS 4    // Кусков выгрузки части на поток
+#define RS_MAX_THREADS 8192
+#define RS_DEFAULT_READ_BUF (1024 * 1024)
+#define RS_DEFAULT_WRITE_BUF (4 * 1024 * 1024)
+
+// Метка записи части: префикс ключа и номер записи в части. Сортируются
+// метки, а записи переставляются один раз при выгрузке части.
+struct rs_tag
+{
+    uint64_t key;
+    uint64_t idx;
+};
+
+// Метки сортируются radix_sort как записи с префиксом в начале
+static const struct rs_format tag_format = {
+    .record_size = sizeof(struct rs_tag),
+    .key = {RS_KEY_U64, offsetof(struct rs_tag, key), sizeof(uint64_t)}};
+
+int rs_layout(const struct rs_format *f, size_t memsize, uint64_t file_size, uint64_t *records,
+              size_t *records_per_part, int *parts)
+{
+    if (file_size < f->header_size || (file_size - f->header_size) % f->record_size != 0)
+    {
+        fprintf(stderr, "[Main] file size %lu is not %zu + N*%zu bytes\n", file_size, f->header_size,
+                f->record_size);
+        return 1;
+    }
+    *records = (file_size - f->header_size) / f->record_size;
+    *records_per_part = memsize / (f->record_size + 2 * sizeof(struct rs_tag));
+    if (*records_per_part == 0)
+    {
+        fprintf(stderr, "[Main] memsize must hold at least one record with its keys (%zu bytes)\n",
+                f->record_size + 2 * sizeof(struct rs_tag));
+        return 1;
+    }
+    uint64_t n = (*records + *records_per_part - 1) / *records_per_part;
+    if (n > INT32_MAX)
+    {
+        fprintf(stderr, "[Main] too many parts: %lu\n", n);
+        return 1;
+    }
+    *parts = n;
+    return 0;
+}
+
+// Сортировка одной части в памяти
+struct rs_part
+{
+    const struct rs_format *f;
+    int tail;           // rs_has_tail(f)
+    char *data;         // Записи части
+    size_t n;
+    struct rs_tag *tags;    // Метки; после rs_sort_part результат в sorted
+    struct rs_tag *scratch;
+    struct rs_tag *sorted;
+    int blocks;
+    int threads;
+    int fd;             // Файл, в который выгружается часть
+    off_t out_pos;      // Смещение первой записи части в файле
+    size_t write_buf;
+    atomic_int failed;
+    struct metrics *m;
+    int verbose;
+};
+
+static inline size_t part_block_start(const struct rs_part *p, int block)
+{
+    return (uint64_t)p->n * block / p->blocks;
+}
+
+static inline int tag_less(const struct rs_part *p, const struct rs_tag *a, const struct rs_tag *b)
+{
+    if (a->key != b->key)
+        return a->key < b->key;
+    if (p->tail)
+    {
+        size_t size = p->f->record_size;
+        int c = rs_tail_compare(p->f, p->data + a->idx * size, p->data + b->idx * size);
+        if (c != 0)
+            return c < 0;
+    }
+    return a->idx < b->idx;
+}
+
+// Извлечение префиксов ключей записей [lo, hi) части
+#define RS_EXTRACT(name, load)                                             \
+    static void extract_##name(struct rs_part *p, size_t lo, size_t hi)   \
+    {                                                                      \
+        size_t size = p->f->record_size;                                   \
+        size_t len = p->f->key.len;                                        \
+        const char *rec = p->data + lo * size + p->f->key.offset;          \
+        for (size_t i = lo; i < hi; i++, rec += size)                      \
+        {                                                                  \
+            p->tags[i].key = load(rec, len);                               \
+            p->tags[i].idx = i;                                            \
+        }                                                                  \
+    }
+RS_KINDS(RS_EXTRACT)
+
+static void extract(struct rs_part *p, size_t lo, size_t hi)
+{
+    switch (p->f->key.type)
+    {
+    case RS_KEY_F64:
+        extract_f64(p, lo, hi);
+        break;
+    case RS_KEY_U64:
+        extract_u64(p, lo, hi);
+        break;
+    case RS_KEY_I64:
+        extract_i64(p, lo, hi);
+        break;
+    default:
+        extract_bytes(p, lo, hi);
+        break;
+    }
+}
+
+// Устойчивое слияние меток a и b в out
+static void merge_tags(const struct rs_part *p, const struct rs_tag *a, size_t na, const struct rs_tag *b,
+                       size_t nb, struct rs_tag *out)
+{
+    size_t i = 0, j = 0;
+    while (i < na && j < nb)
+        *out++ = tag_less(p, &b[j], &a[i]) ? b[j++] : a[i++];
+    memcpy(out, &a[i], (na - i) * sizeof(struct rs_tag));
+    memcpy(out + (na - i), &b[j], (nb - j) * sizeof(struct rs_tag));
+}
+
+// Порядок меток для radix_sort_ties и kmerge_co_rank
+static int tag_before(const void *ctx, const void *a, const void *b)
+{
+    return tag_less((const struct rs_part *)ctx, (const struct rs_tag *)a, (const struct rs_tag *)b);
+}
+
+// Сортировка меток по префиксу: radix_sort устойчива, и метки с равным
+// префиксом остаются в порядке idx; если префикса мало для порядка,
+// такие серии досортировываются сравнением записей. Результат - в tags.
+static void sort_tags(const struct rs_part *p, struct rs_tag *tags, struct rs_tag *scratch, size_t n)
+{
+    struct rs_tag *sorted = radix_sort(&tag_format, tags, scratch, n);
+    if (sorted != tags)
+        memcpy(tags, sorted, n * sizeof(struct rs_tag));
+
+    if (p->tail)
+        radix_sort_ties(&tag_format, tags, scratch, n, tag_before, p);
+}
+
+struct rs_block_task
+{
+    struct rs_part *p;
+    int block;
+};
+
+static void block_task(struct sched *s, void *arg, int worker)
+{
+    (void)s;
+    struct rs_block_task *t = (struct rs_block_task *)arg;
+    struct rs_part *p = t->p;
+    uint64_t t0 = metrics_now();
+    size_t lo = part_block_start(p, t->block), hi = part_block_start(p, t->block + 1);
+    if (p->verbose)
+        printf("[Thread %d] Sorting block: %d\n", worker, t->block);
+    extract(p, lo, hi);
+    sort_tags(p, &p->tags[lo], &p->scratch[lo], hi - lo);
+    metrics_time(p->m, worker, PHASE_SORT, metrics_now() - t0);
+    metrics_count(p->m, worker, CNT_BLOCKS, 1);
+    metrics_count(p->m, worker, CNT_SORTED, hi - lo);
+}
+
+// Кусок слияния соседних серий [lo, mid) и [mid, hi): ранги [from, to)
+struct rs_merge_task
+{
+    struct rs_part *p;
+    const struct rs_tag *src;
+    struct rs_tag *dst;
+    size_t lo, mid, hi;
+    size_t from, to;
+};
+
+static void merge_task(struct sched *s, void *arg, int worker)
+{
+    (void)s;
+    struct rs_merge_task *t = (struct rs_merge_task *)arg;
+    const struct rs_part *p = t->p;
+    uint64_t t0 = metrics_now();
+    const struct rs_tag *a = &t->src[t->lo], *b = &t->src[t->mid];
+    size_t na = t->mid - t->lo, nb = t->hi - t->mid;
+    size_t a_from = kmerge_co_rank(a, na, b, nb, sizeof(struct rs_tag), t->from, tag_before, p);
+    size_t a_to = kmerge_co_rank(a, na, b, nb, sizeof(struct rs_tag), t->to, tag_before, p);
+    if (p->verbose)
+        printf("[Thread %d] Merging [%zu, %zu) ranks %zu-%zu\n", worker, t->lo, t->hi, t->from, t->to);
+    merge_tags(p, a + a_from, a_to - a_from, b + (t->from - a_from), (t->to - t->from) - (a_to - a_from),
+               &t->dst[t->lo + t->from]);
+    metrics_time(p->m, worker, PHASE_MERGE, metrics_now() - t0);
+    metrics_count(p->m, worker, CNT_MERGES, 1);
+    metrics_count(p->m, worker, CNT_MERGED, t->to - t->from);
+}
+
+// Сортировка меток части: блоки сортируются независимо, затем сливаются
+// попарно по уровням, переходя между tags и scratch. Каждое слияние
+// уровня делится на куски по рангам, чтобы последние уровни с одним-двумя
+// слияниями тоже занимали все потоки. tasks - не меньше blocks * threads.
+static void rs_sort_part(struct sched *s, struct rs_part *p, struct rs_block_task *blocks,
+                         struct rs_merge_task *tasks)
+{
+    for (int b = 0; b < p->blocks; b++)
+    {
+        blocks[b].p = p;
+        blocks[b].block = b;
+        sched_spawn(s, b % p->threads, block_task, &blocks[b]);
+    }
+    sched_run(s, 0);
+
+    struct rs_tag *src = p->tags, *dst = p->scratch;
+    for (int width = 1; width < p->blocks; width *= 2)
+    {
+        int ntasks = 0;
+        for (int g = 0; g < p->blocks; g += 2 * width)
+        {
+            size_t lo = part_block_start(p, g);
+            size_t mid = part_block_start(p, g + width < p->blocks ? g + width : p->blocks);
+            size_t hi = part_block_start(p, g + 2 * width < p->blocks ? g + 2 * width : p->blocks);
+            size_t pieces = (hi - lo) / RS_MERGE_PIECE;
+            if (pieces > (size_t)p->threads)
+                pieces = p->threads;
+            if (pieces == 0)
+                pieces = 1;
+            for (size_t i = 0; i < pieces; i++)
+            {
+                struct rs_merge_task *t = &tasks[ntasks];
+                t->p = p;
+                t->src = src;
+                t->dst = dst;
+                t->lo = lo;
+                t->mid = mid;
+                t->hi = hi;
+                t->from = (hi - lo) * i / pieces;
+                t->to = (hi - lo) * (i + 1) / pieces;
+                sched_spawn(s, ntasks % p->threads, merge_task, t);
+                ntasks++;
+            }
+        }
+        sched_run(s, 0);
+        struct rs_tag *t = src;
+        src = dst;
+        dst = t;
+    }
+    p->sorted = src;
+}
+
+// Выгрузка отсортированной части: записи переставляются по меткам прямо
+// в буфер записи
+struct rs_gather_task
+{
+    struct rs_part *p;
+    size_t lo, hi;
+};
+
+static void gather_task(struct sched *s, void *arg, int worker)
+{
+    (void)s;
+    struct rs_gather_task *t = (struct rs_gather_task *)arg;
+    struct rs_part *p = t->p;
+    size_t size = p->f->record_size;
+    uint64_t t0 = metrics_now();
+    struct run_writer w;
+    if (rw_open(&w, p->fd, p->out_pos + (off_t)(t->lo * size), p->write_buf, NULL, -1) != 0)
+    {
+        perror("[Thread] malloc writer buffer");
+        atomic_store(&p->failed, 1);
+        return;
+    }
+    int ok = 1;
+    for (size_t i = t->lo; i < t->hi && ok; i++)
+        ok = rw_put(&w, p->data + p->sorted[i].idx * size, size) == 0;
+    if (!ok || rw_flush(&w) != 0)
+    {
+        perror("[Thread] write part");
+        atomic_store(&p->failed, 1);
+    }
+    metrics_time(p->m, worker, PHASE_IO, w.io_ns);
+    metrics_time(p->m, worker, PHASE_MERGE, metrics_now() - t0 - w.io_ns);
+    metrics_count(p->m, worker, CNT_BYTES_WRITTEN, w.bytes);
+    rw_close(&w);
+}
+
+static int gather_part(struct sched *s, struct rs_part *p, struct rs_gather_task *tasks)
+{
+    int n = p->threads * RS_GATHER_TASKS;
+    for (int i = 0; i < n; i++)
+    {
+        tasks[i].p = p;
+        tasks[i].lo = (uint64_t)p->n * i / n;
+        tasks[i].hi = (uint64_t)p->n * (i + 1) / n;
+        sched_spawn(s, i % p->threads, gather_task, &tasks[i]);
+    }
+    sched_run(s, 0);
+    return atomic_load(&p->failed);
+}
+
+// Слияние частей во временный файл out_path с тем же заголовком
+static int merge_parts(int fd, const struct rs_format *f, const struct rs_options *opt, uint64_t records,
+                       size_t records_per_part, const char *out_path, uint64_t file_size, struct metrics *m)
+{
+    char *header = NULL;
+    uint64_t *ranks = malloc(sizeof(uint64_t) * (opt->threads + 1));
+    int out_fd = open(out_path, O_CREAT | O_TRUNC | O_WRONLY, 0666);
+    int ret = 1;
+    if (!ranks || out_fd == -1)
+    {
+        perror("[Merge] prepare");
+        goto out;
+    }
+    if (f->header_size > 0)
+    {
+        header = malloc(f->header_size);
+        if (!header || pread(fd, header, f->header_size, 0) != (ssize_t)f->header_size ||
+            pwrite(out_fd, header, f->header_size, 0) != (ssize_t)f->header_size)
+        {
+            perror("[Merge] copy header");
+            goto out;
+        }
+    }
+    if (ftruncate(out_fd, file_size) != 0)
+    {
+        perror("[Merge] ftruncate");
+        goto out;
+    }
+    for (int c = 0; c <= opt->threads; c++)
+        ranks[c] = records * c / opt->threads;
+    struct kmerge_job job = {
+        .f = f,
+        .fd = fd,
+        .out_fd = out_fd,
+        .records = records,
+        .records_per_part = records_per_part,
+        .chunks = opt->threads,
+        .ranks = ranks,
+        .threads = opt->threads,
+        .read_buf = opt->read_buf ? opt->read_buf : RS_DEFAULT_READ_BUF,
+        .write_buf = opt->write_buf ? opt->write_buf : RS_DEFAULT_WRITE_BUF,
+        .verbose = opt->verbose,
+        .m = m};
+    if (kmerge_parts(&job) != 0)
+        goto out;
+    if (fsync(out_fd) != 0)
+    {
+        perror("[Merge] fsync");
+        goto out;
+    }
+    ret = 0;
+
+out:
+    if (out_fd != -1)
+        close(out_fd);
+    if (ret != 0)
+        unlink(out_path);
+    free(header);
+    free(ranks);
+    return ret;
+}
+
+int rs_sort_file(const char *filename, const struct rs_format *f, const struct rs_options *opt, struct metrics *m)
+{
+    if (rs_check_format(f))
+        return 1;
+    if (opt->threads < 1 || opt->threads > RS_MAX_THREADS || opt->blocks < 1)
+    {
+        fprintf(stderr, "[Main] threads must be between 1 and %d, blocks at least 1\n", RS_MAX_THREADS);
+        return 1;
+    }
+    int fd = open(filename, O_RDWR);
+    if (fd == -1)
+    {
+        perror("[Main] open");
+        return 1;
+    }
+    struct stat st;
+    uint64_t records;
+    size_t rpp;
+    int parts;
+    if (fstat(fd, &st) == -1)
+    {
+        perror("[Main] fstat");
+        close(fd);
+        return 1;
+    }
+    if (rs_layout(f, opt->memsize, st.st_size, &records, &rpp, &parts))
+    {
+        close(fd);
+        return 1;
+    }
+    if (rpp > records)
+        rpp = records > 0 ? records : 1;
+
+    int blocks = (uint64_t)opt->blocks > rpp ? (int)rpp : opt->blocks;
+    struct rs_part p = {.f = f, .tail = rs_has_tail(f), .blocks = blocks, .threads = opt->threads, .fd = fd,
+                        .write_buf = opt->write_buf ? opt->write_buf : RS_DEFAULT_WRITE_BUF, .m = m,
+                        .verbose = opt->verbose};
+    atomic_init(&p.failed, 0);
+    p.data = malloc(rpp * f->record_size);
+    p.tags = malloc(rpp * sizeof(struct rs_tag));
+    p.scratch = malloc(rpp * sizeof(struct rs_tag));
+    struct rs_block_task *block_tasks = malloc(sizeof(struct rs_block_task) * blocks);
+    struct rs_merge_task *merge_tasks = malloc(sizeof(struct rs_merge_task) * blocks * opt->threads);
+    struct rs_gather_task *gather_tasks = malloc(sizeof(struct rs_gather_task) * opt->threads * RS_GATHER_TASKS);
+    struct sched sched;
+    int ret = 1;
+    if (!p.data || !p.tags || !p.scratch || !block_tasks || !merge_tasks || !gather_tasks)
+    {
+        perror("[Main] malloc");
+        goto out_mem;
+    }
+    if (sched_init(&sched, opt->threads) != 0)
+    {
+        perror("[Main] start thread pool");
+        goto out_mem;
+    }
+    sched.metrics = m;
+    if (sched_start(&sched) != 0)
+    {
+        perror("[Main] start thread pool");
+        sched_destroy(&sched);
+        goto out_mem;
+    }
+
+    uint64_t t0 = metrics_now();
+    for (int part = 0; part < parts; part++)
+    {
+        uint64_t first = (uint64_t)part * rpp;
+        p.n = records - first < rpp ? records - first : rpp;
+        p.out_pos = f->header_size + first * f->record_size;
+        uint64_t io0 = metrics_now();
+        if (runio_bulk(0, fd, -1, p.data, p.n * f->record_size, p.out_pos, 0) != 0)
+        {
+            perror("[Main] read part");
+            goto out;
+        }
+        metrics_time(m, 0, PHASE_IO, metrics_now() - io0);
+        metrics_count(m, 0, CNT_BYTES_READ, p.n * f->record_size);
+        rs_sort_part(&sched, &p, block_tasks, merge_tasks);
+        if (gather_part(&sched, &p, gather_tasks) != 0)
+            goto out;
+        printf("[Main] Processed part %d of %d\n", part + 1, parts);
+        fflush(stdout);
+        if (m)
+            atomic_fetch_add(&m->parts_done, 1);
+    }
+    if (m)
+        m->wall_ns[WALL_PARTS] = metrics_now() - t0;
+
+    if (parts > 1)
+    {
+        t0 = metrics_now();
+        char *out_path = malloc(strlen(filename) + sizeof(".sorted.tmp"));
+        if (!out_path)
+        {
+            perror("[Main] malloc");
+            goto out;
+        }
+        sprintf(out_path, "%s.sorted.tmp", filename);
+        int merged = merge_parts(fd, f, opt, records, rpp, out_path, st.st_size, m);
+        if (merged == 0)
+            merged = commit_output(out_path, filename);
+        if (merged != 0)
+            unlink(out_path);
+        free(out_path);
+        if (merged != 0)
+            goto out;
+        printf("[Main] Merged %d parts into %s\n", parts, filename);
+        if (m)
+            m->wall_ns[WALL_FINAL] = metrics_now() - t0;
+    }
+    else if (fsync(fd) != 0)
+    {
+        perror("[Main] fsync");
+        goto out;
+    }
+    ret = 0;
+
+out:
+    sched_stop(&sched);
+    sched_destroy(&sched);
+out_mem:
+    free(p.data);
+    free(p.tags);
+    free(p.scratch);
+    free(block_tasks);
+    free(merge_tasks);
+    free(gather_tasks);
+    close(fd);
+    return ret;
+}
+
+int64_t rs_check_file(const char *filename, const struct rs_format *f)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        perror("[Verify] open");
+        return -1;
+    }
+    struct stat st;
+    struct run_reader r;
+    char *rec = malloc(2 * f->record_size);
+    if (!rec || fstat(fd, &st) == -1 ||
+        rr_open(&r, fd, f->header_size, st.st_size, RS_DEFAULT_READ_BUF, f->record_size, NULL, 0) != 0)
+    {
+        perror("[Verify] open reader");
+        free(rec);
+        close(fd);
+        return -1;
+    }
+    int64_t bad = 0;
+    char *prev = rec, *cur = rec + f->record_size;
+    int got = rr_next(&r, prev, f->record_size);
+    while (got > 0 && (got = rr_next(&r, cur, f->record_size)) > 0)
+    {
+        if (rs_compare(f, prev, cur) > 0)
+            bad++;
+        char *t = prev;
+        prev = cur;
+        cur = t;
+    }
+    if (got < 0)
+    {
+        perror("[Verify] read");
+        bad = -1;
+    }
+    rr_close(&r);
+    free(rec);
+    close(fd);
+    return bad;
+}
@@ -0,0 +1,42 @@
+#ifndef RECSORT_H
+#define RECSORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "metrics.h"
+#include "recfmt.h"
+
+// Внешняя сортировка файлов из записей фиксированного размера формата
+// rs_format (recfmt.h). Заголовок файла не меняется. При равенстве обоих
+// ключей записи остаются в исходном порядке (сортировка устойчива).
+// Части сортируются метками (префикс ключа, номер записи), которые
+// раскладывает radix_sort, слияние частей - kmerge_parts, как у
+// sort_index. Извлечение префиксов генерируется отдельно для каждого
+// типа ключа, так что на каждую запись нет косвенного вызова.
+
+struct rs_options
+{
+    size_t memsize;   // Память под часть: записи и их ключи
+    int blocks;       // Блоков сортировки в части
+    int threads;
+    size_t read_buf;  // Буфер чтения источника при слиянии, 0 - по умолчанию
+    size_t write_buf; // Буфер записи при слиянии и выгрузке части, 0 - по умолчанию
+    int verbose;
+};
+
+// Раскладка файла: записей, записей в части и частей. Записей в части
+// столько, сколько помещается в memsize вместе с ключами. 0 - успех.
+int rs_layout(const struct rs_format *f, size_t memsize, uint64_t file_size, uint64_t *records,
+              size_t *records_per_part, int *parts);
+
+// Сортировка файла на месте: части сортируются в памяти, затем
+// сливаются во временный файл рядом с исходным, который заменяет его
+// через commit_output. Метрики m (может быть NULL) должны быть созданы
+// на opt->threads потоков.
+int rs_sort_file(const char *filename, const struct rs_format *f, const struct rs_options *opt, struct metrics *m);
+
+// Проверка порядка записей файла: число пар соседних записей не по
+// порядку или -1 при ошибке чтения
+int64_t rs_check_file(const char *filename, const struct rs_format *f);
+
+#endif // RECSORT_H
@@ -0,0 +1,535 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#include "runio.h"
+#include "metrics.h"
+
+size_t runio_buf_size(size_t requested)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    if (requested < RUNIO_MIN_BUF)
+        requested = RUNIO_MIN_BUF;
+    return (requested + page - 1) / page * page;
+}
+
+static char *alloc_buf(size_t size)
+{
+    void *p = NULL;
+    int err = posix_memalign(&p, sysconf(_SC_PAGESIZE), size);
+    if (err != 0)
+    {
+        errno = err;
+        return NULL;
+    }
+    return p;
+}
+
+int rr_open(struct run_reader *r, int fd, off_t start, off_t end, size_t buf_size, size_t record_size,
+            struct uring *ring, int direct)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    r->fd = fd;
+    r->pos = start;
+    r->end = end;
+    r->size = runio_buf_size(buf_size);
+    r->slack = record_size > page ? (record_size + page - 1) / page * page : page;
+    r->len = 0;
+    r->off = 0;
+    r->bytes = 0;
+    r->io_ns = 0;
+    r->ring = ring;
+    r->direct = ring && direct;
+    r->buf_index = -1;
+    r->inflight = 0;
+    // С кольцом два окна подряд, в каждом запас под хвост записи
+    r->buf = alloc_buf(ring ? 2 * (r->size + r->slack) : r->size + r->slack);
+    if (!r->buf)
+        return -1;
+    r->ahead = ring ? r->buf + r->size + r->slack : NULL;
+    if (end > start && !r->direct)
+    {
+        posix_fadvise(fd, start, end - start, POSIX_FADV_SEQUENTIAL);
+        posix_fadvise(fd, start, r->size, POSIX_FADV_WILLNEED);
+    }
+    return 0;
+}
+
+static int rr_fill(struct run_reader *r)
+{
+    // Недочитанный хвост записи, попавшей на границу чтения, переносим в начало
+    size_t tail = r->len - r->off;
+    memmove(r->buf, r->buf + r->off, tail);
+    r->len = tail;
+    r->off = 0;
+
+    // Читаем до выровненной границы: со второго чтения смещения выровнены.
+    // Хвост меньше записи помещается в запас буфера slack.
+    size_t want = r->size - (size_t)(r->pos % r->size);
+    if ((off_t)want > r->end - r->pos)
+        want = r->end - r->pos;
+
+    uint64_t t0 = metrics_now();
+    while (want > 0)
+    {
+        ssize_t n = pread(r->fd, r->buf + r->len, want, r->pos);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+        {
+            errno = EIO;
+            return -1;
+        }
+        r->len += n;
+        r->pos += n;
+        r->bytes += n;
+        want -= n;
+    }
+    r->io_ns += metrics_now() - t0;
+
+    if (r->pos < r->end)
+        posix_fadvise(r->fd, r->pos, r->size, POSIX_FADV_WILLNEED);
+    return 0;
+}
+
+void rr_iovec(const struct run_reader *r, struct iovec *iov)
+{
+    iov->iov_base = r->buf < r->ahead ? r->buf : r->ahead;
+    iov->iov_len = 2 * (r->size + r->slack);
+}
+
+// Чтение следующего окна в ahead за запасом slack. С O_DIRECT
+// начало и длина выровнены по странице.
+static int rr_submit(struct run_reader *r)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    off_t pos = r->direct ? r->pos - r->pos % (off_t)page : r->pos;
+    size_t want = r->size - (size_t)(pos % r->size);
+    off_t left = r->end - pos;
+    if (r->direct)
+        left = (left + page - 1) / page * page;
+    if ((off_t)want > left)
+        want = left;
+    r->ahead_pos = pos;
+    r->ahead_want = want;
+    if (uring_prep(r->ring, 0, r->fd, r->ahead + r->slack, want, pos, r->buf_index, &r->req) != 0)
+        return -1;
+    r->inflight = 1;
+    return 0;
+}
+
+int rr_prefetch(struct run_reader *r)
+{
+    if (!r->ring || r->inflight || r->pos >= r->end)
+        return 0;
+    return rr_submit(r);
+}
+
+static int rr_fill_async(struct run_reader *r)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    uint64_t t0 = metrics_now();
+    if (!r->inflight && rr_submit(r) != 0)
+        return -1;
+    if (uring_wait(r->ring, &r->req) != 0)
+        return -1;
+    r->inflight = 0;
+    if (r->req.res < 0)
+    {
+        errno = -r->req.res;
+        return -1;
+    }
+
+    // Нужны байты до конца диапазона; короткое чтение дочитывается тем же
+    // кольцом. С O_DIRECT повтор идет с границы страницы: невыровненное
+    // смещение ядро отвергло бы с EINVAL.
+    size_t got = r->req.res;
+    size_t need = r->end - r->ahead_pos < (off_t)r->ahead_want ? (size_t)(r->end - r->ahead_pos) : r->ahead_want;
+    while (got < need)
+    {
+        size_t done = r->direct ? got - got % page : got;
+        if (uring_prep(r->ring, 0, r->fd, r->ahead + r->slack + done, r->ahead_want - done, r->ahead_pos + done,
+                       r->buf_index, &r->req) != 0 ||
+            uring_wait(r->ring, &r->req) != 0)
+            return -1;
+        if (r->req.res <= 0 || done + r->req.res <= got)
+        {
+            errno = r->req.res < 0 ? -r->req.res : EIO;
+            return -1;
+        }
+        got = done + r->req.res;
+    }
+    r->bytes += got;
+
+    // Хвост записи из текущего окна переносится перед данными нового
+    size_t skip = r->pos - r->ahead_pos;
+    size_t tail = r->len - r->off;
+    memcpy(r->ahead + r->slack + skip - tail, r->buf + r->off, tail);
+    char *old = r->buf;
+    r->buf = r->ahead;
+    r->ahead = old;
+    r->off = r->slack + skip - tail;
+    r->len = r->slack + need;
+    r->pos = r->ahead_pos + need;
+    r->io_ns += metrics_now() - t0;
+
+    if (r->pos < r->end)
+        return rr_submit(r);
+    return 0;
+}
+
+int rr_next(struct run_reader *r, void *rec, size_t record_size)
+{
+    // Первое чтение до выровненной границы может оказаться короче записи
+    while (r->len - r->off < record_size)
+    {
+        if (r->pos >= r->end)
+        {
+            if (r->len == r->off)
+                return 0;
+            errno = EIO; // Диапазон обрывается посреди записи
+            return -1;
+        }
+        if ((r->ring ? rr_fill_async(r) : rr_fill(r)) != 0)
+            return -1;
+    }
+    memcpy(rec, r->buf + r->off, record_size);
+    r->off += record_size;
+    return 1;
+}
+
+void rr_close(struct run_reader *r)
+{
+    // Буфер нельзя освобождать, пока в него читает ядро
+    if (r->inflight)
+        uring_wait(r->ring, &r->req);
+    r->inflight = 0;
+    if (r->ring && r->ahead < r->buf)
+        r->buf = r->ahead;
+    free(r->buf);
+    r->buf = NULL;
+}
+
+int rw_open(struct run_writer *w, int fd, off_t start, size_t buf_size, struct uring *ring, int direct_fd)
+{
+    w->fd = fd;
+    w->pos = start;
+    w->size = runio_buf_size(buf_size);
+    w->len = 0;
+    w->bytes = 0;
+    w->io_ns = 0;
+    w->ring = ring;
+    w->direct_fd = ring ? direct_fd : -1;
+    w->buf_index = -1;
+    w->inflight = 0;
+    w->buf = alloc_buf(ring ? 2 * w->size : w->size);
+    w->spare = (ring && w->buf) ? w->buf + w->size : NULL;
+    return w->buf ? 0 : -1;
+}
+
+void rw_iovec(const struct run_writer *w, struct iovec *iov)
+{
+    iov->iov_base = w->buf < w->spare ? w->buf : w->spare;
+    iov->iov_len = 2 * w->size;
+}
+
+static int write_all(int fd, const char *data, size_t size, off_t pos)
+{
+    while (size > 0)
+    {
+        ssize_t n = pwrite(fd, data, size, pos);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        data += n;
+        size -= n;
+        pos += n;
+    }
+    return 0;
+}
+
+// Сбрасывает буфер до ближайшей выровненной границы файла
+static int rw_drain(struct run_writer *w)
+{
+    size_t chunk = w->size - (size_t)(w->pos % w->size);
+    if (chunk > w->len)
+        chunk = w->len;
+    uint64_t t0 = metrics_now();
+    if (write_all(w->fd, w->buf, chunk, w->pos) != 0)
+        return -1;
+    w->io_ns += metrics_now() - t0;
+    w->bytes += chunk;
+    w->pos += chunk;
+    w->len -= chunk;
+    memmove(w->buf, w->buf + chunk, w->len);
+    return 0;
+}
+
+// Ожидание записи из spare; короткая запись дописывается синхронно
+static int rw_wait(struct run_writer *w)
+{
+    if (!w->inflight)
+        return 0;
+    uint64_t t0 = metrics_now();
+    w->inflight = 0;
+    if (uring_wait(w->ring, &w->req) != 0)
+        return -1;
+    if (w->req.res < 0)
+    {
+        errno = -w->req.res;
+        return -1;
+    }
+    size_t done = w->req.res;
+    if (done < w->spare_len && write_all(w->spare_fd, w->spare + done, w->spare_len - done, w->spare_pos + done) != 0)
+        return -1;
+    w->io_ns += metrics_now() - t0;
+    return 0;
+}
+
+// Блок до выровненной границы уходит в запись, остаток переносится
+// в освободившийся второй буфер
+static int rw_drain_async(struct run_writer *w)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t chunk = w->size - (size_t)(w->pos % w->size);
+    if (chunk > w->len)
+        chunk = w->len;
+    if (rw_wait(w) != 0)
+        return -1;
+    memcpy(w->spare, w->buf + chunk, w->len - chunk);
+
+    int direct = w->direct_fd >= 0 && w->pos % page == 0 && chunk % page == 0;
+    w->spare_fd = direct ? w->direct_fd : w->fd;
+    w->spare_pos = w->pos;
+    w->spare_len = chunk;
+    uint64_t t0 = metrics_now();
+    if (uring_prep(w->ring, 1, w->spare_fd, w->buf, chunk, w->pos, w->buf_index, &w->req) != 0 ||
+        uring_submit(w->ring) != 0)
+        return -1;
+    w->io_ns += metrics_now() - t0;
+    w->inflight = 1;
+
+    char *old = w->buf;
+    w->buf = w->spare;
+    w->spare = old;
+    w->bytes += chunk;
+    w->pos += chunk;
+    w->len -= chunk;
+    return 0;
+}
+
+int rw_put(struct run_writer *w, const void *data, size_t size)
+{
+    const char *p = data;
+    while (size > 0)
+    {
+        size_t n = w->size - w->len;
+        if (n > size)
+            n = size;
+        memcpy(w->buf + w->len, p, n);
+        w->len += n;
+        p += n;
+        size -= n;
+        if (w->len == w->size && (w->ring ? rw_drain_async(w) : rw_drain(w)) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+int rw_flush(struct run_writer *w)
+{
+    while (w->len > 0)
+    {
+        if ((w->ring ? rw_drain_async(w) : rw_drain(w)) != 0)
+            return -1;
+    }
+    return w->ring ? rw_wait(w) : 0;
+}
+
+void rw_close(struct run_writer *w)
+{
+    if (w->inflight)
+        uring_wait(w->ring, &w->req);
+    w->inflight = 0;
+    if (w->ring && w->spare < w->buf)
+        w->buf = w->spare;
+    free(w->buf);
+    w->buf = NULL;
+}
+
+static int bulk_sync(int write, int fd, char *buf, size_t len, off_t pos)
+{
+    if (write)
+        return write_all(fd, buf, len, pos);
+    while (len > 0)
+    {
+        ssize_t n = pread(fd, buf, len, pos);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+        {
+            if (n == 0)
+                errno = EIO;
+            return -1;
+        }
+        buf += n;
+        len -= n;
+        pos += n;
+    }
+    return 0;
+}
+
+// Кусок runio_bulk в полете
+struct bulk_piece
+{
+    struct uring_req req;
+    int fd;
+    char *buf;
+    size_t len;
+    off_t pos;
+};
+
+static int bulk_finish(int write, struct uring *u, struct bulk_piece *p)
+{
+    if (uring_wait(u, &p->req) != 0)
+        return -1;
+    if (p->req.res < 0)
+    {
+        errno = -p->req.res;
+        return -1;
+    }
+    size_t done = p->req.res;
+    return done < p->len ? bulk_sync(write, p->fd, p->buf + done, p->len - done, p->pos + done) : 0;
+}
+
+int runio_bulk(int write, int fd, int direct_fd, char *buf, size_t len, off_t pos, int use_uring)
+{
+    // Неполные страницы в начале и конце идут через обычный fd
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t head = 0, tail = 0;
+    if (direct_fd >= 0)
+    {
+        head = (page - pos % page) % page;
+        if (head > len)
+            head = len;
+        tail = (len - head) % page;
+        if ((head > 0 && bulk_sync(write, fd, buf, head, pos) != 0) ||
+            (tail > 0 && bulk_sync(write, fd, buf + len - tail, tail, pos + len - tail) != 0))
+            return -1;
+        buf += head;
+        pos += head;
+        len -= head + tail;
+        fd = direct_fd;
+    }
+
+    struct uring u;
+    if (!use_uring || uring_init(&u, RUNIO_BULK_DEPTH) != 0)
+        return bulk_sync(write, fd, buf, len, pos);
+
+    struct bulk_piece pieces[RUNIO_BULK_DEPTH];
+    size_t issued = 0, finished = 0, done = 0;
+    int ret = 0;
+    while (ret == 0 && finished < issued + (done < len))
+    {
+        // Очередь держится полной; ждем самый старый кусок
+        if (done < len && issued - finished < RUNIO_BULK_DEPTH)
+        {
+            struct bulk_piece *p = &pieces[issued % RUNIO_BULK_DEPTH];
+            p->fd = fd;
+            p->buf = buf + done;
+            p->len = len - done < RUNIO_BULK_CHUNK ? len - done : RUNIO_BULK_CHUNK;
+            p->pos = pos + done;
+            if (uring_prep(&u, write, fd, p->buf, p->len, p->pos, -1, &p->req) != 0)
+                ret = -1;
+            done += p->len;
+            issued++;
+            continue;
+        }
+        ret = bulk_finish(write, &u, &pieces[finished % RUNIO_BULK_DEPTH]);
+        finished++;
+    }
+    uring_exit(&u);
+    return ret;
+}
+
+// Каталог файла сбрасывается на диск, чтобы rename пережил сбой
+int fsync_dir(const char *path)
+{
+    char dir[PATH_MAX];
+    const char *slash = strrchr(path, '/');
+    if (!slash)
+        snprintf(dir, sizeof(dir), ".");
+    else if (slash == path)
+        snprintf(dir, sizeof(dir), "/");
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)(slash - path), path);
+    int fd = open(dir, O_RDONLY);
+    if (fd == -1)
+        return -1;
+    int ret = fsync(fd);
+    close(fd);
+    return ret;
+}
+
+// Копия src в dst с fsync - для временного каталога на другой файловой системе
+static int copy_file(const char *src, const char *dst)
+{
+    int in = open(src, O_RDONLY);
+    int out = open(dst, O_CREAT | O_WRONLY | O_TRUNC, 0666);
+    char *buf = malloc(RUNIO_COPY_BUF);
+    int ret = (in == -1 || out == -1 || !buf) ? -1 : 0;
+    while (ret == 0)
+    {
+        ssize_t n = read(in, buf, RUNIO_COPY_BUF);
+        if (n == 0)
+            break;
+        if (n < 0 || write(out, buf, n) != n)
+            ret = -1;
+    }
+    if (ret == 0)
+        ret = fsync(out);
+    free(buf);
+    if (in != -1)
+        close(in);
+    if (out != -1)
+        close(out);
+    return ret;
+}
+
+// Атомарная замена filename готовым результатом tmp. rename между
+// файловыми системами невозможен, тогда результат сначала копируется
+// рядом с filename.
+int commit_output(const char *tmp, const char *filename)
+{
+    if (rename(tmp, filename) == -1)
+    {
+        if (errno != EXDEV)
+        {
+            perror("[Main] rename");
+            return 1;
+        }
+        char near[PATH_MAX];
+        snprintf(near, sizeof(near), "%s.sorted.tmp", filename);
+        if (copy_file(tmp, near) != 0 || rename(near, filename) == -1)
+        {
+            perror("[Main] copy to target file system");
+            unlink(near);
+            return 1;
+        }
+        unlink(tmp);
+    }
+    if (fsync_dir(filename) != 0)
+        perror("[Main] fsync directory");
+    return 0;
+}
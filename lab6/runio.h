@@ -0,0 +1,104 @@
+#ifndef RUNIO_H
+#define RUNIO_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "uring.h"
+
+#define RUNIO_MIN_BUF (64 * 1024)
+#define RUNIO_BULK_CHUNK (1024 * 1024) // Один запрос runio_bulk
+#define RUNIO_BULK_DEPTH 32            // Запросов runio_bulk в полете
+#define RUNIO_COPY_BUF (1024 * 1024)   // Буфер копии в commit_output
+
+// Буферизованное последовательное чтение диапазона [pos, end) файла.
+// Буфер выровнен по странице, каждое чтение (кроме первого) начинается
+// с выровненного смещения. После каждого чтения ядру подсказывается
+// следующее окно (POSIX_FADV_WILLNEED), чтобы оно читалось заранее.
+// С io_uring буферов два: пока разбирается один, во второй уже читается
+// следующее окно. С O_DIRECT чтения начинаются с границы страницы, а
+// лишние байты до начала диапазона пропускаются.
+struct run_reader
+{
+    int fd;
+    off_t pos;     // Смещение следующего чтения из файла
+    off_t end;     // Конец диапазона
+    char *buf;
+    size_t size;   // Размер одного чтения
+    size_t slack;  // Запас буфера перед окном под хвост записи: не меньше записи, кратен странице
+    size_t len;    // Байт данных в буфере
+    size_t off;    // Позиция разбора в буфере
+    uint64_t bytes; // Всего прочитано из файла
+    uint64_t io_ns; // Время в pread или в ожидании завершений
+    struct uring *ring; // NULL - синхронный pread
+    int direct;         // fd открыт с O_DIRECT
+    int buf_index;      // Зарегистрированный буфер (оба окна), -1 - нет
+    char *ahead;        // Окно, в которое идет чтение
+    off_t ahead_pos;
+    size_t ahead_want;
+    int inflight;
+    struct uring_req req;
+};
+
+// Буферизованная запись начиная со смещения pos через pwrite большими
+// блоками, выровненными по размеру буфера относительно начала файла.
+// С io_uring запись блока уходит в полет, а заполняется второй буфер.
+// С direct_fd выровненные по странице блоки пишутся через O_DIRECT,
+// неполные первый и последний - через обычный fd.
+struct run_writer
+{
+    int fd;
+    off_t pos;     // Смещение следующей записи в файл
+    char *buf;
+    size_t size;
+    size_t len;
+    uint64_t bytes; // Всего записано в файл
+    uint64_t io_ns; // Время в pwrite или в ожидании завершений
+    struct uring *ring; // NULL - синхронный pwrite
+    int direct_fd;      // -1 - без O_DIRECT
+    int buf_index;
+    char *spare;        // Буфер записи в полете
+    off_t spare_pos;
+    size_t spare_len;
+    int spare_fd;
+    int inflight;
+    struct uring_req req;
+};
+
+// ring != NULL - чтение через io_uring; direct - fd открыт с O_DIRECT.
+// record_size - наибольший размер записи, которую запросит rr_next.
+int rr_open(struct run_reader *r, int fd, off_t start, off_t end, size_t buf_size, size_t record_size,
+            struct uring *ring, int direct);
+// С io_uring ставит в очередь чтение первого окна (после регистрации буферов)
+int rr_prefetch(struct run_reader *r);
+// Копирует следующую запись в rec. 1 - запись прочитана, 0 - конец диапазона, -1 - ошибка
+int rr_next(struct run_reader *r, void *rec, size_t record_size);
+void rr_close(struct run_reader *r);
+
+int rw_open(struct run_writer *w, int fd, off_t start, size_t buf_size, struct uring *ring, int direct_fd);
+int rw_put(struct run_writer *w, const void *data, size_t size);
+int rw_flush(struct run_writer *w);
+void rw_close(struct run_writer *w);
+
+// Буферы для регистрации в кольце: по одному iovec на оба окна
+void rr_iovec(const struct run_reader *r, struct iovec *iov);
+void rw_iovec(const struct run_writer *w, struct iovec *iov);
+
+// Чтение (write = 0) или запись len байт buf по смещению pos кусками по
+// RUNIO_BULK_CHUNK: через io_uring до RUNIO_BULK_DEPTH в полете, иначе
+// pread/pwrite. direct_fd >= 0 - тот же файл с O_DIRECT для целых
+// страниц; тогда buf и pos должны иметь одинаковый остаток по странице.
+int runio_bulk(int write, int fd, int direct_fd, char *buf, size_t len, off_t pos, int use_uring);
+
+// Округление размера буфера вверх до кратного странице и не меньше RUNIO_MIN_BUF
+size_t runio_buf_size(size_t requested);
+
+// Атомарная замена filename готовым результатом tmp с fsync каталога.
+// Между файловыми системами результат сначала копируется рядом с
+// filename. 0 - успех.
+int commit_output(const char *tmp, const char *filename);
+
+// fsync каталога, в котором лежит path
+int fsync_dir(const char *path);
+
+#endif // RUNIO_H
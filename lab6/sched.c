@@ -0,0 +1,212 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include "sched.h"
+
+#define SCHED_INITIAL_CAP 64
+
+int sched_init(struct sched *s, int workers)
+{
+    s->workers = workers;
+    s->deques = calloc(workers, sizeof(struct sched_deque));
+    if (!s->deques)
+        return 1;
+    for (int i = 0; i < workers; i++)
+        pthread_mutex_init(&s->deques[i].mutex, NULL);
+    pthread_mutex_init(&s->mutex, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    atomic_init(&s->queued, 0);
+    atomic_init(&s->outstanding, 0);
+    s->stop = 0;
+    s->threads = NULL;
+    s->started = 0;
+    s->metrics = NULL;
+    s->numa = NULL;
+    return 0;
+}
+
+void sched_destroy(struct sched *s)
+{
+    for (int i = 0; i < s->workers; i++)
+    {
+        pthread_mutex_destroy(&s->deques[i].mutex);
+        free(s->deques[i].tasks);
+    }
+    free(s->deques);
+    s->deques = NULL;
+    pthread_mutex_destroy(&s->mutex);
+    pthread_cond_destroy(&s->cond);
+}
+
+static int deque_push(struct sched_deque *d, struct sched_task task)
+{
+    pthread_mutex_lock(&d->mutex);
+    if (d->count == d->cap)
+    {
+        size_t cap = d->cap ? 2 * d->cap : SCHED_INITIAL_CAP;
+        struct sched_task *tasks = malloc(sizeof(struct sched_task) * cap);
+        if (!tasks)
+        {
+            pthread_mutex_unlock(&d->mutex);
+            return 1;
+        }
+        for (size_t i = 0; i < d->count; i++)
+            tasks[i] = d->tasks[(d->head + i) % d->cap];
+        free(d->tasks);
+        d->tasks = tasks;
+        d->head = 0;
+        d->cap = cap;
+    }
+    d->tasks[(d->head + d->count) % d->cap] = task;
+    d->count++;
+    pthread_mutex_unlock(&d->mutex);
+    return 0;
+}
+
+// Владелец берет с конца, вор - с начала очереди
+static int deque_take(struct sched_deque *d, int steal, struct sched_task *task)
+{
+    int got = 0;
+    pthread_mutex_lock(&d->mutex);
+    if (d->count > 0)
+    {
+        if (steal)
+        {
+            *task = d->tasks[d->head];
+            d->head = (d->head + 1) % d->cap;
+        }
+        else
+        {
+            *task = d->tasks[(d->head + d->count - 1) % d->cap];
+        }
+        d->count--;
+        got = 1;
+    }
+    pthread_mutex_unlock(&d->mutex);
+    return got;
+}
+
+void sched_spawn(struct sched *s, int worker, sched_fn fn, void *arg)
+{
+    struct sched_task task = {fn, arg};
+    atomic_fetch_add(&s->outstanding, 1);
+    atomic_fetch_add(&s->queued, 1);
+    if (deque_push(&s->deques[worker], task) != 0)
+    {
+        atomic_fetch_sub(&s->queued, 1);
+        atomic_fetch_sub(&s->outstanding, 1);
+        fn(s, arg, worker);
+        return;
+    }
+    // Под мьютексом, чтобы не потерять пробуждение потока, только что
+    // увидевшего пустые очереди
+    pthread_mutex_lock(&s->mutex);
+    pthread_cond_signal(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+}
+
+static int find_task(struct sched *s, int worker, struct sched_task *task)
+{
+    if (deque_take(&s->deques[worker], 0, task))
+        return 1;
+    for (int i = 1; i < s->workers; i++)
+    {
+        if (deque_take(&s->deques[(worker + i) % s->workers], 1, task))
+            return 1;
+    }
+    return 0;
+}
+
+void sched_run(struct sched *s, int worker)
+{
+    struct sched_task task;
+    while (1)
+    {
+        if (find_task(s, worker, &task))
+        {
+            atomic_fetch_sub(&s->queued, 1);
+            task.fn(s, task.arg, worker);
+            if (atomic_fetch_sub(&s->outstanding, 1) == 1)
+            {
+                pthread_mutex_lock(&s->mutex);
+                pthread_cond_broadcast(&s->cond);
+                pthread_mutex_unlock(&s->mutex);
+            }
+            continue;
+        }
+
+        uint64_t idle_start = metrics_now();
+        pthread_mutex_lock(&s->mutex);
+        while (atomic_load(&s->queued) == 0 && atomic_load(&s->outstanding) > 0)
+            pthread_cond_wait(&s->cond, &s->mutex);
+        int done = atomic_load(&s->outstanding) == 0;
+        pthread_mutex_unlock(&s->mutex);
+        metrics_time(s->metrics, worker, PHASE_WAIT, metrics_now() - idle_start);
+        if (done)
+            return;
+    }
+}
+
+struct pool_arg
+{
+    struct sched *s;
+    int worker;
+};
+
+static void *pool_thread(void *arg)
+{
+    struct pool_arg pa = *(struct pool_arg *)arg;
+    struct sched *s = pa.s;
+    free(arg);
+    if (s->numa && numa_pin(s->numa, pa.worker) != 0)
+        fprintf(stderr, "[Thread %d] Cannot pin to NUMA node\n", pa.worker);
+    while (1)
+    {
+        pthread_mutex_lock(&s->mutex);
+        while (atomic_load(&s->queued) == 0 && !s->stop)
+            pthread_cond_wait(&s->cond, &s->mutex);
+        int stop = s->stop;
+        pthread_mutex_unlock(&s->mutex);
+        if (stop)
+            return NULL;
+        sched_run(s, pa.worker);
+    }
+}
+
+int sched_start(struct sched *s)
+{
+    s->threads = malloc(sizeof(pthread_t) * s->workers);
+    if (!s->threads)
+        return 1;
+    if (s->numa && numa_pin(s->numa, 0) != 0)
+        fprintf(stderr, "[Thread 0] Cannot pin to NUMA node\n");
+    s->started = 1;
+    for (; s->started < s->workers; s->started++)
+    {
+        struct pool_arg *pa = malloc(sizeof(struct pool_arg));
+        if (!pa)
+            break;
+        pa->s = s;
+        pa->worker = s->started;
+        if (pthread_create(&s->threads[s->started], NULL, pool_thread, pa) != 0)
+        {
+            // Очереди незапущенных потоков разберут остальные кражей
+            free(pa);
+            break;
+        }
+    }
+    return 0;
+}
+
+void sched_stop(struct sched *s)
+{
+    pthread_mutex_lock(&s->mutex);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->mutex);
+    for (int t = 1; t < s->started; t++)
+        pthread_join(s->threads[t], NULL);
+    free(s->threads);
+    s->threads = NULL;
+    s->started = 0;
+}
@@ -0,0 +1,64 @@
+#ifndef SCHED_H
+#define SCHED_H
+
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "metrics.h"
+#include "mem.h"
+
+// Планировщик задач с перехватом работы: у каждого потока своя очередь,
+// свои задачи он берет с конца (LIFO), а простаивая - крадет с начала
+// очередей других потоков. Задача может порождать новые задачи;
+// sched_run возвращается, когда не осталось ни очередных, ни выполняемых.
+struct sched;
+typedef void (*sched_fn)(struct sched *s, void *arg, int worker);
+
+struct sched_task
+{
+    sched_fn fn;
+    void *arg;
+};
+
+struct sched_deque
+{
+    pthread_mutex_t mutex;
+    struct sched_task *tasks; // Кольцевой буфер емкостью cap
+    size_t head;              // Отсюда крадут
+    size_t count;
+    size_t cap;
+};
+
+struct sched
+{
+    int workers;
+    struct sched_deque *deques;
+    pthread_mutex_t mutex; // Для ожидания простаивающих потоков
+    pthread_cond_t cond;
+    atomic_size_t queued;      // Задач в очередях
+    atomic_size_t outstanding; // Задач в очередях и выполняемых
+    int stop;                  // Пул потоков завершается, под mutex
+    pthread_t *threads;        // Потоки пула 1..workers-1, поток 0 - вызывающий
+    int started;
+    struct metrics *metrics;   // Учет простоя потоков, может быть NULL
+    const struct numa_topology *numa; // Привязка потоков к узлам, может быть NULL
+};
+
+int sched_init(struct sched *s, int workers);
+void sched_destroy(struct sched *s);
+
+// Ставит задачу в очередь потока worker; без памяти выполняет ее сразу
+void sched_spawn(struct sched *s, int worker, sched_fn fn, void *arg);
+
+// Цикл потока worker: выполняет и крадет задачи, пока они не кончатся
+void sched_run(struct sched *s, int worker);
+
+// Постоянный пул: потоки 1..workers-1 живут между партиями задач и ждут
+// новых задач, а поток 0 (вызывающий) подключается к каждой партии
+// через sched_run. sched_stop останавливает и присоединяет потоки пула.
+// Если задан numa, каждый поток пула и вызывающий привязываются к узлу
+// по своему номеру.
+int sched_start(struct sched *s);
+void sched_stop(struct sched *s);
+
+#endif // SCHED_H
@@ -0,0 +1,246 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "search.h"
+
+#define INTERP_ROUNDS 8  // Шагов интерполяционного поиска до перехода на двоичный
+#define INTERP_MIN 64    // Отрезок, который дешевле добить двоичным поиском
+
+int index_open(struct index_file *f, const char *filename)
+{
+    f->map = NULL;
+    f->data = NULL;
+    f->fence = NULL;
+    f->fence_count = 0;
+    f->fence_step = 0;
+    f->columnar = 0;
+    f->block_buf = NULL;
+    f->cached_block = -1;
+
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        perror("[Search] open");
+        return 1;
+    }
+    if (col_detect(fd))
+    {
+        close(fd);
+        if (col_open(&f->col, filename) != 0)
+            return 1;
+        f->block_buf = malloc(sizeof(struct index_s) * f->col.hdr.block_records);
+        if (!f->block_buf)
+        {
+            perror("[Search] malloc block");
+            col_close(&f->col);
+            return 1;
+        }
+        f->columnar = 1;
+        f->records = f->col.hdr.records;
+        return 0;
+    }
+    struct stat st;
+    if (pread(fd, &f->records, sizeof(uint64_t), 0) != sizeof(uint64_t) || fstat(fd, &st) == -1)
+    {
+        perror("[Search] read header");
+        close(fd);
+        return 1;
+    }
+    f->map_size = sizeof(uint64_t) + f->records * RECORD_SIZE;
+    if ((uint64_t)st.st_size < f->map_size)
+    {
+        fprintf(stderr, "[Search] file is shorter than %lu records from its header\n", f->records);
+        close(fd);
+        return 1;
+    }
+    f->map = mmap(NULL, f->map_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (f->map == MAP_FAILED)
+    {
+        perror("[Search] mmap");
+        f->map = NULL;
+        return 1;
+    }
+    // Запросы читают по нескольку страниц в случайных местах
+    posix_madvise(f->map, f->map_size, POSIX_MADV_RANDOM);
+    f->data = (const struct index_s *)((const char *)f->map + sizeof(uint64_t));
+    return 0;
+}
+
+void index_close(struct index_file *f)
+{
+    if (f->columnar)
+        col_close(&f->col);
+    if (f->map)
+        munmap(f->map, f->map_size);
+    free(f->block_buf);
+    free(f->fence);
+    f->map = NULL;
+    f->fence = NULL;
+}
+
+int index_build_fence(struct index_file *f, uint64_t step)
+{
+    free(f->fence);
+    f->fence = NULL;
+    f->fence_count = 0;
+    f->fence_step = 0;
+    if (step == 0 || f->records == 0 || f->columnar)
+        return 0;
+
+    uint64_t count = (f->records + step - 1) / step;
+    f->fence = malloc(sizeof(uint64_t) * count);
+    if (!f->fence)
+    {
+        perror("[Search] malloc fence");
+        return 1;
+    }
+    for (uint64_t i = 0; i < count; i++)
+        f->fence[i] = index_key(f->data[i * step].time_mark);
+    f->fence_count = count;
+    f->fence_step = step;
+    return 0;
+}
+
+// Запись с ключом k лежит левее искомой границы
+static inline int before(uint64_t k, uint64_t key, int upper)
+{
+    return upper ? k <= key : k < key;
+}
+
+// Граница в data[lo, hi): сначала интерполяция по ключам концов отрезка,
+// затем двоичный поиск. Инвариант: ответ лежит в [lo, hi].
+static uint64_t bound_in(const struct index_s *data, uint64_t lo, uint64_t hi, uint64_t key, int upper)
+{
+    for (int round = 0; round < INTERP_ROUNDS && hi - lo > INTERP_MIN; round++)
+    {
+        uint64_t klo = index_key(data[lo].time_mark);
+        uint64_t khi = index_key(data[hi - 1].time_mark);
+        if (!before(klo, key, upper))
+            return lo;
+        if (before(khi, key, upper))
+            return hi;
+        // Здесь klo < khi, так что деление корректно
+        double frac = (double)(key - klo) / (double)(khi - klo);
+        uint64_t pos = lo + (uint64_t)(frac * (hi - 1 - lo));
+        if (pos <= lo)
+            pos = lo + 1;
+        if (pos >= hi - 1)
+            pos = hi - 2;
+        if (before(index_key(data[pos].time_mark), key, upper))
+            lo = pos + 1;
+        else
+            hi = pos;
+    }
+    while (lo < hi)
+    {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (before(index_key(data[mid].time_mark), key, upper))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Декодированный блок колоночного файла, последний блок кэшируется
+static const struct index_s *load_block(struct index_file *f, uint32_t block)
+{
+    if (f->cached_block != block)
+    {
+        f->cached_block = -1;
+        if (col_decode_block(&f->col, block, f->block_buf) < 0)
+        {
+            fprintf(stderr, "[Search] block %u is corrupted\n", block);
+            return NULL;
+        }
+        f->cached_block = block;
+    }
+    return f->block_buf;
+}
+
+// Граница в колоночном файле: первый блок, чей максимум не левее
+// границы, содержит ее. Внутри блока столбец time_mark читается
+// последовательно до границы, recno не декодируются.
+static uint64_t bound_columnar(struct index_file *f, uint64_t key, int upper)
+{
+    uint32_t a = 0, b = f->col.hdr.blocks;
+    while (a < b)
+    {
+        uint32_t mid = a + (b - a) / 2;
+        if (before(index_key(f->col.dir[mid].max_time), key, upper))
+            a = mid + 1;
+        else
+            b = mid;
+    }
+    if (a == f->col.hdr.blocks)
+        return f->records;
+    struct col_cursor c;
+    double time_mark;
+    uint64_t pos = (uint64_t)a * f->col.hdr.block_records;
+    col_time_cursor(&f->col, a, &c);
+    while (col_next_time(&c, &time_mark) == 1 && before(index_key(time_mark), key, upper))
+        pos++;
+    return pos;
+}
+
+static uint64_t bound(struct index_file *f, uint64_t key, int upper)
+{
+    if (f->columnar)
+        return bound_columnar(f, key, upper);
+    uint64_t lo = 0, hi = f->records;
+    if (f->fence)
+    {
+        // Первая опорная запись не левее границы: ответ в ((j - 1) * step, j * step]
+        uint64_t a = 0, b = f->fence_count;
+        while (a < b)
+        {
+            uint64_t mid = a + (b - a) / 2;
+            if (before(f->fence[mid], key, upper))
+                a = mid + 1;
+            else
+                b = mid;
+        }
+        lo = a > 0 ? (a - 1) * f->fence_step + 1 : 0;
+        hi = a < f->fence_count ? a * f->fence_step : f->records;
+    }
+    return bound_in(f->data, lo, hi, key, upper);
+}
+
+uint64_t index_lower_bound(struct index_file *f, uint64_t key)
+{
+    return bound(f, key, 0);
+}
+
+uint64_t index_upper_bound(struct index_file *f, uint64_t key)
+{
+    return bound(f, key, 1);
+}
+
+void index_range(struct index_file *f, double from, double to, uint64_t *first, uint64_t *last)
+{
+    *first = index_lower_bound(f, index_key(from));
+    *last = index_upper_bound(f, index_key(to));
+    if (*last < *first)
+        *last = *first;
+}
+
+const struct index_s *index_records(struct index_file *f, uint64_t pos, uint64_t *avail)
+{
+    if (!f->columnar)
+    {
+        *avail = f->records - pos;
+        return &f->data[pos];
+    }
+    uint32_t block = pos / f->col.hdr.block_records;
+    uint64_t offset = pos % f->col.hdr.block_records;
+    const struct index_s *data = load_block(f, block);
+    if (!data)
+        return NULL;
+    *avail = f->col.dir[block].count - offset;
+    return &data[offset];
+}
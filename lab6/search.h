@@ -0,0 +1,48 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "index.h"
+#include "colfile.h"
+
+// Поиск по отсортированному индексному файлу, отображенному в память.
+// Ключи - index_key(time_mark). Разреженный индекс (fence) хранит ключ
+// каждой fence_step-й записи в памяти: поиск сначала идет по нему, в
+// файле затрагивается только один отрезок из fence_step записей.
+// В колоночном формате роль разреженного индекса играет каталог блоков
+// с min/max, декодируется только блок на границе.
+struct index_file
+{
+    void *map;
+    size_t map_size;
+    const struct index_s *data; // NULL для колоночного формата
+    uint64_t records;
+    uint64_t *fence; // Ключ записи i * fence_step
+    uint64_t fence_count;
+    uint64_t fence_step;
+
+    struct col_file col;
+    int columnar;
+    struct index_s *block_buf; // Последний декодированный блок
+    int64_t cached_block;
+};
+
+int index_open(struct index_file *f, const char *filename);
+void index_close(struct index_file *f);
+
+// Построение разреженного индекса, step = 0 - без него
+int index_build_fence(struct index_file *f, uint64_t step);
+
+// Первая позиция с ключом >= key (lower) или > key (upper)
+uint64_t index_lower_bound(struct index_file *f, uint64_t key);
+uint64_t index_upper_bound(struct index_file *f, uint64_t key);
+
+// Диапазон записей [*first, *last) с time_mark в [from, to]
+void index_range(struct index_file *f, double from, double to, uint64_t *first, uint64_t *last);
+
+// Записи начиная с pos, лежащие подряд в памяти: *avail штук. Для
+// колоночного формата - до конца блока. NULL при поврежденном блоке.
+const struct index_s *index_records(struct index_file *f, uint64_t pos, uint64_t *avail);
+
+#endif // SEARCH_H
@@ -0,0 +1,570 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "index.h"
+#include "colfile.h"
+#include "metrics.h"
+
+// Выборка без полной сортировки: первые или последние N записей и
+// квантили time_mark индексного файла за один проход в несколько потоков.
+//
+// Top-K: у каждого потока своя куча из N лучших записей, корень - худшая
+// из них, и большинство записей отсекается одним сравнением с корнем.
+// Кучи потоков в конце сливаются.
+//
+// Квантили: по случайной выборке записей для каждого квантиля берется
+// отрезок [lo, hi] вокруг выборочного квантиля с запасом в несколько
+// стандартных отклонений. Проход считает записи левее lo и собирает
+// записи внутри отрезка; если искомый ранг попал в отрезок, ответ -
+// быстрый выбор среди собранных. Иначе отрезок расширяется в нужную
+// сторону и проход повторяется только для таких квантилей.
+
+#define DEFAULT_SAMPLE (1 << 20)
+#define MAX_QUANTILES 64
+#define MARGIN_GROWTH 8
+#define SAMPLE_SEED 0x5eed
+#define SPLITMIX_GAMMA 0x9e3779b97f4a7c15ULL
+
+struct bracket
+{
+    double q;
+    uint64_t rank;      // Ранг ответа в порядке compare_index
+    uint64_t margin;    // Запас в записях выборки по обе стороны
+    int has_lo, has_hi; // Без границы отрезок открыт с этой стороны
+    struct index_s lo, hi;
+    uint64_t lo_key, hi_key;
+    int done;
+    struct index_s value;
+};
+
+struct cand_buf
+{
+    struct index_s *data;
+    size_t len;
+    size_t cap;
+};
+
+struct select_task
+{
+    const struct index_s *data;
+    uint64_t first; // Диапазон потока [first, last)
+    uint64_t last;
+    uint64_t k;     // Размер кучи, 0 - без top-K
+    int dir;        // 1 - первые записи, -1 - последние
+    struct index_s *heap;
+    uint64_t heap_len;
+    int nq;
+    struct bracket *br;
+    uint64_t *below;       // Записей левее lo по квантилям
+    struct cand_buf *cand; // Записи внутри отрезков по квантилям
+    int failed;
+};
+
+static inline uint64_t splitmix64(uint64_t seed, uint64_t n)
+{
+    uint64_t z = seed + (n + 1) * SPLITMIX_GAMMA;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Порядок compare_index по уже посчитанному ключу a
+static inline int compare_keyed(uint64_t ka, const struct index_s *a, uint64_t kb, const struct index_s *b)
+{
+    if (ka != kb)
+        return ka < kb ? -1 : 1;
+    return (a->recno > b->recno) - (a->recno < b->recno);
+}
+
+// a лучше b: раньше для dir = 1, позже для dir = -1
+static inline int better(int dir, const struct index_s *a, const struct index_s *b)
+{
+    return dir * compare_index(a, b) < 0;
+}
+
+// Куча из k лучших записей: в корне худшая
+static void heap_offer(struct select_task *t, const struct index_s *rec)
+{
+    struct index_s *h = t->heap;
+    if (t->heap_len < t->k)
+    {
+        uint64_t i = t->heap_len++;
+        h[i] = *rec;
+        while (i > 0 && better(t->dir, &h[(i - 1) / 2], &h[i]))
+        {
+            struct index_s tmp = h[i];
+            h[i] = h[(i - 1) / 2];
+            h[(i - 1) / 2] = tmp;
+            i = (i - 1) / 2;
+        }
+        return;
+    }
+    if (!better(t->dir, rec, &h[0]))
+        return;
+    h[0] = *rec;
+    uint64_t i = 0;
+    for (;;)
+    {
+        uint64_t l = 2 * i + 1, r = l + 1, w = i;
+        if (l < t->heap_len && better(t->dir, &h[w], &h[l]))
+            w = l;
+        if (r < t->heap_len && better(t->dir, &h[w], &h[r]))
+            w = r;
+        if (w == i)
+            break;
+        struct index_s tmp = h[i];
+        h[i] = h[w];
+        h[w] = tmp;
+        i = w;
+    }
+}
+
+static int cand_push(struct cand_buf *c, const struct index_s *rec)
+{
+    if (c->len == c->cap)
+    {
+        size_t cap = c->cap ? c->cap * 2 : 4096;
+        struct index_s *data = realloc(c->data, cap * sizeof(struct index_s));
+        if (!data)
+            return 1;
+        c->data = data;
+        c->cap = cap;
+    }
+    c->data[c->len++] = *rec;
+    return 0;
+}
+
+static void *select_thread(void *arg)
+{
+    struct select_task *t = (struct select_task *)arg;
+    for (uint64_t i = t->first; i < t->last && !t->failed; i++)
+    {
+        const struct index_s *rec = &t->data[i];
+        if (t->k)
+            heap_offer(t, rec);
+        if (t->nq == 0)
+            continue;
+        uint64_t key = index_key(rec->time_mark);
+        for (int j = 0; j < t->nq; j++)
+        {
+            const struct bracket *b = &t->br[j];
+            if (b->done)
+                continue;
+            if (b->has_lo && compare_keyed(key, rec, b->lo_key, &b->lo) < 0)
+                t->below[j]++;
+            else if ((!b->has_hi || compare_keyed(key, rec, b->hi_key, &b->hi) <= 0) && cand_push(&t->cand[j], rec))
+                t->failed = 1;
+        }
+    }
+    return NULL;
+}
+
+// Проход по файлу в threads потоков
+static int run_pass(struct select_task *tasks, int threads)
+{
+    pthread_t *ids = malloc(sizeof(pthread_t) * threads);
+    if (!ids)
+    {
+        perror("[Main] malloc");
+        return 1;
+    }
+    int started = 1;
+    for (; started < threads; started++)
+    {
+        if (pthread_create(&ids[started], NULL, select_thread, &tasks[started]) != 0)
+            break;
+    }
+    select_thread(&tasks[0]);
+    for (int t = started; t < threads; t++)
+        select_thread(&tasks[t]);
+    for (int t = 1; t < started; t++)
+        pthread_join(ids[t], NULL);
+    free(ids);
+    for (int t = 0; t < threads; t++)
+    {
+        if (tasks[t].failed)
+        {
+            perror("[Main] malloc candidates");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Запись с порядковым номером nth среди a[0..n) по compare_index
+static struct index_s quickselect(struct index_s *a, int64_t n, int64_t nth)
+{
+    int64_t lo = 0, hi = n - 1;
+    while (lo < hi)
+    {
+        struct index_s pivot = a[lo + (hi - lo) / 2];
+        int64_t i = lo, j = hi;
+        while (i <= j)
+        {
+            while (compare_index(&a[i], &pivot) < 0)
+                i++;
+            while (compare_index(&a[j], &pivot) > 0)
+                j--;
+            if (i <= j)
+            {
+                struct index_s tmp = a[i];
+                a[i++] = a[j];
+                a[j--] = tmp;
+            }
+        }
+        if (nth <= j)
+            hi = j;
+        else if (nth >= i)
+            lo = i;
+        else
+            break;
+    }
+    return a[nth];
+}
+
+// Отрезок квантиля по отсортированной выборке: позиция квантиля в
+// выборке плюс-минус margin
+static void set_bracket(struct bracket *b, const struct index_s *sample, uint64_t s)
+{
+    uint64_t p = (uint64_t)(b->q * (s - 1));
+    b->has_lo = p >= b->margin;
+    b->has_hi = p + b->margin < s;
+    if (b->has_lo)
+    {
+        b->lo = sample[p - b->margin];
+        b->lo_key = index_key(b->lo.time_mark);
+    }
+    if (b->has_hi)
+    {
+        b->hi = sample[p + b->margin];
+        b->hi_key = index_key(b->hi.time_mark);
+    }
+}
+
+static uint64_t isqrt(uint64_t x)
+{
+    uint64_t r = 0;
+    while ((r + 1) * (r + 1) <= x)
+        r++;
+    return r;
+}
+
+static int parse_quantiles(const char *arg, struct bracket *br, int *nq)
+{
+    char *end;
+    *nq = 0;
+    for (const char *p = arg; *p;)
+    {
+        double q = strtod(p, &end);
+        if (end == p || q < 0.0 || q > 1.0 || *nq == MAX_QUANTILES || (*end && *end != ','))
+            return 1;
+        memset(&br[*nq], 0, sizeof(br[*nq]));
+        br[(*nq)++].q = q;
+        p = *end ? end + 1 : end;
+    }
+    return *nq == 0;
+}
+
+static void print_record(const char *prefix, const struct index_s *rec)
+{
+    printf("[Main] %stime_mark: %.6f, recno: %lu\n", prefix, rec->time_mark, rec->recno);
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "[Main] Usage: %s [-t threads] [-k N [-l]] [-q q1,q2,...] [-a] [-s sample] filename\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = sysconf(_SC_NPROCESSORS_ONLN), dir = 1, approx = 0, nq = 0;
+    uint64_t k = 0, sample_size = DEFAULT_SAMPLE;
+    struct bracket br[MAX_QUANTILES];
+    int c;
+    while ((c = getopt(argc, argv, "t:k:lq:as:")) != -1)
+    {
+        switch (c)
+        {
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'k':
+            k = strtoull(optarg, NULL, 10);
+            break;
+        case 'l':
+            dir = -1;
+            break;
+        case 'q':
+            if (parse_quantiles(optarg, br, &nq) != 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'a':
+            approx = 1;
+            break;
+        case 's':
+            sample_size = strtoull(optarg, NULL, 10);
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 1 || (k == 0 && nq == 0) || threads < 1 || sample_size == 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    const char *filename = argv[optind];
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        perror("[Main] open");
+        return 1;
+    }
+    if (col_detect(fd))
+    {
+        fprintf(stderr, "[Main] %s is columnar, convert it with idxconv first\n", filename);
+        close(fd);
+        return 1;
+    }
+    uint64_t records;
+    struct stat st;
+    if (pread(fd, &records, sizeof(uint64_t), 0) != sizeof(uint64_t) || fstat(fd, &st) == -1)
+    {
+        perror("[Main] read header");
+        close(fd);
+        return 1;
+    }
+    size_t file_size = sizeof(uint64_t) + records * RECORD_SIZE;
+    if ((uint64_t)st.st_size < file_size)
+    {
+        fprintf(stderr, "[Main] file is shorter than %lu records from its header\n", records);
+        close(fd);
+        return 1;
+    }
+    if (records == 0)
+    {
+        printf("[Main] Records: 0\n");
+        close(fd);
+        return 0;
+    }
+    void *map = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("[Main] mmap");
+        return 1;
+    }
+    posix_madvise(map, file_size, POSIX_MADV_SEQUENTIAL);
+    const struct index_s *data = (const struct index_s *)((const char *)map + sizeof(uint64_t));
+    if ((uint64_t)threads > records)
+        threads = records;
+    if (k > records)
+        k = records;
+    uint64_t t0 = metrics_now();
+
+    // Выборка нужна, только если файл больше нее; иначе отрезки
+    // открыты и кандидаты - все записи
+    struct index_s *sample = NULL;
+    uint64_t s = 0;
+    if (nq > 0 && (records > sample_size || approx))
+    {
+        s = sample_size;
+        sample = malloc(sizeof(struct index_s) * s);
+        if (!sample)
+        {
+            perror("[Main] malloc sample");
+            munmap(map, file_size);
+            return 1;
+        }
+        for (uint64_t i = 0; i < s; i++)
+            sample[i] = data[splitmix64(SAMPLE_SEED, i) % records];
+        qsort(sample, s, sizeof(struct index_s), compare_index);
+    }
+    for (int j = 0; j < nq; j++)
+    {
+        br[j].rank = (uint64_t)(br[j].q * (records - 1));
+        br[j].margin = 3 * isqrt(s) + 8;
+        if (approx)
+        {
+            br[j].value = sample[(uint64_t)(br[j].q * (s - 1))];
+            br[j].done = 1;
+        }
+        else if (sample)
+        {
+            set_bracket(&br[j], sample, s);
+        }
+    }
+
+    struct select_task *tasks = calloc(threads, sizeof(struct select_task));
+    uint64_t *below = calloc((size_t)threads * MAX_QUANTILES, sizeof(uint64_t));
+    struct cand_buf *cand = calloc((size_t)threads * MAX_QUANTILES, sizeof(struct cand_buf));
+    struct index_s *all = NULL;
+    int ret = 1;
+    if (!tasks || !below || !cand)
+    {
+        perror("[Main] malloc");
+        goto out;
+    }
+    for (int t = 0; t < threads; t++)
+    {
+        tasks[t].data = data;
+        tasks[t].first = records * t / threads;
+        tasks[t].last = records * (t + 1) / threads;
+        // Куче потока хватает записей его отрезка
+        tasks[t].k = k < tasks[t].last - tasks[t].first ? k : tasks[t].last - tasks[t].first;
+        tasks[t].dir = dir;
+        tasks[t].nq = nq;
+        tasks[t].br = br;
+        tasks[t].below = &below[(size_t)t * MAX_QUANTILES];
+        tasks[t].cand = &cand[(size_t)t * MAX_QUANTILES];
+        if (k && !(tasks[t].heap = malloc(sizeof(struct index_s) * tasks[t].k)))
+        {
+            perror("[Main] malloc heap");
+            goto out;
+        }
+    }
+
+    int passes = 0;
+    uint64_t max_cand = 0;
+    for (;;)
+    {
+        int pending = 0;
+        for (int j = 0; j < nq; j++)
+            pending += !br[j].done;
+        if (pending == 0 && (passes > 0 || k == 0))
+            break;
+        if (passes > 0)
+        {
+            // Повторный проход только для квантилей
+            for (int t = 0; t < threads; t++)
+                tasks[t].k = 0;
+        }
+        if (run_pass(tasks, threads) != 0)
+            goto out;
+        passes++;
+
+        for (int j = 0; j < nq; j++)
+        {
+            if (br[j].done)
+                continue;
+            uint64_t n_below = 0, n_cand = 0;
+            for (int t = 0; t < threads; t++)
+            {
+                n_below += tasks[t].below[j];
+                n_cand += tasks[t].cand[j].len;
+            }
+            if (br[j].rank >= n_below && br[j].rank < n_below + n_cand)
+            {
+                struct index_s *merged = realloc(all, sizeof(struct index_s) * n_cand);
+                if (!merged)
+                {
+                    perror("[Main] malloc candidates");
+                    goto out;
+                }
+                all = merged;
+                size_t pos = 0;
+                for (int t = 0; t < threads; t++)
+                {
+                    memcpy(&all[pos], tasks[t].cand[j].data, tasks[t].cand[j].len * sizeof(struct index_s));
+                    pos += tasks[t].cand[j].len;
+                }
+                br[j].value = quickselect(all, n_cand, br[j].rank - n_below);
+                br[j].done = 1;
+                if (n_cand > max_cand)
+                    max_cand = n_cand;
+            }
+            else
+            {
+                // Ранг вне отрезка: старая граница становится
+                // противоположной, новая берется с большим запасом
+                int left = br[j].rank < n_below;
+                struct bracket old = br[j];
+                br[j].margin *= MARGIN_GROWTH;
+                set_bracket(&br[j], sample, s);
+                if (left)
+                {
+                    br[j].has_hi = old.has_lo;
+                    br[j].hi = old.lo;
+                    br[j].hi_key = old.lo_key;
+                }
+                else
+                {
+                    br[j].has_lo = old.has_hi;
+                    br[j].lo = old.hi;
+                    br[j].lo_key = old.hi_key;
+                }
+            }
+            for (int t = 0; t < threads; t++)
+            {
+                tasks[t].below[j] = 0;
+                tasks[t].cand[j].len = 0;
+            }
+        }
+    }
+
+    if (k)
+    {
+        // Кучи потоков вместе, лучшие k по порядку
+        uint64_t total = 0;
+        for (int t = 0; t < threads; t++)
+            total += tasks[t].heap_len;
+        struct index_s *merged = realloc(all, sizeof(struct index_s) * total);
+        if (!merged)
+        {
+            perror("[Main] malloc");
+            goto out;
+        }
+        all = merged;
+        uint64_t pos = 0;
+        for (int t = 0; t < threads; t++)
+        {
+            memcpy(&all[pos], tasks[t].heap, tasks[t].heap_len * sizeof(struct index_s));
+            pos += tasks[t].heap_len;
+        }
+        qsort(all, total, sizeof(struct index_s), compare_index);
+        uint64_t shown = total < k ? total : k;
+        printf("[Main] %s %lu of %lu records:\n", dir > 0 ? "Earliest" : "Latest", shown, records);
+        for (uint64_t i = 0; i < shown; i++)
+            print_record("", dir > 0 ? &all[i] : &all[total - 1 - i]);
+    }
+    for (int j = 0; j < nq; j++)
+    {
+        char prefix[64];
+        snprintf(prefix, sizeof(prefix), "q=%g%s rank %lu: ", br[j].q, approx ? " (approximate)" : "", br[j].rank);
+        print_record(prefix, &br[j].value);
+    }
+    printf("[Main] Records: %lu, threads: %d, passes: %d, sample: %lu, max candidates: %lu, elapsed: %.3f s\n",
+           records, threads, passes, s, max_cand, (metrics_now() - t0) / 1e9);
+    ret = 0;
+
+out:
+    if (tasks)
+    {
+        for (int t = 0; t < threads; t++)
+            free(tasks[t].heap);
+    }
+    if (cand)
+    {
+        for (size_t i = 0; i < (size_t)threads * MAX_QUANTILES; i++)
+            free(cand[i].data);
+    }
+    free(tasks);
+    free(below);
+    free(cand);
+    free(all);
+    free(sample);
+    munmap(map, file_size);
+    return ret;
+}
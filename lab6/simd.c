@@ -0,0 +1,300 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdlib.h>
+#include <string.h>
+#include "simd.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86 1
+#endif
+
+#define TILE 16
+
+typedef void (*merge_fn)(struct index_s *, const struct index_s *, size_t, const struct index_s *, size_t);
+
+static void merge_scalar(struct index_s *dest, const struct index_s *a, size_t a_len, const struct index_s *b,
+                         size_t b_len)
+{
+    size_t i = 0, j = 0, k = 0;
+    // Выбор источника арифметикой, а не переходом: на случайных ключах
+    // ветвление угадывается в половине случаев
+    while (i < a_len && j < b_len)
+    {
+        int take_b = compare_index(&b[j], &a[i]) < 0;
+        dest[k++] = take_b ? b[j] : a[i];
+        j += take_b;
+        i += !take_b;
+    }
+    while (i < a_len)
+        dest[k++] = a[i++];
+    while (j < b_len)
+        dest[k++] = b[j++];
+}
+
+static merge_fn merge_impl = merge_scalar;
+static int use_avx2;
+
+#ifdef HAVE_X86
+
+// Четыре записи в регистрах по полям: k - ключ сравнения, r - recno,
+// t - исходные биты time_mark. k и r сдвинуты на 2^63, чтобы беззнаковый
+// порядок совпал со знаковым сравнением AVX2.
+struct vrec
+{
+    __m256i k, r, t;
+};
+
+#define VPERM(v, imm) ((struct vrec){_mm256_permute4x64_epi64((v).k, imm), _mm256_permute4x64_epi64((v).r, imm), \
+                                     _mm256_permute4x64_epi64((v).t, imm)})
+
+__attribute__((target("avx2"))) static inline __m256i vkey(__m256i t)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    // index_key(t) ^ 2^63: у отрицательных инвертируются все биты кроме знака
+    __m256i neg = _mm256_cmpgt_epi64(zero, t);
+    __m256i k = _mm256_xor_si256(t, _mm256_srli_epi64(neg, 1));
+    __m256d d = _mm256_castsi256_pd(t);
+    __m256i is_zero = _mm256_castpd_si256(_mm256_cmp_pd(d, _mm256_setzero_pd(), _CMP_EQ_OQ));
+    __m256i is_nan = _mm256_castpd_si256(_mm256_cmp_pd(d, d, _CMP_UNORD_Q));
+    k = _mm256_andnot_si256(is_zero, k);
+    return _mm256_blendv_epi8(k, _mm256_set1_epi64x(INT64_MAX), is_nan);
+}
+
+__attribute__((target("avx2"))) static inline struct vrec vload(const struct index_s *p)
+{
+    __m256i v0 = _mm256_loadu_si256((const __m256i *)p);
+    __m256i v1 = _mm256_loadu_si256((const __m256i *)(p + 2));
+    struct vrec v;
+    v.t = _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(v0, v1), 0xD8);
+    v.r = _mm256_xor_si256(_mm256_permute4x64_epi64(_mm256_unpackhi_epi64(v0, v1), 0xD8),
+                           _mm256_set1_epi64x(INT64_MIN));
+    v.k = vkey(v.t);
+    return v;
+}
+
+__attribute__((target("avx2"))) static inline void vstore(struct index_s *p, struct vrec v)
+{
+    __m256i t = _mm256_permute4x64_epi64(v.t, 0xD8);
+    __m256i r = _mm256_permute4x64_epi64(_mm256_xor_si256(v.r, _mm256_set1_epi64x(INT64_MIN)), 0xD8);
+    _mm256_storeu_si256((__m256i *)p, _mm256_unpacklo_epi64(t, r));
+    _mm256_storeu_si256((__m256i *)(p + 2), _mm256_unpackhi_epi64(t, r));
+}
+
+// Маска дорожек, где x < y
+__attribute__((target("avx2"))) static inline __m256i vlt(struct vrec x, struct vrec y)
+{
+    __m256i key_lt = _mm256_cmpgt_epi64(y.k, x.k);
+    __m256i key_eq = _mm256_cmpeq_epi64(x.k, y.k);
+    __m256i rec_lt = _mm256_cmpgt_epi64(y.r, x.r);
+    return _mm256_or_si256(key_lt, _mm256_and_si256(key_eq, rec_lt));
+}
+
+// m ? b : a по дорожкам
+__attribute__((target("avx2"))) static inline struct vrec vblend(struct vrec a, struct vrec b, __m256i m)
+{
+    struct vrec v;
+    v.k = _mm256_blendv_epi8(a.k, b.k, m);
+    v.r = _mm256_blendv_epi8(a.r, b.r, m);
+    v.t = _mm256_blendv_epi8(a.t, b.t, m);
+    return v;
+}
+
+// Компаратор между дорожками x и ее парой в y = перестановке x: в дорожках
+// low остается меньшая, в остальных - большая. Маски берутся с двух сторон,
+// чтобы равные по ключу и recno записи не дублировались.
+__attribute__((target("avx2"))) static inline struct vrec vminmax_lanes(struct vrec x, struct vrec y, __m256i low)
+{
+    __m256i sel = _mm256_blendv_epi8(vlt(y, x), vlt(x, y), low);
+    return vblend(y, x, sel);
+}
+
+// Битоническое слияние двух отсортированных четверок: lo - 4 меньших,
+// hi - 4 больших, обе по возрастанию
+__attribute__((target("avx2"))) static inline void vmerge4(struct vrec *lo, struct vrec *hi)
+{
+    const __m256i low_half = _mm256_set_epi64x(0, 0, -1, -1);
+    const __m256i low_even = _mm256_set_epi64x(0, -1, 0, -1);
+    struct vrec b = VPERM(*hi, 0x1B);
+    __m256i m = vlt(*lo, b);
+    struct vrec l = vblend(b, *lo, m);
+    struct vrec h = vblend(*lo, b, m);
+
+    l = vminmax_lanes(l, VPERM(l, 0x4E), low_half);
+    h = vminmax_lanes(h, VPERM(h, 0x4E), low_half);
+    l = vminmax_lanes(l, VPERM(l, 0xB1), low_even);
+    h = vminmax_lanes(h, VPERM(h, 0xB1), low_even);
+    *lo = l;
+    *hi = h;
+}
+
+// Слияние хвостов трех отсортированных последовательностей
+static void merge3_tail(struct index_s *dest, const struct index_s *c, size_t c_len, const struct index_s *a,
+                        size_t a_len, const struct index_s *b, size_t b_len)
+{
+    size_t i = 0, j = 0, l = 0, k = 0;
+    while (l < c_len)
+    {
+        const struct index_s *best = &c[l];
+        int src = 0;
+        if (i < a_len && compare_index(&a[i], best) < 0)
+        {
+            best = &a[i];
+            src = 1;
+        }
+        if (j < b_len && compare_index(&b[j], best) < 0)
+        {
+            best = &b[j];
+            src = 2;
+        }
+        dest[k++] = *best;
+        if (src == 0)
+            l++;
+        else if (src == 1)
+            i++;
+        else
+            j++;
+    }
+    merge_scalar(&dest[k], &a[i], a_len - i, &b[j], b_len - j);
+}
+
+__attribute__((target("avx2"))) static void merge_avx2(struct index_s *dest, const struct index_s *a, size_t a_len,
+                                                       const struct index_s *b, size_t b_len)
+{
+    if (a_len < 4 || b_len < 4)
+    {
+        merge_scalar(dest, a, a_len, b, b_len);
+        return;
+    }
+
+    // В hi всегда 4 записи, не меньшие уже выведенных. Следующую четверку
+    // берем из серии с меньшей головой - тогда 4 меньших из lo и hi не
+    // больше всех еще не загруженных записей.
+    struct vrec lo = vload(a), hi = vload(b);
+    size_t i = 4, j = 4, k = 0;
+    vmerge4(&lo, &hi);
+    vstore(dest, lo);
+    k = 4;
+    while (i + 4 <= a_len && j + 4 <= b_len)
+    {
+        if (compare_index(&a[i], &b[j]) <= 0)
+        {
+            lo = vload(&a[i]);
+            i += 4;
+        }
+        else
+        {
+            lo = vload(&b[j]);
+            j += 4;
+        }
+        vmerge4(&lo, &hi);
+        vstore(&dest[k], lo);
+        k += 4;
+    }
+
+    struct index_s carry[4];
+    vstore(carry, hi);
+    merge3_tail(&dest[k], carry, 4, &a[i], a_len - i, &b[j], b_len - j);
+}
+
+// Сортирующая сеть на 16 записей: столбцы из четырех четверок сортируются
+// сетью из 5 компараторов, после транспонирования это 4 серии по 4
+__attribute__((target("avx2"))) static inline void vcas(struct vrec *x, struct vrec *y)
+{
+    __m256i m = vlt(*x, *y);
+    struct vrec mn = vblend(*y, *x, m);
+    struct vrec mx = vblend(*x, *y, m);
+    *x = mn;
+    *y = mx;
+}
+
+__attribute__((target("avx2"))) static inline void vtranspose(__m256i *c0, __m256i *c1, __m256i *c2, __m256i *c3)
+{
+    __m256i t0 = _mm256_unpacklo_epi64(*c0, *c1);
+    __m256i t1 = _mm256_unpackhi_epi64(*c0, *c1);
+    __m256i t2 = _mm256_unpacklo_epi64(*c2, *c3);
+    __m256i t3 = _mm256_unpackhi_epi64(*c2, *c3);
+    *c0 = _mm256_permute2x128_si256(t0, t2, 0x20);
+    *c1 = _mm256_permute2x128_si256(t1, t3, 0x20);
+    *c2 = _mm256_permute2x128_si256(t0, t2, 0x31);
+    *c3 = _mm256_permute2x128_si256(t1, t3, 0x31);
+}
+
+__attribute__((target("avx2"))) static void sort_tile_avx2(struct index_s *p)
+{
+    struct vrec v0 = vload(p), v1 = vload(p + 4), v2 = vload(p + 8), v3 = vload(p + 12);
+    vcas(&v0, &v1);
+    vcas(&v2, &v3);
+    vcas(&v0, &v2);
+    vcas(&v1, &v3);
+    vcas(&v1, &v2);
+    vtranspose(&v0.k, &v1.k, &v2.k, &v3.k);
+    vtranspose(&v0.r, &v1.r, &v2.r, &v3.r);
+    vtranspose(&v0.t, &v1.t, &v2.t, &v3.t);
+    vstore(p, v0);
+    vstore(p + 4, v1);
+    vstore(p + 8, v2);
+    vstore(p + 12, v3);
+}
+
+#endif // HAVE_X86
+
+void simd_init(void)
+{
+#ifdef HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        use_avx2 = 1;
+        merge_impl = merge_avx2;
+        return;
+    }
+#endif
+    use_avx2 = 0;
+    merge_impl = merge_scalar;
+}
+
+int simd_enabled(void)
+{
+    return use_avx2;
+}
+
+void merge_index(struct index_s *dest, const struct index_s *a, size_t a_len, const struct index_s *b, size_t b_len)
+{
+    merge_impl(dest, a, a_len, b, b_len);
+}
+
+struct index_s *simd_sort_index(struct index_s *data, struct index_s *scratch, size_t n)
+{
+    size_t run = 1;
+#ifdef HAVE_X86
+    if (use_avx2 && n >= TILE)
+    {
+        size_t tiles = n / TILE * TILE;
+        for (size_t t = 0; t < tiles; t += TILE)
+            sort_tile_avx2(&data[t]);
+        // Хвост короче плитки целиком отсортирован и потому делится на серии любой длины
+        qsort(&data[tiles], n - tiles, sizeof(struct index_s), compare_index);
+        run = 4;
+    }
+#endif
+    if (run == 1 && n > 1)
+    {
+        qsort(data, n, sizeof(struct index_s), compare_index);
+        return data;
+    }
+
+    struct index_s *src = data, *dst = scratch;
+    for (size_t width = run; width < n; width *= 2)
+    {
+        for (size_t lo = 0; lo < n; lo += 2 * width)
+        {
+            size_t mid = (lo + width < n) ? lo + width : n;
+            size_t hi = (mid + width < n) ? mid + width : n;
+            merge_impl(&dst[lo], &src[lo], mid - lo, &src[mid], hi - mid);
+        }
+        struct index_s *t = src;
+        src = dst;
+        dst = t;
+    }
+    return src;
+}
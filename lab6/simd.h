@@ -0,0 +1,24 @@
+#ifndef SIMD_H
+#define SIMD_H
+
+#include <stddef.h>
+#include "index.h"
+
+// Векторные ядра для struct index_s. Путь AVX2 выбирается во время
+// выполнения по возможностям процессора, иначе работает скалярный
+// вариант без ветвлений в цикле слияния. Порядок совпадает с compare_index.
+
+// Выбор реализации; вызывать до первого использования, повторный вызов безопасен
+void simd_init(void);
+// 1, если используется AVX2
+int simd_enabled(void);
+
+// Слияние отсортированных a и b в dest
+void merge_index(struct index_s *dest, const struct index_s *a, size_t a_len, const struct index_s *b, size_t b_len);
+
+// Сортировка слиянием: сети сортировки на плитках по 16 записей, затем
+// векторное битоническое слияние серий попеременно между data и scratch.
+// Возвращает data или scratch, где оказался результат.
+struct index_s *simd_sort_index(struct index_s *data, struct index_s *scratch, size_t n);
+
+#endif // SIMD_H
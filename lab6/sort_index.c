@@ -1,281 +1,639 @@
-#define _POSIX_C_SOURCE 200809L
+#define _GNU_SOURCE // O_DIRECT
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <pthread.h>
+#include <stdatomic.h>
+#include "append.h"
+#include "index.h"
+#include "journal.h"
+#include "kmerge.h"
+#include "mem.h"
+#include "metrics.h"
+#include "radix.h"
+#include "runio.h"
+#include "sched.h"
+#include "simd.h"
+#include "verify.h"
 
 #define MAX_THREADS 8192
 #define MIN_BLOCKS_PER_THREAD 4
-#define RECORD_SIZE sizeof(struct index_s)
+#define MIN_MERGE_PIECE 65536 // Записей; слияния меньше 2*MIN_MERGE_PIECE не делятся
+#define DEFAULT_WRITE_BUF (8 * 1024 * 1024)
+#define MAX_READ_BUF (8 * 1024 * 1024)
+#define CHECKPOINT_CHUNKS 64                       // Кусков финального слияния с журналом
+#define CHECKPOINT_MIN_RECORDS 65536
+#define CHECKPOINT_MAX_RECORDS (16 * 1024 * 1024) // Не больше 256 МиБ результата между точками сохранения
 
-struct index_s
-{
-    double time_mark;
-    uint64_t recno;
-};
-
-struct index_hdr_s
-{
-    uint64_t records;
-    struct index_s idx[];
-};
+struct merge_node;
 
 struct sort_context
 {
     struct index_s *buffer;
     size_t memsize;
     size_t record_size;
-    size_t records_per_part;
+    size_t part_records; // Записей в текущей части, последняя часть может быть короче
     int blocks;
     int threads;
-    pthread_barrier_t barrier;
-    pthread_mutex_t mutex;
-    int *block_map;
+    struct sched sched;
+    struct merge_node *nodes;
     struct index_s *tmp_buf;
+    int sort_mode;
+    struct metrics *metrics;
+    int adaptive;               // Пропускать уже упорядоченные блоки и слияния
+    unsigned char *block_order; // Порядок блоков части по проверке: enum block_order
+};
+
+// Кусок слияния узла: диапазон рангов результата [len*index/n, len*(index+1)/n)
+struct merge_piece
+{
+    struct merge_node *node;
+    int index;
 };
 
-struct thread_data
+// Узел дерева слияния над блоками [lo, hi) части. Листья - сортировка
+// одного блока, внутренний узел сливает детей [lo, mid) и [mid, hi),
+// как только оба готовы. Большие слияния делятся на куски по рангам.
+// Слияния идут попеременно между buffer и tmp_buf без копирования
+// обратно: результат узла глубины depth лежит в buffer при четной
+// глубине и в tmp_buf при нечетной, так что корень всегда в buffer.
+struct merge_node
 {
-    int thread_id;
     struct sort_context *ctx;
+    struct merge_node *parent;
+    int lo, mid, hi;
+    int depth;
+    atomic_int pending;     // Незавершенных детей
+    atomic_int pieces_left; // Незавершенных кусков слияния
+    int npieces;
+    int ordered; // Левый ребенок целиком не больше правого - слияние сводится к копии
+    struct merge_piece *pieces;
+    struct merge_piece single; // Если слияние не делится или не хватило памяти
 };
 
-int compare_index(const void *a, const void *b)
+enum prefetch_mode
 {
-    const struct index_s *ia = (const struct index_s *)a;
-    const struct index_s *ib = (const struct index_s *)b;
-    if (ia->time_mark < ib->time_mark)
-        return -1;
-    if (ia->time_mark > ib->time_mark)
-        return 1;
-    return 0;
+    PREFETCH_OFF,
+    PREFETCH_MADVISE, // posix_madvise(WILLNEED) - ядро читает часть асинхронно
+    PREFETCH_READER   // Отдельный поток читает страницы части
+};
+
+enum io_mode
+{
+    IO_SYNC, // Части отображаются в память, слияние через pread/pwrite
+    IO_URING // Части читаются в буферы и слияние идет через io_uring
+};
+
+enum sort_mode
+{
+    SORT_QSORT,
+    SORT_RADIX,
+    SORT_SIMD
+};
+
+// Результат проверки блока в адаптивном режиме. BLOCK_LINKED ставится
+// вместе с BLOCK_ASCENDING, если последняя запись блока не больше первой
+// записи следующего
+enum block_order
+{
+    BLOCK_UNORDERED = 0,
+    BLOCK_ASCENDING = 1,
+    BLOCK_DESCENDING = 2,
+    BLOCK_LINKED = 4
+};
+
+enum summary_mode
+{
+    SUMMARY_NONE,
+    SUMMARY_TEXT,
+    SUMMARY_JSON,
+    SUMMARY_CSV
+};
+
+struct sort_options
+{
+    int sort_mode;    // Движок сортировки блоков: enum sort_mode
+    int prefetch;     // Упреждающее чтение следующей части: enum prefetch_mode
+    size_t read_buf;  // Буфер чтения на каждую часть в каждом потоке слияния, 0 - по умолчанию
+    size_t write_buf; // Буфер записи результата слияния
+    int verbose;      // Печатать каждый блок и кусок слияния
+    int interval;     // Период строки прогресса в секундах, 0 - выключена
+    int summary;      // Итоговый отчет: enum summary_mode
+    int adaptive;     // Искать готовые возрастающие и убывающие участки
+    int verify;       // Сверить контрольную сумму до и после и проверить порядок результата
+    int journal;      // Сортировать копию с журналом, чтобы продолжить после сбоя
+    const char *tmp_dir; // Каталог временных файлов, NULL - каталог исходного файла
+    int huge;         // Страницы tmp_buf и частей: enum huge_mode
+    int numa;         // Привязать потоки к узлам NUMA и разместить tmp_buf первым касанием
+    int io;           // enum io_mode
+    int direct;       // O_DIRECT для частей и слияния (только с io_uring)
+    const char *append_to; // Влить отсортированный файл в этот индекс, NULL - нет
+    int dedup;        // Повторы при вливании: enum dedup_policy
+};
+
+// Временные файлы: результат слияния, копия с отсортированными частями
+// и журнал. Имена строятся от имени исходного файла.
+struct sort_paths
+{
+    char out[PATH_MAX];
+    char runs[PATH_MAX];
+    char journal[PATH_MAX];
+};
+
+// Начало блока в записях. Блоки различаются по длине не больше чем на
+// одну запись, block_start(ctx, blocks) - конец части.
+static inline size_t block_start(const struct sort_context *ctx, int block)
+{
+    return (uint64_t)ctx->part_records * block / ctx->blocks;
+}
+
+// Буфер, в котором лежит результат узла
+static inline struct index_s *node_data(const struct merge_node *node)
+{
+    return (node->depth & 1) ? node->ctx->tmp_buf : node->ctx->buffer;
 }
 
-void merge(struct index_s *dest, struct index_s *a, size_t a_len, struct index_s *b, size_t b_len)
+// Сортировка блока листа с результатом в node_data(leaf). tmp_buf на месте
+// блока служит рабочим буфером radix. Копия нужна только листу нечетной
+// глубины и только если сортировка закончилась не в том буфере - это и
+// есть единственное копирование за всю сортировку части.
+void sort_block(struct merge_node *leaf)
 {
-    size_t i = 0, j = 0, k = 0;
-    while (i < a_len && j < b_len)
+    struct sort_context *ctx = leaf->ctx;
+    size_t start = block_start(ctx, leaf->lo);
+    size_t len = block_start(ctx, leaf->hi) - start;
+    int order = ctx->adaptive ? ctx->block_order[leaf->lo] : BLOCK_UNORDERED;
+    struct index_s *sorted;
+    if (order & BLOCK_ASCENDING)
     {
-        if (compare_index(&a[i], &b[j]) <= 0)
-        {
-            dest[k++] = a[i++];
-        }
-        else
+        sorted = &ctx->buffer[start];
+    }
+    else if (order & BLOCK_DESCENDING)
+    {
+        // Строго убывающий блок достаточно развернуть, сразу в node_data
+        struct index_s *src = &ctx->buffer[start], *dst = &node_data(leaf)[start];
+        for (size_t i = 0, j = len - 1; i < j; i++, j--)
         {
-            dest[k++] = b[j++];
+            struct index_s tmp = src[i];
+            dst[i] = src[j];
+            dst[j] = tmp;
         }
+        if (dst != src && len % 2 == 1)
+            dst[len / 2] = src[len / 2];
+        return;
     }
-    while (i < a_len)
-        dest[k++] = a[i++];
-    while (j < b_len)
-        dest[k++] = b[j++];
+    else if (ctx->sort_mode == SORT_RADIX)
+    {
+        sorted = radix_sort(&rs_index_format, &ctx->buffer[start], &ctx->tmp_buf[start], len);
+    }
+    else if (ctx->sort_mode == SORT_SIMD)
+    {
+        sorted = simd_sort_index(&ctx->buffer[start], &ctx->tmp_buf[start], len);
+    }
+    else
+    {
+        qsort(&ctx->buffer[start], len, ctx->record_size, compare_index);
+        sorted = &ctx->buffer[start];
+    }
+    struct index_s *dst = &node_data(leaf)[start];
+    if (sorted != dst)
+        memcpy(dst, sorted, len * ctx->record_size);
 }
 
-void *thread_func(void *arg)
+// Проверка порядка блока перед сортировкой в адаптивном режиме
+static int check_block(const struct sort_context *ctx, int block)
 {
-    struct thread_data *data = (struct thread_data *)arg;
-    int tid = data->thread_id;
-    struct sort_context *ctx = data->ctx;
-    struct index_s *buffer = ctx->buffer;
-    size_t block_records = ctx->records_per_part / ctx->blocks;
+    size_t start = block_start(ctx, block);
+    size_t end = block_start(ctx, block + 1);
+    const struct index_s *data = ctx->buffer;
+    int ascending = 1, descending = end - start > 1;
+    for (size_t i = start + 1; i < end && (ascending || descending); i++)
+    {
+        int cmp = compare_index(&data[i - 1], &data[i]);
+        ascending &= cmp <= 0;
+        descending &= cmp > 0;
+    }
+    if (ascending)
+    {
+        int linked = block + 1 == ctx->blocks || end == start ||
+                     end == ctx->part_records || compare_index(&data[end - 1], &data[end]) <= 0;
+        return BLOCK_ASCENDING | (linked ? BLOCK_LINKED : 0);
+    }
+    return descending ? BLOCK_DESCENDING : BLOCK_UNORDERED;
+}
+
+// Порядок записей для kmerge_co_rank
+static int index_less(const void *ctx, const void *a, const void *b)
+{
+    (void)ctx;
+    return compare_index(a, b) < 0;
+}
 
-    // Сортировка начального блока
-    if (tid < ctx->blocks)
+static void schedule_merge(struct sched *s, struct merge_node *node, int worker);
+
+static void node_done(struct sched *s, struct merge_node *node, int worker)
+{
+    struct merge_node *parent = node->parent;
+    if (parent && atomic_fetch_sub(&parent->pending, 1) == 1)
+        schedule_merge(s, parent, worker);
+}
+
+static void sort_task(struct sched *s, void *arg, int worker)
+{
+    struct merge_node *node = (struct merge_node *)arg;
+    struct metrics *m = node->ctx->metrics;
+    if (m->verbose)
     {
-        printf("[Thread %d] Sorting block: %d\n", tid, tid);
+        printf("[Thread %d] Sorting block: %d\n", worker, node->lo);
         fflush(stdout);
-        qsort(&buffer[tid * block_records], block_records, ctx->record_size, compare_index);
-        pthread_mutex_lock(&ctx->mutex);
-        ctx->block_map[tid] = 2; // Отсортирован
-        pthread_mutex_unlock(&ctx->mutex);
-        printf("[Thread %d] Sorted block: %d\n", tid, tid);
+    }
+    uint64_t t0 = metrics_now();
+    sort_block(node);
+    metrics_time(m, worker, PHASE_SORT, metrics_now() - t0);
+    size_t len = block_start(node->ctx, node->hi) - block_start(node->ctx, node->lo);
+    metrics_count(m, worker, CNT_BLOCKS, 1);
+    metrics_count(m, worker, CNT_SORTED, len);
+    if (node->ctx->adaptive && node->ctx->block_order[node->lo] != BLOCK_UNORDERED)
+        metrics_count(m, worker, CNT_PRESORTED, len);
+    if (m->verbose)
+    {
+        printf("[Thread %d] Sorted block: %d\n", worker, node->lo);
         fflush(stdout);
     }
+    node_done(s, node, worker);
+}
+
+static void check_task(struct sched *s, void *arg, int worker)
+{
+    (void)s;
+    struct merge_node *leaf = (struct merge_node *)arg;
+    struct sort_context *ctx = leaf->ctx;
+    uint64_t t0 = metrics_now();
+    ctx->block_order[leaf->lo] = check_block(ctx, leaf->lo);
+    metrics_time(ctx->metrics, worker, PHASE_SORT, metrics_now() - t0);
+}
 
-    // Сортировка остальных блоков
-    while (1)
+static void piece_task(struct sched *s, void *arg, int worker);
+
+static void schedule_pieces(struct sched *s, struct merge_node *node, int worker)
+{
+    atomic_store(&node->pieces_left, node->npieces);
+    for (int i = 0; i < node->npieces; i++)
+        sched_spawn(s, worker, piece_task, &node->pieces[i]);
+}
+
+static void schedule_merge(struct sched *s, struct merge_node *node, int worker)
+{
+    struct sort_context *ctx = node->ctx;
+    size_t len = block_start(ctx, node->hi) - block_start(ctx, node->lo);
+    size_t middle = block_start(ctx, node->mid);
+    const struct index_s *src = (node->depth & 1) ? ctx->buffer : ctx->tmp_buf;
+    node->ordered = ctx->adaptive && middle > block_start(ctx, node->lo) && middle < block_start(ctx, node->hi) &&
+                    compare_index(&src[middle - 1], &src[middle]) <= 0;
+
+    // Кусков по доле узла в части, чтобы последние слияния занимали все потоки
+    int n = ((long long)ctx->threads * (node->hi - node->lo) + ctx->blocks - 1) / ctx->blocks;
+    if ((size_t)n > len / MIN_MERGE_PIECE)
+        n = len / MIN_MERGE_PIECE;
+    node->pieces = (n > 1) ? malloc(sizeof(struct merge_piece) * n) : NULL;
+    if (!node->pieces)
     {
-        pthread_mutex_lock(&ctx->mutex);
-        int free_block = -1;
-        for (int i = 0; i < ctx->blocks; i++)
-        {
-            if (ctx->block_map[i] == 0)
-            {
-                free_block = i;
-                ctx->block_map[i] = 1; // Занят
-                break;
-            }
-        }
-        pthread_mutex_unlock(&ctx->mutex);
+        n = 1;
+        node->pieces = &node->single;
+    }
+    for (int i = 0; i < n; i++)
+    {
+        node->pieces[i].node = node;
+        node->pieces[i].index = i;
+    }
+    node->npieces = n;
+    schedule_pieces(s, node, worker);
+}
 
-        if (free_block == -1)
-        {
-            printf("[Thread %d] Waiting at sort barrier\n", tid);
-            fflush(stdout);
-            pthread_barrier_wait(&ctx->barrier);
-            break;
-        }
+static void piece_task(struct sched *s, void *arg, int worker)
+{
+    struct merge_piece *piece = (struct merge_piece *)arg;
+    struct merge_node *node = piece->node;
+    struct sort_context *ctx = node->ctx;
+    size_t start = block_start(ctx, node->lo);
+    size_t middle = block_start(ctx, node->mid);
+    size_t len = block_start(ctx, node->hi) - start;
+    size_t r0 = (uint64_t)len * piece->index / node->npieces;
+    size_t r1 = (uint64_t)len * (piece->index + 1) / node->npieces;
 
-        printf("[Thread %d] Sorting block: %d\n", tid, free_block);
+    struct metrics *m = ctx->metrics;
+    if (m->verbose)
+    {
+        printf("[Thread %d] Merging blocks: %d-%d, piece %d of %d\n", worker, node->lo, node->hi - 1,
+               piece->index + 1, node->npieces);
         fflush(stdout);
-        qsort(&buffer[free_block * block_records], block_records, ctx->record_size, compare_index);
-        pthread_mutex_lock(&ctx->mutex);
-        ctx->block_map[free_block] = 2; // Отсортирован
-        pthread_mutex_unlock(&ctx->mutex);
-        printf("[Thread %d] Sorted block: %d\n", tid, free_block);
+    }
+    uint64_t t0 = metrics_now();
+    struct index_s *src = (node->depth & 1) ? ctx->buffer : ctx->tmp_buf;
+    if (node->ordered)
+    {
+        memcpy(&node_data(node)[start + r0], &src[start + r0], (r1 - r0) * ctx->record_size);
+        metrics_count(m, worker, CNT_PRESORTED, r1 - r0);
+    }
+    else
+    {
+        struct index_s *a = &src[start], *b = &src[middle];
+        size_t a_len = middle - start, b_len = len - a_len;
+        size_t i0 = kmerge_co_rank(a, a_len, b, b_len, RECORD_SIZE, r0, index_less, NULL);
+        size_t i1 = kmerge_co_rank(a, a_len, b, b_len, RECORD_SIZE, r1, index_less, NULL);
+        merge_index(&node_data(node)[start + r0], &a[i0], i1 - i0, &b[r0 - i0], (r1 - i1) - (r0 - i0));
+        metrics_count(m, worker, CNT_MERGED, r1 - r0);
+    }
+    metrics_time(m, worker, PHASE_MERGE, metrics_now() - t0);
+    metrics_count(m, worker, CNT_MERGES, 1);
+    if (m->verbose)
+    {
+        printf("[Thread %d] Merged blocks: %d-%d, piece %d of %d\n", worker, node->lo, node->hi - 1,
+               piece->index + 1, node->npieces);
         fflush(stdout);
     }
 
-    // Фаза слияния
-    size_t current_block_records = block_records;
-    int current_blocks = ctx->blocks;
-    while (current_blocks > 1)
+    if (atomic_fetch_sub(&node->pieces_left, 1) != 1)
+        return;
+    if (node->pieces != &node->single)
+        free(node->pieces);
+    node_done(s, node, worker);
+}
+
+static struct merge_node *build_tree(struct sort_context *ctx, struct merge_node **next, int lo, int hi,
+                                     struct merge_node *parent)
+{
+    struct merge_node *node = (*next)++;
+    node->ctx = ctx;
+    node->parent = parent;
+    node->depth = parent ? parent->depth + 1 : 0;
+    node->lo = lo;
+    node->hi = hi;
+    node->mid = lo + (hi - lo) / 2;
+    atomic_init(&node->pending, hi - lo > 1 ? 2 : 0);
+    atomic_init(&node->pieces_left, 0);
+    if (hi - lo > 1)
+    {
+        build_tree(ctx, next, lo, node->mid, node);
+        build_tree(ctx, next, node->mid, hi, node);
+    }
+    return node;
+}
+
+// Сортировка части постоянным пулом: листья дерева слияния раздаются по
+// очередям потоков, дальше потоки сами подхватывают готовые слияния и
+// крадут работу друг у друга. Поток main участвует как поток 0.
+// В адаптивном режиме сначала параллельно проверяется порядок блоков:
+// если все блоки возрастают и стыкуются, часть уже отсортирована и
+// стоит одного чтения.
+void sort_part(struct sort_context *ctx)
+{
+    struct merge_node *next = ctx->nodes;
+    build_tree(ctx, &next, 0, ctx->blocks, NULL);
+    int leaf = 0;
+    if (ctx->adaptive)
     {
-        int pairs = current_blocks / 2;
-        for (int i = tid; i < pairs; i += ctx->threads)
+        for (struct merge_node *node = ctx->nodes; node < next; node++)
         {
-            size_t start = 2 * i * current_block_records;
-            size_t mid = start + current_block_records;
-            printf("[Thread %d] Merging blocks: %zu-%zu\n", tid, start / block_records, (mid / block_records) - 1);
-            fflush(stdout);
-            merge(&ctx->tmp_buf[start], &buffer[start], current_block_records,
-                  &buffer[mid], current_block_records);
-            memcpy(&buffer[start], &ctx->tmp_buf[start], 2 * current_block_records * ctx->record_size);
-            printf("[Thread %d] Merged blocks: %zu-%zu\n", tid, start / block_records, (mid / block_records) - 1);
-            fflush(stdout);
+            if (node->hi - node->lo == 1)
+                sched_spawn(&ctx->sched, leaf++ % ctx->threads, check_task, node);
         }
-        printf("[Thread %d] Waiting at merge barrier\n", tid);
-        fflush(stdout);
-        pthread_barrier_wait(&ctx->barrier);
-        current_block_records *= 2;
-        current_blocks = (current_blocks + 1) / 2;
+        sched_run(&ctx->sched, 0);
+        int in_order = 1;
+        for (int b = 0; b < ctx->blocks && in_order; b++)
+            in_order = ctx->block_order[b] == (BLOCK_ASCENDING | BLOCK_LINKED);
+        if (in_order)
+        {
+            metrics_count(ctx->metrics, 0, CNT_PRESORTED, ctx->part_records);
+            return;
+        }
+        leaf = 0;
     }
+    for (struct merge_node *node = ctx->nodes; node < next; node++)
+    {
+        if (node->hi - node->lo == 1)
+            sched_spawn(&ctx->sched, leaf++ % ctx->threads, sort_task, node);
+    }
+    sched_run(&ctx->sched, 0);
+}
 
-    return NULL;
+// Первое касание tmp_buf: страницы блока выделяются на узле потока,
+// которому sort_part раздает этот лист (блок b - потоку b % threads).
+// Украденный лист касается с процессоров узла владельца, после чего
+// поток возвращается на свой узел.
+static void touch_task(struct sched *s, void *arg, int worker)
+{
+    struct merge_node *node = (struct merge_node *)arg;
+    struct sort_context *ctx = node->ctx;
+    int owner = node->lo % ctx->threads;
+    const struct numa_topology *numa = s->numa;
+    int moved = numa && owner % numa->nodes != worker % numa->nodes && numa_pin(numa, owner) == 0;
+    size_t start = block_start(ctx, node->lo);
+    size_t end = block_start(ctx, node->hi);
+    memset(&ctx->tmp_buf[start], 0, (end - start) * ctx->record_size);
+    if (moved)
+        numa_pin(numa, worker);
 }
 
-int merge_parts(int fd, int num_parts, size_t records_per_part, size_t record_size, const char *filename)
+void first_touch(struct sort_context *ctx, size_t part_records)
 {
-    int tmp_fd = open("tmp.sorted", O_CREAT | O_WRONLY | O_TRUNC, 0666);
-    if (tmp_fd == -1)
+    ctx->part_records = part_records;
+    struct merge_node *next = ctx->nodes;
+    build_tree(ctx, &next, 0, ctx->blocks, NULL);
+    int leaf = 0;
+    for (struct merge_node *node = ctx->nodes; node < next; node++)
     {
-        perror("[Main] open tmp");
-        return 1;
+        if (node->hi - node->lo == 1)
+            sched_spawn(&ctx->sched, leaf++ % ctx->threads, touch_task, node);
     }
+    sched_run(&ctx->sched, 0);
+}
+
+// Финальное слияние делится на куски по рангам результата. Без журнала
+// кусков столько же, сколько потоков; с журналом - около
+// CHECKPOINT_CHUNKS, и их размер зависит только от числа записей, чтобы
+// после сбоя можно было продолжить с другим числом потоков.
+static uint64_t merge_chunk_records(uint64_t total_records)
+{
+    uint64_t chunk = (total_records + CHECKPOINT_CHUNKS - 1) / CHECKPOINT_CHUNKS;
+    if (chunk < CHECKPOINT_MIN_RECORDS)
+        chunk = CHECKPOINT_MIN_RECORDS;
+    if (chunk > CHECKPOINT_MAX_RECORDS)
+        chunk = CHECKPOINT_MAX_RECORDS;
+    return chunk;
+}
 
-    uint64_t total_records = num_parts * records_per_part;
-    if (write(tmp_fd, &total_records, sizeof(uint64_t)) != sizeof(uint64_t))
+static uint64_t merge_chunks(uint64_t total_records, int threads, int journaled)
+{
+    if (!journaled)
+        return threads;
+    uint64_t chunk = merge_chunk_records(total_records);
+    return (total_records + chunk - 1) / chunk;
+}
+
+static uint64_t merge_chunk_rank(uint64_t total_records, uint64_t chunks, uint64_t c, int journaled)
+{
+    if (!journaled)
+        return total_records / chunks * c + total_records % chunks * c / chunks;
+    uint64_t rank = merge_chunk_records(total_records) * c;
+    return rank < total_records ? rank : total_records;
+}
+
+// Кусок отмечается в журнале только после того, как он на диске
+struct chunk_journal
+{
+    struct journal *j;
+    int out_fd;
+};
+
+static int journal_chunk(void *arg, uint64_t chunk)
+{
+    struct chunk_journal *cj = (struct chunk_journal *)arg;
+    if (fdatasync(cj->out_fd) != 0)
     {
-        perror("[Main] write header");
-        close(tmp_fd);
+        perror("[Merge] fdatasync");
         return 1;
     }
+    return journal_mark(cj->j, "chunk", chunk);
+}
+
+// Финальное слияние частей в threads потоков через kmerge_parts: ключи-
+// разделители делят результат на куски, каждый кусок сливается
+// независимо и пишется в out_path по заранее известному смещению.
+// Результат сбрасывается на диск, но не переименовывается. С журналом
+// уже слитые куски пропускаются, а файл результата не обрезается.
+// in_direct_fd - fd, открытый с O_DIRECT, или -1.
+int merge_parts(int fd, int in_direct_fd, uint64_t total_records, size_t records_per_part, const char *out_path,
+                int threads, const struct sort_options *opt, struct metrics *m, struct journal *j)
+{
+    size_t file_size = sizeof(uint64_t) + total_records * RECORD_SIZE;
+    uint64_t chunks = merge_chunks(total_records, threads, j != NULL);
 
-    struct merge_state
+    // Слитые куски доверяются журналу, только если файл результата цел
+    int keep = 0;
+    struct stat st;
+    if (j && stat(out_path, &st) == 0 && (size_t)st.st_size == file_size)
     {
-        struct index_s current;
-        size_t pos;
-        size_t end;
-        int active;
-    };
+        for (uint64_t c = 0; c < chunks && !keep; c++)
+            keep = j->chunk_done[c];
+    }
+    if (j && !keep)
+        memset(j->chunk_done, 0, chunks);
 
-    struct merge_state *states = malloc(sizeof(struct merge_state) * num_parts);
-    if (!states)
+    int tmp_fd = open(out_path, O_CREAT | O_RDWR | (keep ? 0 : O_TRUNC), 0666);
+    if (tmp_fd == -1)
     {
-        perror("[Main] malloc states");
+        perror("[Main] open tmp");
+        return 1;
+    }
+    if (ftruncate(tmp_fd, file_size) == -1)
+    {
+        perror("[Main] ftruncate tmp");
         close(tmp_fd);
         return 1;
     }
-
-    for (int i = 0; i < num_parts; i++)
+    if (pwrite(tmp_fd, &total_records, sizeof(uint64_t), 0) != sizeof(uint64_t))
     {
-        states[i].pos = sizeof(uint64_t) + i * records_per_part * record_size;
-        states[i].end = states[i].pos + records_per_part * record_size;
-        if (lseek(fd, states[i].pos, SEEK_SET) == -1)
-        {
-            perror("[Main] lseek");
-            free(states);
-            close(tmp_fd);
-            return 1;
-        }
-        if (read(fd, &states[i].current, record_size) != (ssize_t)record_size)
-        {
-            perror("[Main] read initial record");
-            free(states);
-            close(tmp_fd);
-            return 1;
-        }
-        states[i].pos += record_size;
-        states[i].active = 1;
+        perror("[Main] write header");
+        close(tmp_fd);
+        return 1;
     }
 
-    while (1)
-    {
-        int min_idx = -1;
-        for (int i = 0; i < num_parts; i++)
-        {
-            if (states[i].active)
-            {
-                if (min_idx == -1 || compare_index(&states[i].current, &states[min_idx].current) < 0)
-                {
-                    min_idx = i;
-                }
-            }
-        }
-        if (min_idx == -1)
-            break;
+    int out_direct_fd = -1;
+    if (opt->direct && (out_direct_fd = open(out_path, O_WRONLY | O_DIRECT)) == -1)
+        perror("[Main] open tmp with O_DIRECT");
 
-        if (write(tmp_fd, &states[min_idx].current, record_size) != (ssize_t)record_size)
-        {
-            perror("[Main] write merged record");
-            free(states);
-            close(tmp_fd);
-            return 1;
-        }
+    uint64_t *ranks = malloc(sizeof(uint64_t) * (chunks + 1));
+    int ret = 1;
+    if (!ranks)
+    {
+        perror("[Main] malloc merge tasks");
+        goto out;
+    }
+    for (uint64_t c = 0; c <= chunks; c++)
+        ranks[c] = merge_chunk_rank(total_records, chunks, c, j != NULL);
+    struct chunk_journal cj = {.j = j, .out_fd = tmp_fd};
 
-        if (states[min_idx].pos < states[min_idx].end)
-        {
-            if (lseek(fd, states[min_idx].pos, SEEK_SET) == -1)
-            {
-                perror("[Main] lseek");
-                free(states);
-                close(tmp_fd);
-                return 1;
-            }
-            if (read(fd, &states[min_idx].current, record_size) != (ssize_t)record_size)
-            {
-                perror("[Main] read next record");
-                free(states);
-                close(tmp_fd);
-                return 1;
-            }
-            states[min_idx].pos += record_size;
-        }
-        else
-        {
-            states[min_idx].active = 0;
-        }
+    struct kmerge_job job = {
+        .f = &rs_index_format,
+        .fd = fd,
+        .out_fd = tmp_fd,
+        .records = total_records,
+        .records_per_part = records_per_part,
+        .chunks = chunks,
+        .ranks = ranks,
+        .done = j ? j->chunk_done : NULL,
+        .chunk_done = j ? journal_chunk : NULL,
+        .arg = &cj,
+        .threads = threads,
+        .read_buf = opt->read_buf,
+        .write_buf = opt->write_buf,
+        .io = {.uring = opt->io == IO_URING, .in_direct_fd = in_direct_fd, .out_direct_fd = out_direct_fd},
+        .verbose = m->verbose,
+        .m = m};
+    ret = kmerge_parts(&job);
+    if (ret == 0 && fsync(tmp_fd) != 0)
+    {
+        perror("[Main] fsync tmp");
+        ret = 1;
     }
 
-    free(states);
+out:
+    free(ranks);
+    if (out_direct_fd != -1)
+        close(out_direct_fd);
     close(tmp_fd);
+    return ret;
+}
 
-    if (rename("tmp.sorted", filename) == -1)
+int make_paths(const char *filename, const char *tmp_dir, struct sort_paths *p)
+{
+    const char *slash = strrchr(filename, '/');
+    const char *base = slash ? slash + 1 : filename;
+    int dir_len = slash ? (int)(slash - filename) : 1;
+    const char *dir = slash ? filename : ".";
+    if (slash == filename)
+        dir_len = 1;
+    if (tmp_dir)
     {
-        perror("[Main] rename");
+        dir = tmp_dir;
+        dir_len = strlen(tmp_dir);
+    }
+    int n1 = snprintf(p->out, sizeof(p->out), "%.*s/%s.sorted.tmp", dir_len, dir, base);
+    int n2 = snprintf(p->runs, sizeof(p->runs), "%.*s/%s.runs", dir_len, dir, base);
+    int n3 = snprintf(p->journal, sizeof(p->journal), "%.*s/%s.journal", dir_len, dir, base);
+    if (n1 >= PATH_MAX || n2 >= PATH_MAX || n3 >= PATH_MAX)
+    {
+        fprintf(stderr, "[Main] temporary path is too long\n");
         return 1;
     }
-
-    printf("[Main] Merged %d parts into %s\n", num_parts, filename);
-    fflush(stdout);
     return 0;
 }
 
-int validate_args(size_t memsize, int blocks, int threads, uint64_t records)
+// Стыкуются ли отсортированные части: последняя запись каждой части не
+// больше первой записи следующей. Тогда файл уже упорядочен целиком.
+int parts_in_order(int fd, uint64_t total_records, size_t records_per_part)
+{
+    for (uint64_t end = records_per_part; end < total_records; end += records_per_part)
+    {
+        struct index_s pair[2];
+        off_t pos = sizeof(uint64_t) + (end - 1) * RECORD_SIZE;
+        if (pread(fd, pair, sizeof(pair), pos) != sizeof(pair))
+            return 0;
+        if (compare_index(&pair[0], &pair[1]) > 0)
+            return 0;
+    }
+    return 1;
+}
+
+int validate_args(size_t memsize, int blocks, int threads)
 {
     int page_size = sysconf(_SC_PAGESIZE);
     if (memsize % page_size != 0)
@@ -283,11 +641,6 @@ int validate_args(size_t memsize, int blocks, int threads, uint64_t records)
         fprintf(stderr, "[Main] memsize must be multiple of page size (%d)\n", page_size);
         return 1;
     }
-    if ((blocks & (blocks - 1)) != 0)
-    {
-        fprintf(stderr, "[Main] blocks must be power of two\n");
-        return 1;
-    }
     if (blocks < MIN_BLOCKS_PER_THREAD * threads)
     {
         fprintf(stderr, "[Main] blocks must be at least %d*threads\n", MIN_BLOCKS_PER_THREAD);
@@ -303,28 +656,213 @@ int validate_args(size_t memsize, int blocks, int threads, uint64_t records)
         fprintf(stderr, "[Main] memsize must be multiple of record size (%zu)\n", RECORD_SIZE);
         return 1;
     }
-    size_t records_per_part = memsize / RECORD_SIZE;
-    if (records % records_per_part != 0)
+    return 0;
+}
+
+// Отображение части файла в память
+struct part_map
+{
+    void *base;
+    size_t size;
+    struct index_s *records;
+    size_t count;
+    pthread_t reader;
+    int reader_started;
+    int src_fd;   // С журналом часть копируется из исходного файла
+    int src_direct; // src_fd с O_DIRECT или -1
+    off_t offset; // Смещение части в файле
+    int status;
+    struct mem_buf *mem; // С io_uring часть читается в этот буфер, NULL - отображение
+};
+
+int map_part(int fd, uint64_t records, size_t records_per_part, int part, int huge, struct part_map *pm)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t data_offset = sizeof(uint64_t) + part * records_per_part * RECORD_SIZE;
+    size_t aligned_offset = data_offset / page_size * page_size;
+    size_t skip_bytes = data_offset - aligned_offset;
+    pm->count = (records - part * records_per_part < records_per_part) ? records - part * records_per_part : records_per_part;
+    pm->size = pm->count * RECORD_SIZE + skip_bytes;
+    pm->reader_started = 0;
+    pm->src_fd = -1;
+    pm->src_direct = -1;
+    pm->offset = data_offset;
+    pm->status = 0;
+    pm->mem = NULL;
+    pm->base = mmap(NULL, pm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, aligned_offset);
+    if (pm->base == MAP_FAILED)
     {
-        fprintf(stderr, "[Main] file records must be multiple of records per part\n");
+        perror("[Main] mmap");
         return 1;
     }
+    pm->records = (struct index_s *)((char *)pm->base + skip_bytes);
+    if (huge != HUGE_OFF)
+        mem_advise_huge(pm->base, pm->size);
     return 0;
 }
 
-int main(int argc, char *argv[])
+// С io_uring часть не отображается, а читается в буфер mem. Остаток
+// смещения по странице сохраняется, чтобы часть годилась для O_DIRECT.
+void buffer_part(uint64_t records, size_t records_per_part, int part, struct mem_buf *mem, struct part_map *pm)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    size_t data_offset = sizeof(uint64_t) + part * records_per_part * RECORD_SIZE;
+    pm->count = (records - part * records_per_part < records_per_part) ? records - part * records_per_part : records_per_part;
+    pm->size = pm->count * RECORD_SIZE + data_offset % page_size;
+    pm->reader_started = 0;
+    pm->src_fd = -1;
+    pm->src_direct = -1;
+    pm->offset = data_offset;
+    pm->status = 0;
+    pm->mem = mem;
+    pm->base = mem->base;
+    pm->records = (struct index_s *)((char *)pm->base + data_offset % page_size);
+}
+
+// Поток упреждающего чтения: касается каждой страницы части, пока
+// пул сортирует предыдущую
+void *reader_func(void *arg)
 {
-    if (argc != 5)
+    struct part_map *pm = (struct part_map *)arg;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    volatile const char *p = (volatile const char *)pm->base;
+    char sum = 0;
+    for (size_t off = 0; off < pm->size; off += page_size)
+        sum += p[off];
+    (void)sum;
+    return NULL;
+}
+
+// Поток загрузки части: в копию с журналом (исходный файл не изменяется,
+// поэтому после сбоя любую часть можно прочитать заново) или в буфер
+// io_uring
+void *copy_func(void *arg)
+{
+    struct part_map *pm = (struct part_map *)arg;
+    if (runio_bulk(0, pm->src_fd, pm->src_direct, (char *)pm->records, pm->count * RECORD_SIZE, pm->offset,
+                   pm->mem != NULL) != 0)
     {
-        fprintf(stderr, "[Main] Usage: %s memsize blocks threads filename\n", argv[0]);
-        return 1;
+        perror("[Reader] read part");
+        pm->status = 1;
     }
+    return NULL;
+}
 
-    size_t memsize = atoll(argv[1]);
-    int blocks = atoi(argv[2]);
-    int threads = atoi(argv[3]);
-    const char *filename = argv[4];
+// src_fd != -1 - часть копируется из src_fd, иначе читается на месте
+void prefetch_part(struct part_map *pm, int mode, int src_fd, int src_direct)
+{
+    if (src_fd != -1)
+    {
+        pm->src_fd = src_fd;
+        pm->src_direct = src_direct;
+        pm->reader_started = pthread_create(&pm->reader, NULL, copy_func, pm) == 0;
+        if (!pm->reader_started)
+            copy_func(pm);
+    }
+    else if (mode == PREFETCH_MADVISE)
+    {
+        posix_madvise(pm->base, pm->size, POSIX_MADV_WILLNEED);
+    }
+    else if (mode == PREFETCH_READER)
+    {
+        pm->reader_started = pthread_create(&pm->reader, NULL, reader_func, pm) == 0;
+        if (!pm->reader_started)
+            posix_madvise(pm->base, pm->size, POSIX_MADV_WILLNEED);
+    }
+}
 
+// Дождаться загрузки части перед сортировкой
+int wait_part(struct part_map *pm)
+{
+    if (pm->src_fd != -1 && pm->reader_started)
+    {
+        pthread_join(pm->reader, NULL);
+        pm->reader_started = 0;
+    }
+    return pm->status;
+}
+
+void unmap_part(struct part_map *pm)
+{
+    if (pm->reader_started)
+        pthread_join(pm->reader, NULL);
+    if (!pm->mem)
+        munmap(pm->base, pm->size);
+}
+
+// Запись отсортированной части из буфера io_uring на ее место в fd
+int store_part(const struct part_map *pm, int fd, int direct_fd)
+{
+    return runio_bulk(1, fd, direct_fd, (char *)pm->records, pm->count * RECORD_SIZE, pm->offset, 1);
+}
+
+// Копия исходного файла под части: тот же размер и заголовок, данные
+// появляются по мере загрузки частей. Если копия не подходит к журналу,
+// журнал начинается заново.
+int open_runs(const char *path, const char *header, struct journal *j, uint64_t records, size_t file_size)
+{
+    int fd = open(path, O_CREAT | O_RDWR, 0666);
+    if (fd == -1)
+    {
+        perror("[Main] open runs");
+        return -1;
+    }
+    struct stat st;
+    if (j->resumed && fstat(fd, &st) == 0 && (size_t)st.st_size == file_size)
+        return fd;
+    if (j->resumed && journal_reset(j, header) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    if (ftruncate(fd, 0) == -1 || ftruncate(fd, file_size) == -1 ||
+        pwrite(fd, &records, sizeof(uint64_t), 0) != sizeof(uint64_t) || fdatasync(fd) != 0)
+    {
+        perror("[Main] create runs");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void remove_temps(const struct sort_paths *paths)
+{
+    unlink(paths->runs);
+    unlink(paths->journal);
+}
+
+// Отображение или буфер io_uring (mem != NULL) для части
+int open_part(int fd, uint64_t records, size_t records_per_part, int part, const struct sort_options *opt,
+              struct mem_buf *mem, struct part_map *pm)
+{
+    if (!mem)
+        return map_part(fd, records, records_per_part, part, opt->huge, pm);
+    buffer_part(records, records_per_part, part, mem, pm);
+    return 0;
+}
+
+void close_direct(int *src_direct, int *work_direct)
+{
+    if (*src_direct != -1)
+        close(*src_direct);
+    if (*work_direct != -1)
+        close(*work_direct);
+    *src_direct = -1;
+    *work_direct = -1;
+}
+
+void close_files(int fd, int work_fd, struct journal *j)
+{
+    if (work_fd != fd)
+        close(work_fd);
+    if (j)
+        journal_close(j);
+    close(fd);
+}
+
+// Сортировка файла на месте с параметрами из командной строки
+static int sort_file(struct sort_options opt, size_t memsize, int blocks, int threads, const char *filename)
+{
     int fd = open(filename, O_RDWR);
     if (fd == -1)
     {
@@ -340,165 +878,599 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    if (validate_args(memsize, blocks, threads, records))
+    if (validate_args(memsize, blocks, threads))
+    {
+        close(fd);
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1)
     {
+        perror("[Main] fstat");
         close(fd);
         return 1;
     }
+    if ((uint64_t)st.st_size < sizeof(uint64_t) + records * RECORD_SIZE)
+    {
+        fprintf(stderr, "[Main] file is shorter than %lu records from its header\n", records);
+        close(fd);
+        return 1;
+    }
+    if (records == 0)
+    {
+        printf("[Main] Nothing to sort in %s\n", filename);
+        close(fd);
+        return 0;
+    }
 
+    // Последняя часть может быть неполной: файл не дополняется до целого числа частей
     size_t records_per_part = memsize / RECORD_SIZE;
-    int num_parts = records / records_per_part;
+    int num_parts = (records + records_per_part - 1) / records_per_part;
 
-    for (int part = 0; part < num_parts; part++)
+    // По умолчанию буферы всех частей во всех потоках слияния вместе
+    // занимают не больше memsize
+    if (opt.read_buf == 0)
+    {
+        opt.read_buf = memsize / num_parts / threads;
+        if (opt.read_buf > MAX_READ_BUF)
+            opt.read_buf = MAX_READ_BUF;
+    }
+    if (opt.write_buf == 0)
+        opt.write_buf = DEFAULT_WRITE_BUF;
+
+    struct sort_paths paths;
+    if (make_paths(filename, opt.tmp_dir, &paths) != 0)
     {
-        size_t data_offset = sizeof(uint64_t) + part * memsize;
-        size_t aligned_offset = (data_offset / sysconf(_SC_PAGESIZE)) * sysconf(_SC_PAGESIZE);
-        size_t skip_bytes = data_offset - aligned_offset;
-        size_t map_size = memsize + skip_bytes;
+        close(fd);
+        return 1;
+    }
 
-        void *mmap_buf = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, aligned_offset);
-        if (mmap_buf == MAP_FAILED)
+    // С журналом части сортируются в копии, а исходный файл не меняется
+    // до rename результата. Заголовок журнала привязывает его к входу и
+    // параметрам, от которых зависят границы частей и кусков слияния.
+    struct journal journal;
+    struct journal *jp = NULL;
+    int work_fd = fd;
+    size_t file_size = sizeof(uint64_t) + records * RECORD_SIZE;
+    char header[256];
+    if (opt.journal)
+    {
+        snprintf(header, sizeof(header), "sort_index journal 1 records %lu part %zu size %ld ino %lu mtime %ld.%09ld\n",
+                 records, records_per_part, (long)st.st_size, (unsigned long)st.st_ino, (long)st.st_mtim.tv_sec,
+                 st.st_mtim.tv_nsec);
+        if (journal_open(&journal, paths.journal, header, num_parts, merge_chunks(records, threads, 1)) != 0)
         {
-            perror("[Main] mmap");
             close(fd);
             return 1;
         }
-
-        struct index_s *buffer = (struct index_s *)((char *)mmap_buf + skip_bytes);
-
-        struct sort_context ctx = {
-            .buffer = buffer,
-            .memsize = memsize,
-            .record_size = RECORD_SIZE,
-            .records_per_part = records_per_part,
-            .blocks = blocks,
-            .threads = threads};
-
-        if (pthread_barrier_init(&ctx.barrier, NULL, threads) != 0)
+        jp = &journal;
+        // Результат записан, прерван только rename. Заголовок совпал,
+        // значит вход не менялся; результат должен быть ему под размер,
+        // иначе он отбрасывается вместе с журналом и сортировка идет заново.
+        struct stat out_st;
+        if (journal.complete && stat(paths.out, &out_st) == 0 && (size_t)out_st.st_size != file_size)
         {
-            perror("[Main] pthread_barrier_init");
-            munmap(mmap_buf, map_size);
-            close(fd);
-            return 1;
+            fprintf(stderr, "[Main] Discarding %s: %ld bytes instead of %zu\n", paths.out, (long)out_st.st_size,
+                    file_size);
+            unlink(paths.out);
         }
-        if (pthread_mutex_init(&ctx.mutex, NULL) != 0)
+        else if (journal.complete && access(paths.out, F_OK) == 0)
         {
-            perror("[Main] pthread_mutex_init");
-            pthread_barrier_destroy(&ctx.barrier);
-            munmap(mmap_buf, map_size);
             close(fd);
-            return 1;
+            int ret = commit_output(paths.out, filename);
+            journal_close(&journal);
+            if (ret == 0)
+            {
+                remove_temps(&paths);
+                printf("[Main] Moved finished result of an interrupted run to %s\n", filename);
+            }
+            return ret;
         }
-
-        ctx.block_map = calloc(blocks, sizeof(int));
-        if (!ctx.block_map)
+        if ((journal.complete && journal_reset(&journal, header) != 0) ||
+            (work_fd = open_runs(paths.runs, header, &journal, records, file_size)) == -1)
         {
-            perror("[Main] calloc block_map");
-            pthread_mutex_destroy(&ctx.mutex);
-            pthread_barrier_destroy(&ctx.barrier);
-            munmap(mmap_buf, map_size);
+            journal_close(&journal);
             close(fd);
             return 1;
         }
-        for (int i = 0; i < blocks; i++)
-        {
-            ctx.block_map[i] = (i < threads) ? 1 : 0;
-        }
+    }
 
-        ctx.tmp_buf = malloc(memsize);
-        if (!ctx.tmp_buf)
+    struct verify_result before;
+    if (opt.verify && verify_file(filename, threads, 0, &before) != 0)
+    {
+        close_files(fd, work_fd, jp);
+        return 1;
+    }
+
+    struct metrics metrics;
+    if (metrics_init(&metrics, threads, records, num_parts) != 0)
+    {
+        perror("[Main] malloc metrics");
+        close_files(fd, work_fd, jp);
+        return 1;
+    }
+    metrics.verbose = opt.verbose;
+    if (metrics_start_progress(&metrics, opt.interval) != 0)
+        perror("[Main] start progress thread");
+
+    // Пул потоков, дерево слияния и tmp_buf общие для всех частей
+    struct sort_context ctx = {
+        .memsize = memsize,
+        .record_size = RECORD_SIZE,
+        .blocks = blocks,
+        .threads = threads,
+        .sort_mode = opt.sort_mode,
+        .metrics = &metrics,
+        .adaptive = opt.adaptive};
+    struct mem_buf tmp_mem;
+    ctx.tmp_buf = mem_alloc(&tmp_mem, memsize, opt.huge) == 0 ? tmp_mem.base : NULL;
+    ctx.nodes = malloc(sizeof(struct merge_node) * (2 * blocks - 1));
+    ctx.block_order = malloc(blocks);
+    int *todo = malloc(sizeof(int) * num_parts);
+    if (!ctx.tmp_buf || !ctx.nodes || !ctx.block_order || !todo)
+    {
+        perror("[Main] malloc tmp_buf");
+        if (ctx.tmp_buf)
+            mem_free(&tmp_mem);
+        free(ctx.nodes);
+        free(ctx.block_order);
+        free(todo);
+        metrics_destroy(&metrics);
+        close_files(fd, work_fd, jp);
+        return 1;
+    }
+    // Потоки раскладываются по узлам NUMA при запуске пула, tmp_buf
+    // размещается их первым касанием
+    struct numa_topology topology;
+    if (opt.numa && numa_detect(&topology) != 0)
+    {
+        perror("[Main] detect NUMA nodes");
+        opt.numa = 0;
+    }
+    if (opt.numa)
+    {
+        printf("[Main] NUMA nodes: %d\n", topology.nodes);
+        fflush(stdout);
+    }
+    int pool = sched_init(&ctx.sched, threads);
+    if (pool == 0)
+    {
+        ctx.sched.numa = opt.numa ? &topology : NULL;
+        pool = sched_start(&ctx.sched);
+        // Очереди уже созданы sched_init и освобождаются здесь
+        if (pool != 0)
+            sched_destroy(&ctx.sched);
+    }
+    if (pool != 0)
+    {
+        perror("[Main] start thread pool");
+        if (opt.numa)
+            numa_free(&topology);
+        mem_free(&tmp_mem);
+        free(ctx.nodes);
+        free(ctx.block_order);
+        free(todo);
+        metrics_destroy(&metrics);
+        close_files(fd, work_fd, jp);
+        return 1;
+    }
+    ctx.sched.metrics = &metrics;
+    if (opt.numa)
+        first_touch(&ctx, records_per_part);
+
+    // Части, отмеченные в журнале, уже отсортированы в копии
+    int todo_count = 0;
+    for (int part = 0; part < num_parts; part++)
+    {
+        if (!jp || !journal.part_done[part])
+            todo[todo_count++] = part;
+    }
+    if (todo_count < num_parts)
+    {
+        atomic_fetch_add(&metrics.parts_done, num_parts - todo_count);
+        printf("[Main] Resuming: %d of %d parts already sorted\n", num_parts - todo_count, num_parts);
+        fflush(stdout);
+    }
+
+    // С io_uring части читаются в два буфера попеременно и пишутся обратно
+    // после сортировки. С O_DIRECT у исходного и рабочего файла есть
+    // вторые дескрипторы для выровненных страниц.
+    struct mem_buf part_mem[2];
+    int uring = opt.io == IO_URING;
+    int src_direct = -1, work_direct = -1;
+    int status = 0;
+    if (uring && mem_alloc(&part_mem[0], memsize + sysconf(_SC_PAGESIZE), opt.huge) != 0)
+        status = 1;
+    else if (uring && mem_alloc(&part_mem[1], memsize + sysconf(_SC_PAGESIZE), opt.huge) != 0)
+    {
+        mem_free(&part_mem[0]);
+        status = 1;
+    }
+    if (status != 0)
+        perror("[Main] malloc part buffers");
+    if (status == 0 && opt.direct)
+    {
+        src_direct = open(filename, O_RDONLY | O_DIRECT);
+        work_direct = open(jp ? paths.runs : filename, O_RDWR | O_DIRECT);
+        if (src_direct == -1 || work_direct == -1)
         {
-            perror("[Main] malloc tmp_buf");
-            free(ctx.block_map);
-            pthread_mutex_destroy(&ctx.mutex);
-            pthread_barrier_destroy(&ctx.barrier);
-            munmap(mmap_buf, map_size);
-            close(fd);
-            return 1;
+            perror("[Main] O_DIRECT is not supported, using buffered I/O");
+            close_direct(&src_direct, &work_direct);
+            opt.direct = 0;
         }
+    }
 
-        pthread_t *thread_ids = NULL;
-        struct thread_data *datas = NULL;
-        if (threads > 1)
+    // Двойная буферизация: следующая часть отображается и читается заранее,
+    // пока пул сортирует текущую. Описатели частей меняются местами, а не
+    // копируются: поток чтения держит указатель на свой.
+    struct part_map maps[2];
+    struct part_map *cur = &maps[0], *next = &maps[1];
+    int src_fd = (jp || uring) ? fd : -1;
+    uint64_t t0 = metrics_now();
+    if (status == 0 && todo_count > 0)
+        status = open_part(work_fd, records, records_per_part, todo[0], &opt, uring ? &part_mem[0] : NULL, cur);
+    if (status == 0 && todo_count > 0)
+        prefetch_part(cur, opt.prefetch, src_fd, src_direct);
+    for (int k = 0; k < todo_count && status == 0; k++)
+    {
+        int part = todo[k];
+        int have_next = k + 1 < todo_count;
+        uint64_t io_start = metrics_now();
+        if (have_next)
         {
-            thread_ids = malloc(sizeof(pthread_t) * (threads - 1));
-            if (!thread_ids)
+            if (open_part(work_fd, records, records_per_part, todo[k + 1], &opt,
+                          uring ? &part_mem[next - maps] : NULL, next) != 0)
             {
-                perror("[Main] malloc thread_ids");
-                goto cleanup;
+                status = 1;
+                have_next = 0;
             }
-            datas = malloc(sizeof(struct thread_data) * threads);
-            if (!datas)
+            else
             {
-                perror("[Main] malloc datas");
-                free(thread_ids);
-                goto cleanup;
+                prefetch_part(next, opt.prefetch, src_fd, src_direct);
             }
+        }
+        if (wait_part(cur) != 0)
+            status = 1;
+        metrics_time(&metrics, 0, PHASE_IO, metrics_now() - io_start);
+        // Объем части считается одинаково при любом вводе-выводе: через
+        // отображение, кольцо io_uring или копию с журналом
+        if (status == 0)
+            metrics_count(&metrics, 0, CNT_BYTES_READ, cur->count * RECORD_SIZE);
 
-            for (int t = 1; t < threads; t++)
+        // Незагруженная часть не сортируется и не отмечается в журнале
+        if (status == 0)
+        {
+            ctx.buffer = cur->records;
+            ctx.part_records = cur->count;
+            sort_part(&ctx);
+        }
+        io_start = metrics_now();
+        if (status == 0 && cur->mem && store_part(cur, work_fd, work_direct) != 0)
+        {
+            perror("[Main] write part");
+            status = 1;
+        }
+        // Часть отмечается в журнале, только когда она на диске
+        if (status == 0 && jp)
+        {
+            if (cur->mem ? fdatasync(work_fd) != 0 : msync(cur->base, cur->size, MS_SYNC) != 0)
+            {
+                perror("[Main] sync part");
+                status = 1;
+            }
+            else
             {
-                datas[t].thread_id = t;
-                datas[t].ctx = &ctx;
-                if (pthread_create(&thread_ids[t - 1], NULL, thread_func, &datas[t]) != 0)
-                {
-                    perror("[Main] pthread_create");
-                    for (int u = 0; u < t - 1; u++)
-                    {
-                        pthread_cancel(thread_ids[u]);
-                    }
-                    free(datas);
-                    free(thread_ids);
-                    goto cleanup;
-                }
+                status = journal_mark(&journal, "part", part);
             }
         }
+        unmap_part(cur);
+        metrics_time(&metrics, 0, PHASE_IO, metrics_now() - io_start);
+        if (status == 0)
+        {
+            metrics_count(&metrics, 0, CNT_BYTES_WRITTEN, cur->count * RECORD_SIZE);
+            atomic_fetch_add(&metrics.parts_done, 1);
+            printf("[Main] Processed part %d of %d\n", part + 1, num_parts);
+            fflush(stdout);
+        }
+        if (have_next && status != 0)
+            unmap_part(next);
+        else if (have_next)
+        {
+            struct part_map *done = cur;
+            cur = next;
+            next = done;
+        }
+    }
 
-        datas = malloc(sizeof(struct thread_data) * threads);
-        if (!datas)
+    sched_stop(&ctx.sched);
+    sched_destroy(&ctx.sched);
+    mem_free(&tmp_mem);
+    free(ctx.nodes);
+    free(ctx.block_order);
+    free(todo);
+    if (opt.numa)
+        numa_free(&topology);
+    if (uring && part_mem[0].base)
+    {
+        mem_free(&part_mem[0]);
+        mem_free(&part_mem[1]);
+    }
+    if (src_direct != -1)
+        close(src_direct);
+    metrics.wall_ns[WALL_PARTS] = metrics_now() - t0;
+    if (status != 0)
+    {
+        metrics_destroy(&metrics);
+        if (work_direct != -1)
+            close(work_direct);
+        close_files(fd, work_fd, jp);
+        return 1;
+    }
+
+    // Без журнала упорядоченные части уже лежат в исходном файле, с
+    // журналом копия с частями сама становится результатом
+    t0 = metrics_now();
+    int in_place = 0, skipped = 0;
+    if (opt.adaptive && parts_in_order(work_fd, records, records_per_part))
+    {
+        printf("[Main] Parts are already in order, final merge skipped\n");
+        fflush(stdout);
+        skipped = 1;
+        in_place = !jp;
+        if (jp && (fsync(work_fd) != 0 || rename(paths.runs, paths.out) == -1))
         {
-            perror("[Main] malloc datas");
-            if (thread_ids)
-                free(thread_ids);
-            goto cleanup;
+            perror("[Main] keep runs as result");
+            status = 1;
         }
-        datas[0].thread_id = 0;
-        datas[0].ctx = &ctx;
-        thread_func(&datas[0]);
+    }
+    else
+    {
+        status = merge_parts(work_fd, work_direct, records, records_per_part, paths.out, threads, &opt, &metrics,
+                             jp);
+    }
+    if (status == 0 && jp)
+        status = journal_complete(&journal);
+    if (status == 0 && !in_place)
+        status = commit_output(paths.out, filename);
+    if (status == 0 && !skipped)
+        printf("[Main] Merged %d parts into %s\n", num_parts, filename);
+    metrics.wall_ns[WALL_FINAL] = metrics_now() - t0;
+    metrics_stop_progress(&metrics);
+    if (status == 0 && opt.summary == SUMMARY_TEXT)
+        metrics_report_text(&metrics, stdout);
+    else if (status == 0 && opt.summary == SUMMARY_JSON)
+        metrics_report_json(&metrics, stdout);
+    else if (status == 0 && opt.summary == SUMMARY_CSV)
+        metrics_report_csv(&metrics, stdout);
+
+    metrics_destroy(&metrics);
+    if (work_direct != -1)
+        close(work_direct);
+    close_files(fd, work_fd, jp);
+    if (status == 0 && jp)
+        remove_temps(&paths);
 
-        if (threads > 1)
+    if (status == 0 && opt.verify)
+    {
+        struct verify_result after;
+        if (verify_file(filename, threads, 1, &after) != 0)
+            return 1;
+        if (!after.sorted)
         {
-            for (int t = 1; t < threads; t++)
-            {
-                if (pthread_join(thread_ids[t - 1], NULL) != 0)
-                {
-                    perror("[Main] pthread_join");
-                }
-            }
+            fprintf(stderr, "[Main] Verify: order violated at record %lu\n", after.violation);
+            status = 1;
         }
+        if (after.checksum != before.checksum || after.records != before.records)
+        {
+            fprintf(stderr, "[Main] Verify: checksum %016lx does not match %016lx before sorting\n", after.checksum,
+                    before.checksum);
+            status = 1;
+        }
+        if (status == 0)
+            printf("[Main] Verified %lu records, checksum %016lx\n", after.records, after.checksum);
+    }
+    return status;
+}
 
-        printf("[Main] Processed part %d of %d\n", part + 1, num_parts);
-        fflush(stdout);
+// Вливание отсортированной партии batch в opt->append_to
+static int append_batch(const char *batch, const struct sort_options *opt, int threads)
+{
+    const char *target = opt->append_to;
+    struct sort_paths paths;
+    if (make_paths(target, opt->tmp_dir, &paths) != 0)
+        return 1;
+    uint64_t t0 = metrics_now();
+    struct append_stats st;
+    if (append_index(batch, target, paths.out, opt->dedup, opt->read_buf, opt->write_buf, &st) != 0)
+        return 1;
+    if (!st.in_place && commit_output(paths.out, target) != 0)
+        return 1;
+    printf("[Main] Appended %lu records to %s %s: %lu records, %lu duplicates dropped, %.3f s\n", st.batch, target,
+           st.in_place ? "in place" : "by merge", st.written, st.dropped, (metrics_now() - t0) / 1e9);
 
-    cleanup:
-        if (ctx.tmp_buf)
-            free(ctx.tmp_buf);
-        if (ctx.block_map)
-            free(ctx.block_map);
-        pthread_mutex_destroy(&ctx.mutex);
-        pthread_barrier_destroy(&ctx.barrier);
-        munmap(mmap_buf, map_size);
-        if (thread_ids)
-            free(thread_ids);
-        if (datas)
-            free(datas);
+    if (opt->verify)
+    {
+        struct verify_result res;
+        if (verify_file(target, threads, 1, &res) != 0)
+            return 1;
+        if (!res.sorted || res.records != st.written)
+        {
+            fprintf(stderr, "[Main] Verify: %s is not sorted or has %lu records instead of %lu\n", target,
+                    res.records, st.written);
+            return 1;
+        }
+        printf("[Main] Verified %lu records in %s\n", res.records, target);
     }
+    return 0;
+}
 
-    if (merge_parts(fd, num_parts, records_per_part, RECORD_SIZE, filename) != 0)
+static void usage(const char *prog)
+{
+    fprintf(stderr, "[Main] Usage: %s [-s qsort|radix|simd] [-p off|madvise|reader] [-r read_buf] [-w write_buf] "
+                    "[-a] [-V] [-v] [-i secs] [-S none|text|json|csv] [-J] [-T tmp_dir] [-H off|thp|hugetlb] [-N] [-I sync|uring] [-D] "
+                    "[-A target [-U keep|exact|time]] "
+                    "memsize blocks threads filename\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    struct sort_options opt = {.prefetch = PREFETCH_MADVISE};
+    int c, dedup_set = 0;
+    while ((c = getopt(argc, argv, "s:p:r:w:aVvi:S:JT:H:NI:DA:U:")) != -1)
     {
-        close(fd);
+        switch (c)
+        {
+        case 's':
+            if (strcmp(optarg, "qsort") == 0)
+                opt.sort_mode = SORT_QSORT;
+            else if (strcmp(optarg, "radix") == 0)
+                opt.sort_mode = SORT_RADIX;
+            else if (strcmp(optarg, "simd") == 0)
+                opt.sort_mode = SORT_SIMD;
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'p':
+            if (strcmp(optarg, "off") == 0)
+                opt.prefetch = PREFETCH_OFF;
+            else if (strcmp(optarg, "madvise") == 0)
+                opt.prefetch = PREFETCH_MADVISE;
+            else if (strcmp(optarg, "reader") == 0)
+                opt.prefetch = PREFETCH_READER;
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            opt.read_buf = atoll(optarg);
+            break;
+        case 'w':
+            opt.write_buf = atoll(optarg);
+            break;
+        case 'a':
+            opt.adaptive = 1;
+            break;
+        case 'V':
+            opt.verify = 1;
+            break;
+        case 'v':
+            opt.verbose = 1;
+            break;
+        case 'i':
+            opt.interval = atoi(optarg);
+            break;
+        case 'J':
+            opt.journal = 1;
+            break;
+        case 'T':
+            opt.tmp_dir = optarg;
+            break;
+        case 'H':
+            if (strcmp(optarg, "off") == 0)
+                opt.huge = HUGE_OFF;
+            else if (strcmp(optarg, "thp") == 0)
+                opt.huge = HUGE_THP;
+            else if (strcmp(optarg, "hugetlb") == 0)
+                opt.huge = HUGE_EXPLICIT;
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'N':
+            opt.numa = 1;
+            break;
+        case 'I':
+            if (strcmp(optarg, "sync") == 0)
+                opt.io = IO_SYNC;
+            else if (strcmp(optarg, "uring") == 0)
+                opt.io = IO_URING;
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'D':
+            opt.direct = 1;
+            break;
+        case 'A':
+            opt.append_to = optarg;
+            break;
+        case 'U':
+            dedup_set = 1;
+            if (strcmp(optarg, "keep") == 0)
+                opt.dedup = DEDUP_KEEP;
+            else if (strcmp(optarg, "exact") == 0)
+                opt.dedup = DEDUP_EXACT;
+            else if (strcmp(optarg, "time") == 0)
+                opt.dedup = DEDUP_TIME;
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'S':
+            if (strcmp(optarg, "none") == 0)
+                opt.summary = SUMMARY_NONE;
+            else if (strcmp(optarg, "text") == 0)
+                opt.summary = SUMMARY_TEXT;
+            else if (strcmp(optarg, "json") == 0)
+                opt.summary = SUMMARY_JSON;
+            else if (strcmp(optarg, "csv") == 0)
+                opt.summary = SUMMARY_CSV;
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 4)
+    {
+        usage(argv[0]);
         return 1;
     }
 
-    close(fd);
-    return 0;
+    if (opt.direct && opt.io != IO_URING)
+    {
+        fprintf(stderr, "[Main] -D requires -I uring\n");
+        return 1;
+    }
+    if (dedup_set && !opt.append_to)
+    {
+        fprintf(stderr, "[Main] -U requires -A\n");
+        usage(argv[0]);
+        return 1;
+    }
+    if (opt.io == IO_URING && !uring_supported())
+    {
+        printf("[Main] io_uring is not available, using mmap and pread/pwrite\n");
+        opt.io = IO_SYNC;
+        opt.direct = 0;
+    }
+
+    simd_init();
+
+    size_t memsize = atoll(argv[optind]);
+    int blocks = atoi(argv[optind + 1]);
+    int threads = atoi(argv[optind + 2]);
+    const char *filename = argv[optind + 3];
+
+    int status = sort_file(opt, memsize, blocks, threads, filename);
+    if (status == 0 && opt.append_to)
+        status = append_batch(filename, &opt, threads);
+    return status;
 }
\ No newline at end of file
@@ -0,0 +1,180 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "metrics.h"
+#include "recsort.h"
+
+// Сортировка произвольных файлов из записей фиксированного размера.
+// Готовые форматы: index - файлы sort_index (тот же порядок, что у
+// compare_index), lab7 - база студентов lab7 (struct record_s) по имени,
+// затем по адресу. Ключи после -F переопределяют формат.
+
+enum summary_mode
+{
+    SUMMARY_NONE,
+    SUMMARY_TEXT,
+    SUMMARY_JSON,
+    SUMMARY_CSV
+};
+
+static const struct
+{
+    const char *name;
+    struct rs_format format;
+} presets[] = {
+    {"index", {16, 8, {RS_KEY_F64, 0, 8}, {RS_KEY_U64, 8, 8}}},
+    {"lab7", {161, 0, {RS_KEY_BYTES, 0, 80}, {RS_KEY_BYTES, 80, 80}}},
+};
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "[Main] Usage: %s [-F index|lab7] [-R record_size] [-O header_size] [-k key] [-K key2] "
+                    "[-r read_buf] [-w write_buf] [-V] [-v] [-i secs] [-S none|text|json|csv] "
+                    "memsize blocks threads filename\n"
+                    "[Main] key: f64:OFF | u64:OFF | i64:OFF | bytes:OFF:LEN\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+    struct rs_format f = {0};
+    struct rs_options opt = {0};
+    int verify = 0, interval = 0, summary = SUMMARY_NONE;
+    int c;
+    while ((c = getopt(argc, argv, "F:R:O:k:K:r:w:Vvi:S:")) != -1)
+    {
+        switch (c)
+        {
+        case 'F':
+        {
+            size_t i = 0;
+            while (i < sizeof(presets) / sizeof(presets[0]) && strcmp(optarg, presets[i].name) != 0)
+                i++;
+            if (i == sizeof(presets) / sizeof(presets[0]))
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            f = presets[i].format;
+            break;
+        }
+        case 'R':
+            f.record_size = atoll(optarg);
+            break;
+        case 'O':
+            f.header_size = atoll(optarg);
+            break;
+        case 'k':
+            if (rs_parse_key(optarg, &f.key) != 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'K':
+            if (rs_parse_key(optarg, &f.key2) != 0)
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        case 'r':
+            opt.read_buf = atoll(optarg);
+            break;
+        case 'w':
+            opt.write_buf = atoll(optarg);
+            break;
+        case 'V':
+            verify = 1;
+            break;
+        case 'v':
+            opt.verbose = 1;
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        case 'S':
+            if (strcmp(optarg, "none") == 0)
+                summary = SUMMARY_NONE;
+            else if (strcmp(optarg, "text") == 0)
+                summary = SUMMARY_TEXT;
+            else if (strcmp(optarg, "json") == 0)
+                summary = SUMMARY_JSON;
+            else if (strcmp(optarg, "csv") == 0)
+                summary = SUMMARY_CSV;
+            else
+            {
+                usage(argv[0]);
+                return 1;
+            }
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 4)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+    if (rs_check_format(&f))
+        return 1;
+
+    opt.memsize = atoll(argv[optind]);
+    opt.blocks = atoi(argv[optind + 1]);
+    opt.threads = atoi(argv[optind + 2]);
+    const char *filename = argv[optind + 3];
+    if (opt.threads < 1 || opt.blocks < opt.threads)
+    {
+        fprintf(stderr, "[Main] threads must be positive and blocks at least threads\n");
+        return 1;
+    }
+
+    struct stat st;
+    uint64_t records;
+    size_t records_per_part;
+    int parts;
+    if (stat(filename, &st) == -1)
+    {
+        perror("[Main] stat");
+        return 1;
+    }
+    if (rs_layout(&f, opt.memsize, st.st_size, &records, &records_per_part, &parts))
+        return 1;
+
+    struct metrics metrics;
+    if (metrics_init(&metrics, opt.threads, records, parts) != 0)
+    {
+        perror("[Main] malloc metrics");
+        return 1;
+    }
+    metrics.verbose = opt.verbose;
+    if (metrics_start_progress(&metrics, interval) != 0)
+        perror("[Main] start progress thread");
+
+    int status = rs_sort_file(filename, &f, &opt, &metrics);
+    metrics_stop_progress(&metrics);
+    if (status == 0 && summary == SUMMARY_TEXT)
+        metrics_report_text(&metrics, stdout);
+    else if (status == 0 && summary == SUMMARY_JSON)
+        metrics_report_json(&metrics, stdout);
+    else if (status == 0 && summary == SUMMARY_CSV)
+        metrics_report_csv(&metrics, stdout);
+    metrics_destroy(&metrics);
+
+    if (status == 0 && verify)
+    {
+        int64_t bad = rs_check_file(filename, &f);
+        if (bad != 0)
+        {
+            if (bad > 0)
+                fprintf(stderr, "[Main] Verify: %ld records out of order\n", bad);
+            return 1;
+        }
+        printf("[Main] Verified %lu records\n", records);
+    }
+    return status;
+}
@@ -0,0 +1,243 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "uring.h"
+
+// Индексы колец разделяются с ядром: чтение с acquire, запись с release
+#define load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static int sys_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// Ядра до 5.6 создают кольцо, но не знают IORING_OP_READ/WRITE и
+// IORING_REGISTER_PROBE; такие отсеиваются вместе с отказом пробы
+static int ops_supported(int fd)
+{
+    static const int ops[] = {IORING_OP_READ, IORING_OP_WRITE, IORING_OP_READ_FIXED, IORING_OP_WRITE_FIXED};
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (!probe)
+        return 0;
+    int ok = syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0;
+    for (size_t i = 0; ok && i < sizeof(ops) / sizeof(ops[0]); i++)
+        ok = ops[i] <= probe->last_op && (probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED);
+    free(probe);
+    return ok;
+}
+
+int uring_supported(void)
+{
+    struct uring u;
+    if (uring_init(&u, 2) != 0)
+        return 0;
+    int ok = ops_supported(u.fd);
+    uring_exit(&u);
+    return ok;
+}
+
+int uring_init(struct uring *u, unsigned entries)
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    memset(u, 0, sizeof(*u));
+    u->fd = sys_setup(entries, &p);
+    if (u->fd < 0)
+        return -1;
+    u->entries = p.sq_entries;
+
+    u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    // Старые ядра без SINGLE_MMAP отображают кольца раздельно
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (u->cq_size > u->sq_size)
+            u->sq_size = u->cq_size;
+        u->cq_size = u->sq_size;
+    }
+    u->sq_ptr = mmap(NULL, u->sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED)
+        goto fail;
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        u->cq_ptr = u->sq_ptr;
+    }
+    else
+    {
+        u->cq_ptr = mmap(NULL, u->cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd,
+                         IORING_OFF_CQ_RING);
+        if (u->cq_ptr == MAP_FAILED)
+        {
+            munmap(u->sq_ptr, u->sq_size);
+            goto fail;
+        }
+    }
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED)
+    {
+        if (u->cq_ptr != u->sq_ptr)
+            munmap(u->cq_ptr, u->cq_size);
+        munmap(u->sq_ptr, u->sq_size);
+        goto fail;
+    }
+
+    char *sq = u->sq_ptr, *cq = u->cq_ptr;
+    u->sq_head = (unsigned *)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned *)(sq + p.sq_off.array);
+    u->cq_head = (unsigned *)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return 0;
+
+fail:
+    close(u->fd);
+    u->fd = -1;
+    return -1;
+}
+
+void uring_exit(struct uring *u)
+{
+    if (u->fd < 0)
+        return;
+    uring_drain(u);
+    munmap(u->sqes, u->sqes_size);
+    if (u->cq_ptr != u->sq_ptr)
+        munmap(u->cq_ptr, u->cq_size);
+    munmap(u->sq_ptr, u->sq_size);
+    close(u->fd);
+    u->fd = -1;
+}
+
+int uring_register(struct uring *u, const struct iovec *iov, unsigned n)
+{
+    if (syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, iov, n) != 0)
+        return -1;
+    u->registered = 1;
+    return 0;
+}
+
+// Разбор готовых завершений; 1 - что-то разобрано
+static int reap(struct uring *u)
+{
+    unsigned head = *u->cq_head;
+    unsigned tail = load_acquire(u->cq_tail);
+    if (head == tail)
+        return 0;
+    for (; head != tail; head++)
+    {
+        struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+        struct uring_req *req = (struct uring_req *)(uintptr_t)cqe->user_data;
+        req->res = cqe->res;
+        req->done = 1;
+        u->inflight--;
+    }
+    store_release(u->cq_head, head);
+    return 1;
+}
+
+int uring_submit(struct uring *u)
+{
+    while (u->pending > 0)
+    {
+        int n = sys_enter(u->fd, u->pending, 0, 0);
+        if (n < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+            {
+                // Кольцо завершений переполнено - сначала освобождаем его
+                if (!reap(u) && sys_enter(u->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+                    return -1;
+                continue;
+            }
+            return -1;
+        }
+        u->pending -= n;
+        u->inflight += n;
+    }
+    return 0;
+}
+
+int uring_prep(struct uring *u, int write, int fd, void *buf, unsigned len, off_t pos, int buf_index,
+               struct uring_req *req)
+{
+    unsigned tail = *u->sq_tail;
+    // Очередь отправки полна: отправляем, а если ядро еще не забрало
+    // записи, ждем любое завершение
+    while (tail - load_acquire(u->sq_head) >= u->entries)
+    {
+        if (uring_submit(u) != 0)
+            return -1;
+        if (tail - load_acquire(u->sq_head) >= u->entries && !reap(u) &&
+            sys_enter(u->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            return -1;
+    }
+
+    unsigned index = tail & *u->sq_mask;
+    struct io_uring_sqe *sqe = &u->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    if (buf_index >= 0 && u->registered)
+    {
+        sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+        sqe->buf_index = buf_index;
+    }
+    else
+    {
+        sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    }
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = pos;
+    sqe->user_data = (uintptr_t)req;
+    req->done = 0;
+    req->res = 0;
+    u->sq_array[index] = index;
+    store_release(u->sq_tail, tail + 1);
+    u->pending++;
+    return 0;
+}
+
+int uring_wait(struct uring *u, struct uring_req *req)
+{
+    if (uring_submit(u) != 0)
+        return -1;
+    while (!req->done)
+    {
+        if (reap(u))
+            continue;
+        if (sys_enter(u->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
+
+int uring_drain(struct uring *u)
+{
+    if (uring_submit(u) != 0)
+        return -1;
+    while (u->inflight > 0)
+    {
+        if (reap(u))
+            continue;
+        if (sys_enter(u->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            return -1;
+    }
+    return 0;
+}
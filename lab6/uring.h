@@ -0,0 +1,61 @@
+#ifndef URING_H
+#define URING_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+// Минимальная обертка io_uring на системных вызовах, без liburing:
+// очередь чтений и записей, зарегистрированные буферы и ожидание
+// конкретного запроса. Кольцо не потокобезопасно - по одному на поток.
+
+// Запрос в полете: его адрес уходит в user_data, завершение
+// записывает результат сюда
+struct uring_req
+{
+    int done;
+    int res; // Байт или -errno
+};
+
+struct uring
+{
+    int fd;
+    unsigned entries;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_sqe *sqes;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    unsigned pending;  // Подготовлено, но не отправлено ядру
+    unsigned inflight; // Отправлено и не завершено
+    int registered;    // Буферы зарегистрированы
+};
+
+// 1, если ядро поддерживает io_uring с нужными операциями чтения и
+// записи и он не запрещен
+int uring_supported(void);
+
+int uring_init(struct uring *u, unsigned entries);
+void uring_exit(struct uring *u);
+
+// Регистрация буферов для READ_FIXED/WRITE_FIXED; 0 - успех
+int uring_register(struct uring *u, const struct iovec *iov, unsigned n);
+
+// Ставит чтение (write = 0) или запись len байт по смещению pos. buf_index
+// >= 0 - номер зарегистрированного буфера, в котором лежит buf. Если
+// очередь полна, отправляет накопленное и ждет место.
+int uring_prep(struct uring *u, int write, int fd, void *buf, unsigned len, off_t pos, int buf_index,
+               struct uring_req *req);
+
+// Отправка подготовленных запросов без ожидания
+int uring_submit(struct uring *u);
+
+// Ожидание завершения req; завершения других запросов разбираются попутно
+int uring_wait(struct uring *u, struct uring_req *req);
+
+// Ожидание всех запросов в полете
+int uring_drain(struct uring *u);
+
+#endif // URING_H
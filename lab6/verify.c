@@ -0,0 +1,285 @@
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "verify.h"
+#include "colfile.h"
+
+struct verify_task
+{
+    const struct index_s *data;
+    uint64_t n;     // Всего записей, чтобы проверить стык со следующим диапазоном
+    uint64_t first; // Диапазон потока [first, last)
+    uint64_t last;
+    int check_order;
+    uint64_t checksum;
+    uint64_t violation; // UINT64_MAX - нарушений нет
+};
+
+static void *verify_thread(void *arg)
+{
+    struct verify_task *task = (struct verify_task *)arg;
+    const struct index_s *data = task->data;
+    uint64_t sum = 0;
+    task->violation = UINT64_MAX;
+    for (uint64_t i = task->first; i < task->last; i++)
+        sum += record_hash(&data[i]);
+    if (task->check_order)
+    {
+        // Последняя запись диапазона сравнивается с первой записью следующего
+        uint64_t end = (task->last == task->n && task->n > 0) ? task->n - 1 : task->last;
+        for (uint64_t i = task->first; i < end; i++)
+        {
+            if (compare_index(&data[i], &data[i + 1]) > 0)
+            {
+                task->violation = i;
+                break;
+            }
+        }
+    }
+    task->checksum = sum;
+    return NULL;
+}
+
+int verify_index(const struct index_s *data, uint64_t n, int threads, int check_order, struct verify_result *res)
+{
+    if (threads < 1)
+        threads = 1;
+    if ((uint64_t)threads > n)
+        threads = n ? n : 1;
+    struct verify_task *tasks = calloc(threads, sizeof(struct verify_task));
+    pthread_t *thread_ids = malloc(sizeof(pthread_t) * threads);
+    if (!tasks || !thread_ids)
+    {
+        perror("[Verify] malloc");
+        free(tasks);
+        free(thread_ids);
+        return 1;
+    }
+
+    for (int t = 0; t < threads; t++)
+    {
+        tasks[t].data = data;
+        tasks[t].n = n;
+        tasks[t].first = n * t / threads;
+        tasks[t].last = n * (t + 1) / threads;
+        tasks[t].check_order = check_order;
+    }
+    int started = 1;
+    for (; started < threads; started++)
+    {
+        if (pthread_create(&thread_ids[started], NULL, verify_thread, &tasks[started]) != 0)
+            break;
+    }
+    verify_thread(&tasks[0]);
+    for (int t = started; t < threads; t++)
+        verify_thread(&tasks[t]);
+    for (int t = 1; t < started; t++)
+        pthread_join(thread_ids[t], NULL);
+
+    res->records = n;
+    res->checksum = 0;
+    res->sorted = 1;
+    res->violation = 0;
+    for (int t = 0; t < threads; t++)
+    {
+        res->checksum += tasks[t].checksum;
+        // Диапазоны идут по возрастанию, первое нарушение - у первого потока с нарушением
+        if (res->sorted && tasks[t].violation != UINT64_MAX)
+        {
+            res->sorted = 0;
+            res->violation = tasks[t].violation;
+            res->pair[0] = data[res->violation];
+            res->pair[1] = data[res->violation + 1];
+        }
+    }
+    free(tasks);
+    free(thread_ids);
+    return 0;
+}
+
+// Колоночный файл: потоки декодируют свои блоки и проверяют каждый
+// блок отдельно, стыки блоков сверяются после по первой и последней записи
+struct col_task
+{
+    const struct col_file *f;
+    uint32_t first; // Диапазон блоков [first, last)
+    uint32_t last;
+    int check_order;
+    uint64_t checksum;
+    uint64_t *violation;   // Нарушение внутри блока, UINT64_MAX - нет
+    struct index_s *edges; // Первая и последняя запись каждого блока
+    int status;
+};
+
+static void *col_verify_thread(void *arg)
+{
+    struct col_task *task = (struct col_task *)arg;
+    const struct col_file *f = task->f;
+    struct index_s *buf = malloc(sizeof(struct index_s) * f->hdr.block_records);
+    task->status = 1;
+    if (!buf)
+        return NULL;
+    for (uint32_t b = task->first; b < task->last; b++)
+    {
+        int n = col_decode_block(f, b, buf);
+        if (n <= 0)
+        {
+            fprintf(stderr, "[Verify] block %u is corrupted\n", b);
+            free(buf);
+            return NULL;
+        }
+        struct verify_task block = {.data = buf, .n = n, .first = 0, .last = n, .check_order = task->check_order};
+        verify_thread(&block);
+        task->checksum += block.checksum;
+        task->violation[b] = block.violation;
+        task->edges[2 * b] = buf[0];
+        task->edges[2 * b + 1] = buf[n - 1];
+    }
+    free(buf);
+    task->status = 0;
+    return NULL;
+}
+
+static int verify_columnar(const char *filename, int threads, int check_order, struct verify_result *res)
+{
+    struct col_file f;
+    if (col_open(&f, filename) != 0)
+        return 1;
+    uint32_t blocks = f.hdr.blocks;
+    if (threads < 1)
+        threads = 1;
+    if ((uint32_t)threads > blocks)
+        threads = blocks ? blocks : 1;
+    struct col_task *tasks = calloc(threads, sizeof(struct col_task));
+    pthread_t *thread_ids = malloc(sizeof(pthread_t) * threads);
+    uint64_t *violation = malloc(sizeof(uint64_t) * (blocks + 1));
+    struct index_s *edges = malloc(sizeof(struct index_s) * 2 * (blocks + 1));
+    int ret = 1;
+    if (!tasks || !thread_ids || !violation || !edges)
+    {
+        perror("[Verify] malloc");
+        goto out;
+    }
+
+    for (int t = 0; t < threads; t++)
+    {
+        tasks[t].f = &f;
+        tasks[t].first = (uint64_t)blocks * t / threads;
+        tasks[t].last = (uint64_t)blocks * (t + 1) / threads;
+        tasks[t].check_order = check_order;
+        tasks[t].violation = violation;
+        tasks[t].edges = edges;
+    }
+    int started = 1;
+    for (; started < threads; started++)
+    {
+        if (pthread_create(&thread_ids[started], NULL, col_verify_thread, &tasks[started]) != 0)
+            break;
+    }
+    col_verify_thread(&tasks[0]);
+    for (int t = started; t < threads; t++)
+        col_verify_thread(&tasks[t]);
+    for (int t = 1; t < started; t++)
+        pthread_join(thread_ids[t], NULL);
+
+    res->records = f.hdr.records;
+    res->checksum = 0;
+    res->sorted = 1;
+    res->violation = 0;
+    ret = 0;
+    for (int t = 0; t < threads; t++)
+    {
+        res->checksum += tasks[t].checksum;
+        if (tasks[t].status != 0)
+            ret = 1;
+    }
+    for (uint32_t b = 0; b < blocks && check_order && ret == 0 && res->sorted; b++)
+    {
+        uint64_t start = (uint64_t)b * f.hdr.block_records;
+        if (b > 0 && compare_index(&edges[2 * b - 1], &edges[2 * b]) > 0)
+        {
+            res->sorted = 0;
+            res->violation = start - 1;
+            res->pair[0] = edges[2 * b - 1];
+            res->pair[1] = edges[2 * b];
+        }
+        else if (violation[b] != UINT64_MAX)
+        {
+            // Нарушение внутри блока: блок декодируется еще раз ради самих записей
+            struct index_s *buf = malloc(sizeof(struct index_s) * f.hdr.block_records);
+            res->sorted = 0;
+            res->violation = start + violation[b];
+            if (buf && col_decode_block(&f, b, buf) > 0)
+            {
+                res->pair[0] = buf[violation[b]];
+                res->pair[1] = buf[violation[b] + 1];
+            }
+            free(buf);
+        }
+    }
+
+out:
+    free(tasks);
+    free(thread_ids);
+    free(violation);
+    free(edges);
+    col_close(&f);
+    return ret;
+}
+
+int verify_file(const char *filename, int threads, int check_order, struct verify_result *res)
+{
+    int fd = open(filename, O_RDONLY);
+    if (fd == -1)
+    {
+        perror("[Verify] open");
+        return 1;
+    }
+    if (col_detect(fd))
+    {
+        close(fd);
+        return verify_columnar(filename, threads, check_order, res);
+    }
+
+    uint64_t records;
+    struct stat st;
+    if (pread(fd, &records, sizeof(uint64_t), 0) != sizeof(uint64_t))
+    {
+        perror("[Verify] read header");
+        close(fd);
+        return 1;
+    }
+    if (fstat(fd, &st) == -1)
+    {
+        perror("[Verify] fstat");
+        close(fd);
+        return 1;
+    }
+    size_t file_size = sizeof(uint64_t) + records * RECORD_SIZE;
+    if ((uint64_t)st.st_size < file_size)
+    {
+        fprintf(stderr, "[Verify] file is shorter than %lu records from its header\n", records);
+        close(fd);
+        return 1;
+    }
+
+    void *map = mmap(NULL, file_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+    {
+        perror("[Verify] mmap");
+        return 1;
+    }
+    posix_madvise(map, file_size, POSIX_MADV_SEQUENTIAL);
+    posix_madvise(map, file_size, POSIX_MADV_WILLNEED);
+
+    const struct index_s *data = (const struct index_s *)((const char *)map + sizeof(uint64_t));
+    int ret = verify_index(data, records, threads, check_order, res);
+    munmap(map, file_size);
+    return ret;
+}
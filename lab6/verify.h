@@ -0,0 +1,37 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+#include <stdint.h>
+#include "index.h"
+
+// Проверка индексного файла: упорядоченность по compare_index и
+// контрольная сумма, не зависящая от порядка записей. Сумма хэшей всех
+// записей (time_mark и recno) по модулю 2^64 совпадает до и после
+// сортировки, если записи только переставлялись.
+struct verify_result
+{
+    uint64_t records;
+    uint64_t checksum;
+    int sorted;
+    uint64_t violation;     // Первая позиция i, где запись i больше записи i + 1
+    struct index_s pair[2]; // Записи i и i + 1 у нарушения
+};
+
+static inline uint64_t record_hash(const struct index_s *rec)
+{
+    uint64_t bits;
+    memcpy(&bits, &rec->time_mark, sizeof(bits));
+    uint64_t z = bits * 0x9e3779b97f4a7c15ULL ^ rec->recno;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Проверка n записей в памяти в threads потоков. check_order = 0 -
+// только контрольная сумма. Возвращает 0, если проверку удалось провести.
+int verify_index(const struct index_s *data, uint64_t n, int threads, int check_order, struct verify_result *res);
+
+// То же для файла: заголовок, отображение в память, проверка.
+int verify_file(const char *filename, int threads, int check_order, struct verify_result *res);
+
+#endif // VERIFY_H
@@ -1,35 +1,132 @@
 #define _POSIX_C_SOURCE 200809L
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include "index.h"
+#include "verify.h"
+#include "colfile.h"
 
-struct index_s
+static void usage(const char *prog)
 {
-    double time_mark;
-    uint64_t recno;
-};
+    fprintf(stderr, "[Main] Usage: %s [-c | -V] [-t threads] [-k checksum] filename\n", prog);
+}
 
-struct index_hdr_s
+// Режимы -c и -V: контрольная сумма и, для -V, проверка порядка.
+// С -k сумма сравнивается с ожидаемой, например посчитанной до сортировки.
+static int check_file(const char *filename, int threads, int check_order, int have_expected, uint64_t expected)
 {
-    uint64_t records;
-    struct index_s idx[];
-};
+    struct verify_result res;
+    if (verify_file(filename, threads, check_order, &res) != 0)
+        return 1;
+
+    int ok = 1;
+    printf("[Main] Records: %lu, checksum: %016lx\n", res.records, res.checksum);
+    if (check_order && res.sorted)
+    {
+        printf("[Main] Order: sorted\n");
+    }
+    else if (check_order)
+    {
+        ok = 0;
+        printf("[Main] Order: violated at record %lu\n", res.violation);
+        for (int i = 0; i < 2; i++)
+            printf("[Main]   %lu: time_mark: %.6f, recno: %lu\n", res.violation + i, res.pair[i].time_mark,
+                   res.pair[i].recno);
+    }
+    if (have_expected && res.checksum != expected)
+    {
+        ok = 0;
+        printf("[Main] Checksum mismatch: expected %016lx\n", expected);
+    }
+    else if (have_expected)
+    {
+        printf("[Main] Checksum: matches\n");
+    }
+    fflush(stdout);
+    return ok ? 0 : 2;
+}
+
+// Печать колоночного файла поблочно
+static int print_columnar(const char *filename)
+{
+    struct col_file f;
+    if (col_open(&f, filename) != 0)
+        return 1;
+    struct index_s *buf = malloc(sizeof(struct index_s) * f.hdr.block_records);
+    if (!buf)
+    {
+        perror("[Main] malloc");
+        col_close(&f);
+        return 1;
+    }
+
+    printf("[Main] Records: %lu, blocks: %u\n", f.hdr.records, f.hdr.blocks);
+    fflush(stdout);
+    int ret = 0;
+    for (uint32_t b = 0; b < f.hdr.blocks; b++)
+    {
+        int n = col_decode_block(&f, b, buf);
+        if (n < 0)
+        {
+            fprintf(stderr, "[Main] block %u is corrupted\n", b);
+            ret = 1;
+            break;
+        }
+        for (int i = 0; i < n; i++)
+            printf("[Main] time_mark: %.6f, recno: %lu\n", buf[i].time_mark, buf[i].recno);
+        fflush(stdout);
+    }
+    free(buf);
+    col_close(&f);
+    return ret;
+}
 
 int main(int argc, char *argv[])
 {
-    if (argc != 2)
+    int mode = 0, threads = sysconf(_SC_NPROCESSORS_ONLN), have_expected = 0;
+    uint64_t expected = 0;
+    int c;
+    while ((c = getopt(argc, argv, "cVt:k:")) != -1)
     {
-        fprintf(stderr, "[Main] Usage: %s filename\n", argv[0]);
+        switch (c)
+        {
+        case 'c':
+        case 'V':
+            mode = c;
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'k':
+            expected = strtoull(optarg, NULL, 16);
+            have_expected = 1;
+            break;
+        default:
+            usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 1 || (have_expected && !mode))
+    {
+        usage(argv[0]);
         return 1;
     }
+    if (mode)
+        return check_file(argv[optind], threads, mode == 'V', have_expected, expected);
 
-    int fd = open(argv[1], O_RDONLY);
+    int fd = open(argv[optind], O_RDONLY);
     if (fd == -1)
     {
         perror("[Main] open");
         return 1;
     }
+    if (col_detect(fd))
+    {
+        close(fd);
+        return print_columnar(argv[optind]);
+    }
 
     uint64_t records;
     if (read(fd, &records, sizeof(uint64_t)) != sizeof(uint64_t))